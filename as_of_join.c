@@ -0,0 +1,440 @@
+/**
+ * as_of_join.c -
+ * Joins every row of a fact table to the version of a temporal dimension that
+ * was valid at the fact's time, in one merge pass over both tables.
+ *
+ * Both sides are read in key order, the facts by time and the dimension by
+ * the start of its era, so each dimension row is looked at once, however many
+ * facts fall in it.  That takes the place of an index probe per fact.
+ */
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <catalog/pg_type.h>
+#include <executor/spi.h>
+#include <funcapi.h>
+#include <lib/stringinfo.h>
+#include <miscadmin.h>
+#include <utils/array.h>
+#include <utils/builtins.h>
+#include <utils/lsyscache.h>
+#include <utils/tuplestore.h>
+#include <utils/typcache.h>
+
+#include "sql_saga.h"
+
+PGDLLEXPORT Datum as_of_join(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(as_of_join);
+
+/* Rows fetched from each side at a time */
+#define AS_OF_JOIN_BATCH_SIZE	1000
+
+/*
+ * One side of the join: a cursor and the batch of rows read from it.
+ */
+typedef struct AsOfJoinSide
+{
+	Portal		portal;
+	SPITupleTable *tuptable;
+	uint64		processed;
+	uint64		pos;
+	bool		done;
+} AsOfJoinSide;
+
+/*
+ * The comparison functions, shared by both sides as the types must match.
+ */
+typedef struct AsOfJoinKeys
+{
+	int			nkeys;
+	TypeCacheEntry *key_typcache[INDEX_MAX_KEYS];
+	Oid			key_collation[INDEX_MAX_KEYS];
+	TypeCacheEntry *time_typcache;
+} AsOfJoinKeys;
+
+static void
+AsOfJoinOpen(AsOfJoinSide *side, const char *sql)
+{
+	side->portal = SPI_cursor_open_with_args(NULL, sql, 0, NULL, NULL, NULL, true, 0);
+	side->tuptable = NULL;
+	side->processed = 0;
+	side->pos = 0;
+	side->done = false;
+}
+
+/*
+ * Returns the current row of the side, or NULL when it has run out.
+ */
+static HeapTuple
+AsOfJoinCurrent(AsOfJoinSide *side)
+{
+	if (side->pos < side->processed)
+		return side->tuptable->vals[side->pos];
+
+	if (side->done)
+		return NULL;
+
+	if (side->tuptable != NULL)
+		SPI_freetuptable(side->tuptable);
+
+	SPI_cursor_fetch(side->portal, true, AS_OF_JOIN_BATCH_SIZE);
+	side->tuptable = SPI_tuptable;
+	side->processed = SPI_processed;
+	side->pos = 0;
+
+	if (side->processed == 0)
+	{
+		side->done = true;
+		return NULL;
+	}
+
+	return side->tuptable->vals[0];
+}
+
+static void
+AsOfJoinAdvance(AsOfJoinSide *side)
+{
+	side->pos++;
+}
+
+static void
+AsOfJoinClose(AsOfJoinSide *side)
+{
+	if (side->tuptable != NULL)
+		SPI_freetuptable(side->tuptable);
+	SPI_cursor_close(side->portal);
+}
+
+/*
+ * Both queries return the whole row first and the key columns after it.
+ */
+static int
+AsOfJoinCompareKeys(const AsOfJoinKeys *keys,
+					HeapTuple fact, TupleDesc fact_desc,
+					HeapTuple dimension, TupleDesc dimension_desc)
+{
+	int			i;
+
+	for (i = 0; i < keys->nkeys; i++)
+	{
+		Datum		a,
+					b;
+		bool		isnull;
+		int32		cmp;
+
+		a = SPI_getbinval(fact, fact_desc, i + 2, &isnull);
+		b = SPI_getbinval(dimension, dimension_desc, i + 2, &isnull);
+		cmp = DatumGetInt32(FunctionCall2Coll(&keys->key_typcache[i]->cmp_proc_finfo,
+											  keys->key_collation[i], a, b));
+		if (cmp != 0)
+			return cmp;
+	}
+
+	return 0;
+}
+
+static int
+AsOfJoinCompareTimes(const AsOfJoinKeys *keys, Datum a, Datum b)
+{
+	return DatumGetInt32(FunctionCall2Coll(&keys->time_typcache->cmp_proc_finfo,
+										   keys->time_typcache->typcollation, a, b));
+}
+
+static TypeCacheEntry *
+AsOfJoinTypeCache(Oid type)
+{
+	TypeCacheEntry *typcache = lookup_type_cache(type, TYPECACHE_CMP_PROC_FINFO);
+
+	if (!OidIsValid(typcache->cmp_proc_finfo.fn_oid))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_FUNCTION),
+				 errmsg("could not identify a comparison function for type %s",
+						format_type_be(type))));
+
+	return typcache;
+}
+
+static char *
+AsOfJoinTableName(Oid relid)
+{
+	return quote_qualified_identifier(get_namespace_name(get_rel_namespace(relid)),
+									  get_rel_name(relid));
+}
+
+/*
+ * as_of_join -
+ * Returns (fact, dimension) for every fact row and the row of the
+ * dimension's unique key with the same key whose era contains the fact's
+ * time.  Facts without such a row are left out, like in an inner join.
+ */
+Datum
+as_of_join(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Oid			fact_relid;
+	ArrayType  *fact_key_columns;
+	Name		fact_time_column;
+	Oid			dimension_relid;
+	SagaUniqueKey uk;
+	AsOfJoinKeys keys;
+	AsOfJoinSide facts;
+	AsOfJoinSide dimensions;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext oldcontext;
+	Datum	   *names;
+	bool	   *name_nulls;
+	int			nkeys;
+	char	   *fact_columns[INDEX_MAX_KEYS];
+	AttrNumber	fact_time_attnum;
+	char	   *fact_table;
+	char	   *dimension_table;
+	StringInfoData sql;
+	HeapTuple	fact;
+	HeapTuple	dimension;
+	int			i;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) || PG_ARGISNULL(3))
+		ereport(ERROR,
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				 errmsg("only dimension_key can be NULL in as_of_join")));
+
+	fact_relid = PG_GETARG_OID(0);
+	fact_key_columns = PG_GETARG_ARRAYTYPE_P(1);
+	fact_time_column = PG_GETARG_NAME(2);
+	dimension_relid = PG_GETARG_OID(3);
+
+	/* The rows come back whole, typed by the column definition list */
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	if (tupdesc->natts != 2 ||
+		TupleDescAttr(tupdesc, 0)->atttypid != get_rel_type_id(fact_relid) ||
+		TupleDescAttr(tupdesc, 1)->atttypid != get_rel_type_id(dimension_relid))
+		ereport(ERROR,
+				(errcode(ERRCODE_DATATYPE_MISMATCH),
+				 errmsg("as_of_join must return the row types of \"%s\" and \"%s\"",
+						get_rel_name(fact_relid), get_rel_name(dimension_relid))));
+
+	tupstore = tuplestore_begin_heap((rsinfo->allowedModes & SFRM_Materialize_Random) != 0,
+									 false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	/* Take the first unique key of the dimension if none was given */
+	if (PG_ARGISNULL(4))
+	{
+		Oid			argtypes[1] = {REGCLASSOID};
+		Datum		values[1];
+		bool		isnull;
+		int			ret;
+		NameData	key_name;
+
+		values[0] = ObjectIdGetDatum(dimension_relid);
+		ret = SPI_execute_with_args("SELECT uk.key_name "
+									"FROM sql_saga.unique_keys AS uk "
+									"WHERE uk.table_name = $1 "
+									"ORDER BY uk.key_name "
+									"LIMIT 1",
+									1, argtypes, values, NULL, true, 1);
+		if (ret != SPI_OK_SELECT)
+			elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+		if (SPI_processed == 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_OBJECT),
+					 errmsg("table \"%s\" has no unique key",
+							get_rel_name(dimension_relid))));
+
+		namestrcpy(&key_name, NameStr(*DatumGetName(SPI_getbinval(SPI_tuptable->vals[0],
+																  SPI_tuptable->tupdesc,
+																  1, &isnull))));
+		uk = *SagaLookupUniqueKey(NameStr(key_name), false);
+	}
+	else
+	{
+		uk = *SagaLookupUniqueKey(NameStr(*PG_GETARG_NAME(4)), false);
+		if (uk.relid != dimension_relid)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("unique key \"%s\" is not on table \"%s\"",
+							NameStr(uk.key_name), get_rel_name(dimension_relid))));
+	}
+
+	deconstruct_array(fact_key_columns, NAMEOID, NAMEDATALEN, false, 'c', &names, &name_nulls, &nkeys);
+	if (nkeys != uk.nkeys)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("fact_key_columns must have as many columns as unique key \"%s\"",
+						NameStr(uk.key_name))));
+
+	/* The keys are compared with one function, so the types must match */
+	keys.nkeys = nkeys;
+	for (i = 0; i < nkeys; i++)
+	{
+		AttrNumber	attnum;
+		Oid			fact_type,
+					dimension_type;
+		int32		typmod;
+		Oid			fact_collation,
+					dimension_collation;
+
+		if (name_nulls[i])
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("fact_key_columns can not contain NULL")));
+
+		fact_columns[i] = NameStr(*DatumGetName(names[i]));
+		attnum = get_attnum(fact_relid, fact_columns[i]);
+		if (attnum == InvalidAttrNumber)
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_COLUMN),
+					 errmsg("column \"%s\" does not exist", fact_columns[i])));
+
+		get_atttypetypmodcoll(fact_relid, attnum, &fact_type, &typmod, &fact_collation);
+		get_atttypetypmodcoll(dimension_relid, uk.attnums[i], &dimension_type, &typmod, &dimension_collation);
+		if (fact_type != dimension_type || fact_collation != dimension_collation)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATATYPE_MISMATCH),
+					 errmsg("column \"%s\" does not match column \"%s\" of unique key \"%s\"",
+							fact_columns[i], NameStr(uk.column_names[i]), NameStr(uk.key_name))));
+
+		keys.key_typcache[i] = AsOfJoinTypeCache(fact_type);
+		keys.key_collation[i] = fact_collation;
+	}
+
+	fact_time_attnum = get_attnum(fact_relid, NameStr(*fact_time_column));
+	if (fact_time_attnum == InvalidAttrNumber)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("column \"%s\" does not exist", NameStr(*fact_time_column))));
+	if (get_atttype(fact_relid, fact_time_attnum) != uk.element_type)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATATYPE_MISMATCH),
+				 errmsg("column \"%s\" does not match the era of unique key \"%s\"",
+						NameStr(*fact_time_column), NameStr(uk.key_name))));
+	keys.time_typcache = AsOfJoinTypeCache(uk.element_type);
+
+	fact_table = AsOfJoinTableName(fact_relid);
+	dimension_table = AsOfJoinTableName(dimension_relid);
+
+	/*
+	 * SELECT sql_saga_fact, sql_saga_fact.k..., sql_saga_fact.t
+	 * FROM fact AS sql_saga_fact
+	 * WHERE k IS NOT NULL AND ... AND t IS NOT NULL
+	 * ORDER BY k..., t
+	 */
+	initStringInfo(&sql);
+	appendStringInfoString(&sql, "SELECT sql_saga_fact");
+	for (i = 0; i < nkeys; i++)
+		appendStringInfo(&sql, ", sql_saga_fact.%s", quote_identifier(fact_columns[i]));
+	appendStringInfo(&sql, ", sql_saga_fact.%s FROM %s AS sql_saga_fact WHERE ",
+					 quote_identifier(NameStr(*fact_time_column)), fact_table);
+	for (i = 0; i < nkeys; i++)
+		appendStringInfo(&sql, "sql_saga_fact.%s IS NOT NULL AND ", quote_identifier(fact_columns[i]));
+	appendStringInfo(&sql, "sql_saga_fact.%s IS NOT NULL ORDER BY ",
+					 quote_identifier(NameStr(*fact_time_column)));
+	for (i = 0; i < nkeys; i++)
+		appendStringInfo(&sql, "sql_saga_fact.%s, ", quote_identifier(fact_columns[i]));
+	appendStringInfo(&sql, "sql_saga_fact.%s", quote_identifier(NameStr(*fact_time_column)));
+	AsOfJoinOpen(&facts, sql.data);
+
+	/*
+	 * SELECT sql_saga_dimension, sql_saga_dimension.k..., start, end
+	 * FROM dimension AS sql_saga_dimension
+	 * WHERE k IS NOT NULL AND ... AND start IS NOT NULL AND end IS NOT NULL
+	 * ORDER BY k..., start
+	 */
+	resetStringInfo(&sql);
+	appendStringInfoString(&sql, "SELECT sql_saga_dimension");
+	for (i = 0; i < nkeys; i++)
+		appendStringInfo(&sql, ", sql_saga_dimension.%s", quote_identifier(NameStr(uk.column_names[i])));
+	appendStringInfo(&sql, ", sql_saga_dimension.%s, sql_saga_dimension.%s FROM %s AS sql_saga_dimension WHERE ",
+					 quote_identifier(NameStr(uk.start_column_name)),
+					 quote_identifier(NameStr(uk.end_column_name)),
+					 dimension_table);
+	for (i = 0; i < nkeys; i++)
+		appendStringInfo(&sql, "sql_saga_dimension.%s IS NOT NULL AND ",
+						 quote_identifier(NameStr(uk.column_names[i])));
+	appendStringInfo(&sql, "sql_saga_dimension.%s IS NOT NULL AND sql_saga_dimension.%s IS NOT NULL ORDER BY ",
+					 quote_identifier(NameStr(uk.start_column_name)),
+					 quote_identifier(NameStr(uk.end_column_name)));
+	for (i = 0; i < nkeys; i++)
+		appendStringInfo(&sql, "sql_saga_dimension.%s, ", quote_identifier(NameStr(uk.column_names[i])));
+	appendStringInfo(&sql, "sql_saga_dimension.%s", quote_identifier(NameStr(uk.start_column_name)));
+	AsOfJoinOpen(&dimensions, sql.data);
+
+	/*
+	 * The unique key keeps the eras of one key from overlapping, so at most
+	 * one dimension row matches each fact.  A dimension row that ends at or
+	 * before a fact's time can't match any later fact of that key either.
+	 */
+	while ((fact = AsOfJoinCurrent(&facts)) != NULL)
+	{
+		TupleDesc	fact_desc = facts.tuptable->tupdesc;
+		Datum		time;
+		bool		isnull;
+		int			cmp = 0;
+
+		CHECK_FOR_INTERRUPTS();
+
+		time = SPI_getbinval(fact, fact_desc, nkeys + 2, &isnull);
+
+		while ((dimension = AsOfJoinCurrent(&dimensions)) != NULL)
+		{
+			TupleDesc	dimension_desc = dimensions.tuptable->tupdesc;
+
+			cmp = AsOfJoinCompareKeys(&keys, fact, fact_desc, dimension, dimension_desc);
+			if (cmp < 0)
+				break;
+			if (cmp == 0 &&
+				AsOfJoinCompareTimes(&keys, SPI_getbinval(dimension, dimension_desc, nkeys + 3, &isnull),
+									 time) > 0)
+				break;
+
+			AsOfJoinAdvance(&dimensions);
+		}
+
+		/* Nothing is left to match the rest of the facts */
+		if (dimension == NULL)
+			break;
+
+		if (cmp == 0 &&
+			AsOfJoinCompareTimes(&keys, SPI_getbinval(dimension, dimensions.tuptable->tupdesc, nkeys + 2, &isnull),
+								 time) <= 0)
+		{
+			Datum		values[2];
+			bool		nulls[2] = {false, false};
+
+			values[0] = SPI_getbinval(fact, fact_desc, 1, &isnull);
+			values[1] = SPI_getbinval(dimension, dimensions.tuptable->tupdesc, 1, &isnull);
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		}
+
+		AsOfJoinAdvance(&facts);
+	}
+
+	AsOfJoinClose(&facts);
+	AsOfJoinClose(&dimensions);
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+
+	return (Datum) 0;
+}
@@ -0,0 +1,6 @@
+-- fk_insert_check: insert a stat covered by one version of its unit
+\set unit random(1, :units)
+\set version random(0, :versions - 1)
+BEGIN;
+INSERT INTO bench_stat (unit_id, valid_from, valid_to, value) VALUES (:unit, :version * 10, :version * 10 + 10, 0);
+ROLLBACK;
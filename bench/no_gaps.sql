@@ -0,0 +1,3 @@
+-- no_gaps: aggregate all the versions of a unit
+\set unit random(1, :units)
+SELECT sql_saga.no_gaps(int4range(valid_from, valid_to), int4range(0, :versions * 10)) FROM bench_unit WHERE id = :unit;
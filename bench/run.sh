@@ -0,0 +1,72 @@
+#!/bin/sh
+#
+# Run the pgbench scripts in this directory against a fresh database and
+# print one JSON object per benchmark, so results can be compared between
+# releases.
+#
+# The scale and the run are set in the environment:
+#
+#   BENCH_DB        database to (re)create, default sql_saga_bench
+#   BENCH_UNITS     number of units, default 1000
+#   BENCH_VERSIONS  versions per unit, at least 2, default 10
+#   BENCH_CLIENTS   pgbench clients, default 1
+#   BENCH_DURATION  seconds per benchmark, default 10
+#   BENCH_ONLY      space separated benchmarks to run, default all
+#
+# The usual PGHOST, PGPORT and PGUSER select the server.
+
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+PG_CONFIG=${PG_CONFIG:-pg_config}
+BINDIR=$("$PG_CONFIG" --bindir)
+PSQL="$BINDIR/psql"
+PGBENCH="$BINDIR/pgbench"
+
+BENCH_DB=${BENCH_DB:-sql_saga_bench}
+BENCH_UNITS=${BENCH_UNITS:-1000}
+BENCH_VERSIONS=${BENCH_VERSIONS:-10}
+BENCH_CLIENTS=${BENCH_CLIENTS:-1}
+BENCH_DURATION=${BENCH_DURATION:-10}
+BENCH_ONLY=${BENCH_ONLY:-fk_insert uk_delete update_portion_of no_gaps}
+
+if [ "$BENCH_VERSIONS" -lt 2 ]; then
+    echo "BENCH_VERSIONS must be at least 2" >&2
+    exit 1
+fi
+
+"$PSQL" -X -q -d postgres -c "DROP DATABASE IF EXISTS $BENCH_DB" >&2
+"$PSQL" -X -q -d postgres -c "CREATE DATABASE $BENCH_DB" >&2
+"$PSQL" -X -q -v ON_ERROR_STOP=1 -d "$BENCH_DB" \
+    -v units="$BENCH_UNITS" -v versions="$BENCH_VERSIONS" \
+    -f "$BENCH_DIR/setup.sql" >/dev/null
+
+SERVER_VERSION=$("$PSQL" -X -A -t -d "$BENCH_DB" -c "SHOW server_version_num")
+SAGA_VERSION=$("$PSQL" -X -A -t -d "$BENCH_DB" -c "SELECT extversion FROM pg_extension WHERE extname = 'sql_saga'")
+GIT_COMMIT=$(git -C "$BENCH_DIR" rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+for bench in $BENCH_ONLY; do
+    # Rows handled by one transaction, for the rows/s figure
+    case "$bench" in
+        no_gaps) rows=$BENCH_VERSIONS ;;
+        *) rows=1 ;;
+    esac
+
+    out=$("$PGBENCH" -n -d "$BENCH_DB" -f "$BENCH_DIR/$bench.sql" \
+        -c "$BENCH_CLIENTS" -j "$BENCH_CLIENTS" -T "$BENCH_DURATION" \
+        -D units="$BENCH_UNITS" -D versions="$BENCH_VERSIONS" 2>&1) || {
+        echo "$out" >&2
+        exit 1
+    }
+
+    transactions=$(echo "$out" | sed -n 's/^number of transactions actually processed: \([0-9]*\).*/\1/p')
+    latency=$(echo "$out" | sed -n 's/^latency average = \([0-9.]*\) ms.*/\1/p')
+    tps=$(echo "$out" | sed -n -e 's/^tps = \([0-9.]*\) (excluding.*/\1/p' -e 's/^tps = \([0-9.]*\) (without.*/\1/p')
+
+    printf '{"benchmark": "%s", "units": %s, "versions": %s, "clients": %s, "duration": %s, ' \
+        "$bench" "$BENCH_UNITS" "$BENCH_VERSIONS" "$BENCH_CLIENTS" "$BENCH_DURATION"
+    printf '"transactions": %s, "tps": %s, "latency_ms": %s, "rows_per_second": %s, ' \
+        "$transactions" "$tps" "$latency" "$(awk "BEGIN { print $tps * $rows }")"
+    printf '"server_version_num": %s, "sql_saga_version": "%s", "commit": "%s"}\n' \
+        "$SERVER_VERSION" "$SAGA_VERSION" "$GIT_COMMIT"
+done
@@ -0,0 +1,44 @@
+/*
+ * Benchmark data: :units units with :versions consecutive versions each,
+ * every version 10 long, and one stat per unit that references all but the
+ * last version of its unit.
+ */
+CREATE EXTENSION IF NOT EXISTS sql_saga CASCADE;
+
+/*
+ * The api views need a primary key, and update_portion_of() leaves it out
+ * of the rows it splits off, so it is a surrogate like in 07_for_portion_of.
+ */
+CREATE TABLE bench_unit (
+    version_id serial PRIMARY KEY,
+    id integer NOT NULL,
+    valid_from integer NOT NULL,
+    valid_to integer NOT NULL,
+    name text NOT NULL
+);
+
+INSERT INTO bench_unit (id, valid_from, valid_to, name)
+SELECT u, v * 10, (v + 1) * 10, format('unit %s version %s', u, v)
+FROM generate_series(1, :units) AS u
+CROSS JOIN generate_series(0, :versions - 1) AS v;
+
+SELECT sql_saga.add_era('bench_unit', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('bench_unit', ARRAY['id']);
+SELECT sql_saga.add_api('bench_unit');
+
+CREATE TABLE bench_stat (
+    id serial PRIMARY KEY,
+    unit_id integer NOT NULL,
+    valid_from integer NOT NULL,
+    valid_to integer NOT NULL,
+    value integer NOT NULL
+);
+
+INSERT INTO bench_stat (unit_id, valid_from, valid_to, value)
+SELECT u, 0, (:versions - 1) * 10, u
+FROM generate_series(1, :units) AS u;
+
+SELECT sql_saga.add_era('bench_stat', 'valid_from', 'valid_to');
+SELECT sql_saga.add_foreign_key('bench_stat', ARRAY['unit_id'], 'valid', 'bench_unit_id_valid', create_index => true);
+
+VACUUM ANALYZE bench_unit, bench_stat;
@@ -0,0 +1,5 @@
+-- uk_delete_check: delete the last version of a unit, which no stat needs
+\set unit random(1, :units)
+BEGIN;
+DELETE FROM bench_unit WHERE id = :unit AND valid_from = (:versions - 1) * 10;
+ROLLBACK;
@@ -0,0 +1,6 @@
+-- update_portion_of: change the middle of one version, splitting it in three
+\set unit random(1, :units)
+\set version random(0, :versions - 1)
+BEGIN;
+UPDATE bench_unit__for_portion_of_valid SET name = 'changed', valid_from = :version * 10 + 3, valid_to = :version * 10 + 7 WHERE id = :unit AND valid_from = :version * 10;
+ROLLBACK;
@@ -1,179 +1,122 @@
 /**
  * completely_covers.c -
  * Provides an aggregate function
- * that tells whether a bunch of input ranges competely cover a target range.
+ * that tells whether a bunch of input ranges, sorted by their lower bounds,
+ * competely cover a target range.
  */
 
-#include <errno.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <sys/uio.h>
-#include <unistd.h>
-#include <string.h>
-#include <time.h>
-
 #include <postgres.h>
 #include <fmgr.h>
-#include <pg_config.h>
-#include <miscadmin.h>
-#include <utils/array.h>
-#include <utils/guc.h>
-#include <utils/acl.h>
-#include <utils/lsyscache.h>
-#include <utils/builtins.h>
 #include <utils/rangetypes.h>
-#include <utils/timestamp.h>
-#include <catalog/pg_type.h>
-#include <catalog/catalog.h>
-#include <catalog/pg_tablespace.h>
-#include <commands/tablespace.h>
+#include <utils/typcache.h>
 
 #include "completely_covers.h"
+#include "coverage.h"
 
 typedef struct completely_covers_state {
-  TimestampTz covered_to;
-  TimestampTz target_start;
-  TimestampTz target_end;
-  bool target_start_unbounded;
-  bool target_end_unbounded;
+  TypeCacheEntry *typcache; // Of the range type
+  RangeType *target;  // Assuming that the target range does not need to be modified and is not large
+  RangeBound target_start, target_end; // Cache computed values
   bool answer_is_null;
-  bool finished;    // Used to avoid further processing if we have already succeeded/failed.
-  bool completely_covered;
+  coverage_sweep sweep;
 } completely_covers_state;
 
 
 Datum completely_covers_transfn(PG_FUNCTION_ARGS);
 PG_FUNCTION_INFO_V1(completely_covers_transfn);
+Datum completely_covers_finalfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(completely_covers_finalfn);
+
+
+// Makes a state in the current memory context.
+// A NULL or empty target makes the answer NULL.
+static completely_covers_state *completely_covers_new_state(FunctionCallInfo fcinfo, RangeType *target)
+{
+  completely_covers_state *state = (completely_covers_state *)palloc0(sizeof(completely_covers_state));
+  coverage_type type;
+  bool target_empty;
+
+  if (target == NULL || RangeIsEmpty(target)) {
+    state->answer_is_null = true;
+    return state;
+  }
+
+  state->typcache = range_get_typcache(fcinfo, RangeTypeGetOid(target));
+  state->target = (RangeType *)palloc(VARSIZE(target));
+  memcpy(state->target, target, VARSIZE(target));
+  range_deserialize(state->typcache, state->target, &state->target_start, &state->target_end, &target_empty);
+
+  coverage_type_of_range(&type, state->typcache);
+  coverage_sweep_init(&state->sweep, &type, &state->target_start, &state->target_end);
+  return state;
+}
 
 Datum completely_covers_transfn(PG_FUNCTION_ARGS)
 {
-  MemoryContext aggContext;
+  MemoryContext aggContext, oldContext;
   completely_covers_state *state;
   RangeType *current_range,
             *target_range;
-  RangeBound current_start, current_end, target_start, target_end;
-  TypeCacheEntry *typcache;
-  bool current_empty, target_empty;
-  bool first_time;
+  RangeBound current_start, current_end;
+  bool current_empty;
+  bool sorted;
 
   if (!AggCheckCallContext(fcinfo, &aggContext)) {
     elog(ERROR, "completely_covers called in non-aggregate context");
   }
 
   if (PG_ARGISNULL(0)) {
-    // Need to use MemoryContextAlloc with aggContext, not just palloc0,
-    // or the state will get cleared in between invocations:
-    state = (completely_covers_state *)MemoryContextAlloc(aggContext, sizeof(completely_covers_state));
-    state->finished = false;
-    state->completely_covered = false;
-    first_time = true;
-
-    // Need to find out the target range:
-
+    // Need to allocate in aggContext, not just palloc0,
+    // or the state will get cleared in between invocations.
     // TODO: Technically this will fail to detect an inconsistent target
     // if only the first row is NULL:
-    if (PG_ARGISNULL(2)) {
-      // return NULL from the whole thing
-      state->answer_is_null = true;
-      state->finished = true;
-      PG_RETURN_POINTER(state);
-    }
-    state->answer_is_null = false;
-
-    target_range = PG_GETARG_RANGE_P(2);
-    typcache = range_get_typcache(fcinfo, RangeTypeGetOid(target_range));
-    range_deserialize(typcache, target_range, &target_start, &target_end, &target_empty);
-
-    state->target_start_unbounded = target_start.infinite;
-    state->target_end_unbounded = target_end.infinite;
-    state->target_start = DatumGetTimestampTz(target_start.val);
-    state->target_end = DatumGetTimestampTz(target_end.val);
-    // ereport(NOTICE, (errmsg("STARTING: state is [%ld, %ld)   target is [%ld, %ld)", state->target_start, state->target_end, DatumGetTimestampTz(target_start.val), DatumGetTimestampTz(target_end.val))));
-
-    state->covered_to = DT_NOBEGIN;
-
+    oldContext = MemoryContextSwitchTo(aggContext);
+    state = completely_covers_new_state(fcinfo, PG_ARGISNULL(2) ? NULL : PG_GETARG_RANGE_P(2));
+    MemoryContextSwitchTo(oldContext);
+    if (state->answer_is_null) PG_RETURN_POINTER(state);
   } else {
-    // ereport(NOTICE, (errmsg("looking up state....")));
     state = (completely_covers_state *)PG_GETARG_POINTER(0);
 
     // TODO: Is there any better way to exit an aggregation early?
     // Even https://pgxn.org/dist/first_last_agg/ hits all the input rows:
-    if (state->finished) PG_RETURN_POINTER(state);
+    if (state->answer_is_null || state->sweep.finished) PG_RETURN_POINTER(state);
 
-    first_time = false;
-
-    // Make sure the second arg is always the same:
+    // Make sure the second arg is always the same.
+    // It nearly always is the very same bytes, so check that first.
     if (PG_ARGISNULL(2)) {
       ereport(ERROR, (errmsg("completely_covers second argument must be constant across the group")));
     }
     target_range = PG_GETARG_RANGE_P(2);
-    typcache = range_get_typcache(fcinfo, RangeTypeGetOid(target_range));
-    range_deserialize(typcache, target_range, &target_start, &target_end, &target_empty);
-
-    // ereport(NOTICE, (errmsg("state is [%ld, %ld)   target is [%ld, %ld)", state->target_start, state->target_end, DatumGetTimestampTz(target_start.val), DatumGetTimestampTz(target_end.val))));
-    if (DatumGetTimestampTz(target_start.val) != state->target_start || DatumGetTimestampTz(target_end.val) != state->target_end) {
+    if ((VARSIZE(target_range) != VARSIZE(state->target) ||
+         memcmp(target_range, state->target, VARSIZE(target_range)) != 0) &&
+        range_ne_internal(state->typcache, state->target, target_range)) {
       ereport(ERROR, (errmsg("completely_covers second argument must be constant across the group")));
     }
   }
 
   if (PG_ARGISNULL(1)) PG_RETURN_POINTER(state);
-  current_range = PG_GETARG_RANGE_P(1);
-  typcache = range_get_typcache(fcinfo, RangeTypeGetOid(current_range));
-  range_deserialize(typcache, current_range, &current_start, &current_end, &current_empty);
-
-  // ereport(NOTICE, (errmsg("current is [%ld, %ld)", DatumGetTimestampTz(current_start.val), DatumGetTimestampTz(current_end.val))));
-
-  if (first_time) {
-    if (state->target_start_unbounded && !current_start.infinite) {
-      state->finished = true;
-      state->completely_covered = false;
-      PG_RETURN_POINTER(state);
-    }
-    if (DatumGetTimestampTz(current_start.val) > state->target_start) {
-      state->finished = true;
-      state->completely_covered = false;
-      PG_RETURN_POINTER(state);
-    }
 
-  } else {
-    // If there is a gap then fail:
-    if (DatumGetTimestampTz(current_start.val) > state->covered_to) {
-      // ereport(NOTICE, (errmsg("found a gap")));
-      state->finished = true;
-      state->completely_covered = false;
-      PG_RETURN_POINTER(state);
-    }
-  }
-
-  // This check is why we set covered_to to DT_NOBEGIN above on the first pass:
-  // Note this check will not check unsorted inputs in some cases:
-  //   - the inputs cover the target before we hit an out-of-order input.
-  if (DatumGetTimestampTz(current_start.val) < state->covered_to) {
-    // Right? Maybe this should be a warning....
-    ereport(ERROR, (errmsg("completely_covered first argument should be sorted")));
-    // ereport(ERROR, (errmsg("completely_covered first argument should be sorted but got %ld after covering up to %ld", DatumGetTimestampTz(current_start.val), state->covered_to)));
+  current_range = PG_GETARG_RANGE_P(1);
+  if (RangeTypeGetOid(current_range) != RangeTypeGetOid(state->target)) {
+    elog(ERROR, "range types do not match");
   }
 
-  if (current_end.infinite) {
-    state->completely_covered = true;
-    state->finished = true;
+  range_deserialize(state->typcache, current_range, &current_start, &current_end, &current_empty);
+  if (current_empty) PG_RETURN_POINTER(state);
 
-  } else {
-    state->covered_to = DatumGetTimestampTz(current_end.val);
+  // The sweep keeps its copies of the bounds in aggContext too
+  oldContext = MemoryContextSwitchTo(aggContext);
+  sorted = coverage_sweep_next(&state->sweep, &current_start, &current_end);
+  MemoryContextSwitchTo(oldContext);
 
-    if (!state->target_end_unbounded && state->covered_to >= state->target_end) {
-      state->completely_covered = true;
-      state->finished = true;
-    }
+  // Unsorted input after the target is covered or a gap is found goes unnoticed
+  if (!sorted) {
+    ereport(ERROR, (errmsg("completely_covered first argument should be sorted")));
   }
 
   PG_RETURN_POINTER(state);
 }
 
-Datum completely_covers_finalfn(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(completely_covers_finalfn);
-
 Datum completely_covers_finalfn(PG_FUNCTION_ARGS)
 {
   completely_covers_state *state;
@@ -184,6 +127,6 @@ Datum completely_covers_finalfn(PG_FUNCTION_ARGS)
   if (state->answer_is_null) {
     PG_RETURN_NULL();
   } else {
-    PG_RETURN_BOOL(state->completely_covered);
+    PG_RETURN_BOOL(state->sweep.covered);
   }
 }
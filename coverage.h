@@ -0,0 +1,228 @@
+/**
+ * coverage.h -
+ * The coverage sweep shared by no_gaps, completely_covers and the foreign
+ * key checks: comparing range bounds, with a fast path for the integer and
+ * time types, and following sorted ranges until they cover a target.
+ */
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <catalog/pg_type.h>
+#include <utils/datum.h>
+#include <utils/rangetypes.h>
+#include <utils/typcache.h>
+
+// How the bound values of the element type are compared.
+typedef enum coverage_kind {
+  COVERAGE_GENERIC,  // With the btree comparison function of the type
+  COVERAGE_INT32,    // int4 and date
+  COVERAGE_INT64     // int8, timestamp and timestamptz
+} coverage_kind;
+
+// What is needed to compare and copy the bound values.
+typedef struct coverage_type {
+  coverage_kind kind;
+  FmgrInfo *cmp_proc;
+  Oid collation;
+  bool typbyval;
+  int16 typlen;
+} coverage_type;
+
+// A reusable copy of a pass-by-reference value, so following a bound that
+// moves on every row does not allocate on every row.
+typedef struct coverage_buffer {
+  char *data;
+  Size size;
+} coverage_buffer;
+
+// Follows ranges sorted by their lower bounds over a target.
+typedef struct coverage_sweep {
+  coverage_type type;
+  RangeBound target_start, target_end;
+  RangeBound last_lower;   // To tell that the input is sorted
+  RangeBound covered_to;   // An upper bound, valid once started
+  coverage_buffer last_lower_buffer;
+  coverage_buffer covered_to_buffer;
+  bool any;        // Seen a range
+  bool started;    // Seen a range that reaches the target
+  bool finished;
+  bool covered;
+} coverage_sweep;
+
+
+static inline coverage_kind coverage_kind_of(Oid element_type)
+{
+  switch (element_type) {
+    case INT4OID:
+    case DATEOID:
+      return COVERAGE_INT32;
+    case INT8OID:
+    case TIMESTAMPOID:
+    case TIMESTAMPTZOID:
+      return COVERAGE_INT64;
+    default:
+      return COVERAGE_GENERIC;
+  }
+}
+
+// For the bounds of a range type.
+static inline void coverage_type_of_range(coverage_type *type, TypeCacheEntry *range_typcache)
+{
+  type->kind = coverage_kind_of(range_typcache->rngelemtype->type_id);
+  type->cmp_proc = &range_typcache->rng_cmp_proc_finfo;
+  type->collation = range_typcache->rng_collation;
+  type->typbyval = range_typcache->rngelemtype->typbyval;
+  type->typlen = range_typcache->rngelemtype->typlen;
+}
+
+// For plain values, with a type cache entry that has TYPECACHE_CMP_PROC_FINFO.
+static inline void coverage_type_of_element(coverage_type *type, TypeCacheEntry *typcache)
+{
+  type->kind = coverage_kind_of(typcache->type_id);
+  type->cmp_proc = &typcache->cmp_proc_finfo;
+  type->collation = typcache->typcollation;
+  type->typbyval = typcache->typbyval;
+  type->typlen = typcache->typlen;
+}
+
+// One comparison kernel per kind, without a function call.
+#define COVERAGE_CMP_KERNEL(ctype, get) \
+  do { \
+    ctype v1 = get(b1->val), v2 = get(b2->val); \
+    return (v1 > v2) - (v1 < v2); \
+  } while (0)
+
+// Like range_cmp_bound_values.
+static inline int coverage_cmp_bound_values(const coverage_type *type, const RangeBound *b1, const RangeBound *b2)
+{
+  if (b1->infinite && b2->infinite) {
+    if (b1->lower == b2->lower) return 0;
+    return b1->lower ? -1 : 1;
+  } else if (b1->infinite) {
+    return b1->lower ? -1 : 1;
+  } else if (b2->infinite) {
+    return b2->lower ? 1 : -1;
+  }
+
+  switch (type->kind) {
+    case COVERAGE_INT32:
+      COVERAGE_CMP_KERNEL(int32, DatumGetInt32);
+    case COVERAGE_INT64:
+      COVERAGE_CMP_KERNEL(int64, DatumGetInt64);
+    default:
+      return DatumGetInt32(FunctionCall2Coll(type->cmp_proc, type->collation, b1->val, b2->val));
+  }
+}
+
+// Like range_cmp_bounds, on top of coverage_cmp_bound_values.
+static inline int coverage_cmp_bounds(const coverage_type *type, const RangeBound *b1, const RangeBound *b2)
+{
+  int result = coverage_cmp_bound_values(type, b1, b2);
+
+  if (result != 0) return result;
+  if (!b1->inclusive && !b2->inclusive) {
+    if (b1->lower == b2->lower) return 0;
+    return b1->lower ? 1 : -1;
+  } else if (!b1->inclusive) {
+    return b1->lower ? 1 : -1;
+  } else if (!b2->inclusive) {
+    return b2->lower ? -1 : 1;
+  }
+  return 0;
+}
+
+// True if there is nothing left out between an upper bound and a lower bound,
+// e.g. [1, 5) and [5, 8) touch, but (1, 5) and (5, 8) do not.
+static inline bool coverage_bounds_touch(const coverage_type *type, const RangeBound *upper, const RangeBound *lower)
+{
+  int cmp = coverage_cmp_bound_values(type, lower, upper);
+
+  return cmp < 0 || (cmp == 0 && (lower->inclusive || upper->inclusive));
+}
+
+// Copies a pass-by-reference value into the buffer, growing it if needed,
+// and returns the copy.  A new buffer is allocated in the current memory context.
+static inline Datum coverage_buffer_set(coverage_buffer *buffer, Datum value, int16 typlen)
+{
+  Size size = datumGetSize(value, false, typlen);
+
+  if (size > buffer->size) {
+    Size new_size = Max(size, 2 * buffer->size);
+
+    if (buffer->data == NULL) {
+      buffer->data = (char *)palloc(new_size);
+    } else {
+      buffer->data = (char *)repalloc(buffer->data, new_size);
+    }
+    buffer->size = new_size;
+  }
+  memmove(buffer->data, DatumGetPointer(value), size);
+  return PointerGetDatum(buffer->data);
+}
+
+// Keeps a bound of the current row, which might go away with the next row.
+static inline void coverage_keep_bound(const coverage_type *type, coverage_buffer *buffer, RangeBound *dst, const RangeBound *src)
+{
+  *dst = *src;
+  if (!src->infinite && !type->typbyval) {
+    dst->val = coverage_buffer_set(buffer, src->val, type->typlen);
+  }
+}
+
+// The target bounds must stay valid for as long as the sweep is used.
+static inline void coverage_sweep_init(coverage_sweep *sweep, const coverage_type *type,
+    const RangeBound *target_start, const RangeBound *target_end)
+{
+  memset(sweep, 0, sizeof(coverage_sweep));
+  sweep->type = *type;
+  sweep->target_start = *target_start;
+  sweep->target_end = *target_end;
+}
+
+// Takes the next range, with bounds that need only stay valid for the call.
+// Returns false if it comes before the previous one, so the input was not sorted.
+// Once finished, covered tells the answer; an input that runs out before
+// finishing did not cover the target.
+static inline bool coverage_sweep_next(coverage_sweep *sweep, const RangeBound *lower, const RangeBound *upper)
+{
+  const coverage_type *type = &sweep->type;
+
+  if (sweep->finished) return true;
+
+  if (sweep->any && coverage_cmp_bounds(type, lower, &sweep->last_lower) < 0) return false;
+  coverage_keep_bound(type, &sweep->last_lower_buffer, &sweep->last_lower, lower);
+  sweep->any = true;
+
+  if (!sweep->started) {
+    // Ranges that end before the target do not count
+    if (!coverage_bounds_touch(type, upper, &sweep->target_start)) return true;
+    if (coverage_cmp_bounds(type, lower, &sweep->target_start) > 0) {
+      sweep->finished = true;
+      return true;
+    }
+    sweep->started = true;
+  } else if (!coverage_bounds_touch(type, &sweep->covered_to, lower)) {
+    sweep->finished = true;
+    return true;
+  } else if (coverage_cmp_bounds(type, upper, &sweep->covered_to) <= 0) {
+    return true;
+  }
+
+  coverage_keep_bound(type, &sweep->covered_to_buffer, &sweep->covered_to, upper);
+
+  if (coverage_cmp_bounds(type, &sweep->covered_to, &sweep->target_end) >= 0) {
+    sweep->covered = true;
+    sweep->finished = true;
+  }
+  return true;
+}
+
+static inline void coverage_sweep_free(coverage_sweep *sweep)
+{
+  if (sweep->last_lower_buffer.data != NULL) pfree(sweep->last_lower_buffer.data);
+  if (sweep->covered_to_buffer.data != NULL) pfree(sweep->covered_to_buffer.data);
+}
+
+#endif // COVERAGE_H
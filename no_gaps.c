@@ -33,37 +33,391 @@
 #include <catalog/catalog.h>
 #include <catalog/pg_tablespace.h>
 #include <commands/tablespace.h>
+#include <executor/spi.h>
+#include <libpq/pqformat.h>
+#include <nodes/parsenodes.h>
+#include <utils/hsearch.h>
+#include <utils/typcache.h>
 
+#include "coverage.h"
 #include "no_gaps.h"
+#include "sql_saga.h"
 
-// Taken from 'https://github.com/postgres/postgres/raw/master/src/backend/utils/adt/numeric.c',
-// since it is not exposed in a headerfile.
-#define NUMERIC_NINF      0xF000
+// How many out of order ranges no_gaps buffers before merging them in.
+#define NO_GAPS_MAX_PENDING 4096
+
+#if (PG_VERSION_NUM < 110000)
+#define pq_sendint32(buf, i) pq_sendint(buf, i, 4)
+#endif
 
 
 // Declarations/Prototypes
 char *DatumGetString(Oid elem_oid, RangeBound bound);
-Datum DatumNegativeInfinity(Oid elem_oid);
 
 Datum no_gaps_transfn(PG_FUNCTION_ARGS);
 PG_FUNCTION_INFO_V1(no_gaps_transfn);
+Datum no_gaps_combinefn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(no_gaps_combinefn);
+Datum no_gaps_serialfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(no_gaps_serialfn);
+Datum no_gaps_deserialfn(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(no_gaps_deserialfn);
 Datum no_gaps_finalfn(PG_FUNCTION_ARGS);
 PG_FUNCTION_INFO_V1(no_gaps_finalfn);
+Datum no_gaps_lookup(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(no_gaps_lookup);
 
 
 // Types
+
+// A part of the target that is covered by the input ranges.
+typedef struct no_gaps_interval {
+  RangeBound lower, upper;
+} no_gaps_interval;
+
 typedef struct no_gaps_state {
-  RangeBound covered_to;
+  TypeCacheEntry *typcache; // Of the range type
+  coverage_type type;
   RangeType *target;  // Assuming that the target range does not need to be modified and is not large
   RangeBound target_start, target_end; // Cache computed values
-  bool target_empty; // Cache computed value
   bool answer_is_null;
-  bool finished;    // Used to avoid further processing if we have already succeeded/failed.
+  bool finished;    // Used to avoid further processing if we have already succeeded.
   bool no_gaps;
+  // What the input covers of the target so far, sorted and without any
+  // overlapping or adjacent intervals, so any state can be merged with another
+  // one whatever order the input came in.
+  // Sorted input keeps this to a single interval that grows at the end.
+  int nintervals;
+  int maxintervals;
+  no_gaps_interval *intervals;
+  // For pass-by-reference types the upper bound of the last interval lives
+  // here, since that is the one that sorted input moves forward.
+  coverage_buffer last_upper;
+  // Ranges that came out of order are collected here, then sorted and swept
+  // into the intervals in one go, instead of being inserted one by one.
+  int npending;
+  int maxpending;
+  no_gaps_interval *pending;
 } no_gaps_state;
 
 
 // Implementations
+
+// Makes an empty state in the current memory context.
+// A NULL or empty target makes the answer NULL.
+// The type cache entry is kept in fn_extra of fcinfo.
+static no_gaps_state *no_gaps_new_state(FunctionCallInfo fcinfo, RangeType *target)
+{
+  no_gaps_state *state = (no_gaps_state *)palloc0(sizeof(no_gaps_state));
+  bool target_empty;
+
+  if (target == NULL || RangeIsEmpty(target)) {
+    state->answer_is_null = true;
+    state->finished = true;
+    return state;
+  }
+
+  state->typcache = range_get_typcache(fcinfo, RangeTypeGetOid(target));
+  state->target = (RangeType *)palloc(VARSIZE(target));
+  memcpy(state->target, target, VARSIZE(target));
+  range_deserialize(state->typcache, state->target, &state->target_start, &state->target_end, &target_empty);
+
+  state->maxintervals = 4;
+  state->intervals = (no_gaps_interval *)palloc(state->maxintervals * sizeof(no_gaps_interval));
+  coverage_type_of_range(&state->type, state->typcache);
+  return state;
+}
+
+static inline bool no_gaps_is_buffered(no_gaps_state *state, RangeBound *bound)
+{
+  return !bound->infinite && !state->typcache->rngelemtype->typbyval &&
+      DatumGetPointer(bound->val) == state->last_upper.data;
+}
+
+// Bounds kept in the state are copies owned by the state,
+// apart from the one in the last_upper buffer.
+static void no_gaps_copy_bound(no_gaps_state *state, RangeBound *dst, const RangeBound *src)
+{
+  TypeCacheEntry *elem_typcache = state->typcache->rngelemtype;
+
+  *dst = *src;
+  if (!src->infinite && !elem_typcache->typbyval) {
+    dst->val = datumCopy(src->val, false, elem_typcache->typlen);
+  }
+}
+
+static void no_gaps_free_bound(no_gaps_state *state, RangeBound *bound)
+{
+  if (!bound->infinite && !state->typcache->rngelemtype->typbyval && !no_gaps_is_buffered(state, bound)) {
+    pfree(DatumGetPointer(bound->val));
+  }
+}
+
+// Sets the upper bound of intervals[i], in the buffer if it is the last one.
+// Any previous bound there must have been freed.
+static void no_gaps_store_upper(no_gaps_state *state, int i, RangeBound *upper)
+{
+  RangeBound *dst = &state->intervals[i].upper;
+
+  if (i == state->nintervals - 1 && !upper->infinite && !state->typcache->rngelemtype->typbyval) {
+    *dst = *upper;
+    dst->val = coverage_buffer_set(&state->last_upper, upper->val, state->typcache->rngelemtype->typlen);
+  } else {
+    no_gaps_copy_bound(state, dst, upper);
+  }
+}
+
+// Gives the last interval its own copy of its upper bound,
+// before it stops being the last one.
+static void no_gaps_detach_last_upper(no_gaps_state *state)
+{
+  RangeBound *upper;
+
+  if (state->nintervals == 0) return;
+  upper = &state->intervals[state->nintervals - 1].upper;
+  if (no_gaps_is_buffered(state, upper)) {
+    upper->val = datumCopy(upper->val, false, state->typcache->rngelemtype->typlen);
+  }
+}
+
+static void no_gaps_check_covered(no_gaps_state *state)
+{
+  // The intervals are clipped to the target, so there is full coverage
+  // once a single interval has the bounds of the target.
+  if (state->nintervals == 1 &&
+      coverage_cmp_bounds(&state->type, &state->intervals[0].lower, &state->target_start) == 0 &&
+      coverage_cmp_bounds(&state->type, &state->intervals[0].upper, &state->target_end) == 0) {
+    state->no_gaps = true;
+    state->finished = true;
+  }
+}
+
+// Cuts [lower, upper] down to the part that is inside the target.
+// Returns false if nothing of the target is covered.
+static bool no_gaps_clip(no_gaps_state *state, RangeBound *lower, RangeBound *upper)
+{
+  if (coverage_cmp_bounds(&state->type, lower, &state->target_start) < 0) *lower = state->target_start;
+  if (coverage_cmp_bounds(&state->type, upper, &state->target_end) > 0) *upper = state->target_end;
+  return coverage_cmp_bounds(&state->type, lower, upper) <= 0;
+}
+
+// Adds [lower, upper], already clipped to the target, to the intervals.
+// Must be called in the memory context of the state.
+static void no_gaps_add(no_gaps_state *state, RangeBound lower, RangeBound upper)
+{
+  no_gaps_interval *intervals;
+  int first, last, i;
+
+  // Find the intervals that the new one touches.
+  // Search from the end, since that is where sorted input goes.
+  intervals = state->intervals;
+  last = state->nintervals - 1;
+  while (last >= 0 && !coverage_bounds_touch(&state->type, &upper, &intervals[last].lower)) last--;
+  first = last;
+  while (first >= 0 && coverage_bounds_touch(&state->type, &intervals[first].upper, &lower)) first--;
+  first++;
+
+  if (first > last) {
+    // It touches nothing, so it goes in between
+    if (state->nintervals == state->maxintervals) {
+      state->maxintervals *= 2;
+      state->intervals = intervals = (no_gaps_interval *)repalloc(intervals, state->maxintervals * sizeof(no_gaps_interval));
+    }
+    if (first == state->nintervals) no_gaps_detach_last_upper(state);
+    memmove(&intervals[first + 1], &intervals[first], (state->nintervals - first) * sizeof(no_gaps_interval));
+    state->nintervals++;
+    no_gaps_copy_bound(state, &intervals[first].lower, &lower);
+    no_gaps_store_upper(state, first, &upper);
+    return;
+  }
+
+  // Join the new interval and the ones it touches into intervals[first]
+  if (coverage_cmp_bounds(&state->type, &lower, &intervals[first].lower) < 0) {
+    no_gaps_free_bound(state, &intervals[first].lower);
+    no_gaps_copy_bound(state, &intervals[first].lower, &lower);
+  }
+  if (coverage_cmp_bounds(&state->type, &upper, &intervals[last].upper) > 0) {
+    no_gaps_free_bound(state, &intervals[last].upper);
+    no_gaps_store_upper(state, last, &upper);
+  }
+  if (last > first) {
+    no_gaps_free_bound(state, &intervals[first].upper);
+    for (i = first + 1; i < last; i++) {
+      no_gaps_free_bound(state, &intervals[i].lower);
+      no_gaps_free_bound(state, &intervals[i].upper);
+    }
+    no_gaps_free_bound(state, &intervals[last].lower);
+    intervals[first].upper = intervals[last].upper;
+    memmove(&intervals[first + 1], &intervals[last + 1], (state->nintervals - last - 1) * sizeof(no_gaps_interval));
+    state->nintervals -= last - first;
+  }
+
+  no_gaps_check_covered(state);
+}
+
+// Sweeps others, sorted by their lower bounds but possibly overlapping,
+// into the intervals of the state.
+// If others_owned the state takes over their bounds, otherwise they are copied.
+// Must be called in the memory context of the state.
+static void no_gaps_merge(no_gaps_state *state, no_gaps_interval *others, int nothers, bool others_owned)
+{
+  no_gaps_interval *merged;
+  int maxmerged = Max(state->nintervals + nothers, 1);
+  int nmerged = 0;
+  int i = 0, j = 0;
+
+  // The intervals get rebuilt, so none of them can use the buffer
+  no_gaps_detach_last_upper(state);
+  merged = (no_gaps_interval *)palloc(maxmerged * sizeof(no_gaps_interval));
+
+  while (i < state->nintervals || j < nothers) {
+    no_gaps_interval next;
+    bool owned;  // Bounds that the state owns can be taken over, the others must be copied.
+
+    if (j >= nothers ||
+        (i < state->nintervals && coverage_cmp_bounds(&state->type, &state->intervals[i].lower, &others[j].lower) <= 0)) {
+      next = state->intervals[i++];
+      owned = true;
+    } else {
+      next = others[j++];
+      owned = others_owned;
+    }
+
+    if (nmerged > 0 && coverage_bounds_touch(&state->type, &merged[nmerged - 1].upper, &next.lower)) {
+      no_gaps_interval *prev = &merged[nmerged - 1];
+
+      if (owned) no_gaps_free_bound(state, &next.lower);
+      if (coverage_cmp_bounds(&state->type, &next.upper, &prev->upper) > 0) {
+        no_gaps_free_bound(state, &prev->upper);
+        if (owned) {
+          prev->upper = next.upper;
+        } else {
+          no_gaps_copy_bound(state, &prev->upper, &next.upper);
+        }
+      } else if (owned) {
+        no_gaps_free_bound(state, &next.upper);
+      }
+    } else {
+      if (owned) {
+        merged[nmerged] = next;
+      } else {
+        no_gaps_copy_bound(state, &merged[nmerged].lower, &next.lower);
+        no_gaps_copy_bound(state, &merged[nmerged].upper, &next.upper);
+      }
+      nmerged++;
+    }
+  }
+
+  pfree(state->intervals);
+  state->intervals = merged;
+  state->nintervals = nmerged;
+  state->maxintervals = maxmerged;
+
+  no_gaps_check_covered(state);
+}
+
+static int no_gaps_cmp_lower(const void *a, const void *b, void *arg)
+{
+  return coverage_cmp_bounds(&((no_gaps_state *)arg)->type, &((no_gaps_interval *)a)->lower, &((no_gaps_interval *)b)->lower);
+}
+
+// The int64 that sorts like the lower bound, flipped to make it unsigned.
+// Ties between inclusive and exclusive bounds do not matter to the sweep.
+static uint64 no_gaps_int64_key(coverage_kind kind, RangeBound *bound)
+{
+  int64 value;
+
+  if (bound->infinite) return 0;
+  if (kind == COVERAGE_INT32) {
+    value = DatumGetInt32(bound->val);
+  } else {
+    value = DatumGetInt64(bound->val);
+  }
+  return ((uint64)value) ^ (UINT64CONST(1) << 63);
+}
+
+// Sorts the intervals by their lower bounds with an LSD radix sort,
+// one byte at a time, skipping the bytes where all the keys are the same.
+static void no_gaps_radix_sort(coverage_kind kind, no_gaps_interval *intervals, int n)
+{
+  uint64 *keys = (uint64 *)palloc(n * sizeof(uint64));
+  uint64 *keys_tmp = (uint64 *)palloc(n * sizeof(uint64));
+  no_gaps_interval *intervals_tmp = (no_gaps_interval *)palloc(n * sizeof(no_gaps_interval));
+  no_gaps_interval *from = intervals, *to = intervals_tmp;
+  int shift, i;
+
+  for (i = 0; i < n; i++) keys[i] = no_gaps_int64_key(kind, &intervals[i].lower);
+
+  for (shift = 0; shift < 64; shift += 8) {
+    int counts[256];
+    int total = 0;
+    uint64 *swap_keys;
+    no_gaps_interval *swap;
+
+    memset(counts, 0, sizeof(counts));
+    for (i = 0; i < n; i++) counts[(keys[i] >> shift) & 0xFF]++;
+    if (counts[(keys[0] >> shift) & 0xFF] == n) continue;
+
+    for (i = 0; i < 256; i++) {
+      int count = counts[i];
+
+      counts[i] = total;
+      total += count;
+    }
+    for (i = 0; i < n; i++) {
+      int pos = counts[(keys[i] >> shift) & 0xFF]++;
+
+      keys_tmp[pos] = keys[i];
+      to[pos] = from[i];
+    }
+
+    swap_keys = keys; keys = keys_tmp; keys_tmp = swap_keys;
+    swap = from; from = to; to = swap;
+  }
+
+  if (from != intervals) memcpy(intervals, from, n * sizeof(no_gaps_interval));
+  pfree(keys);
+  pfree(keys_tmp);
+  pfree(intervals_tmp);
+}
+
+// Sorts the pending ranges and sweeps them into the intervals.
+// Must be called in the memory context of the state.
+static void no_gaps_flush(no_gaps_state *state)
+{
+  if (state->npending == 0) return;
+
+  if (state->type.kind == COVERAGE_GENERIC) {
+    qsort_arg(state->pending, state->npending, sizeof(no_gaps_interval), no_gaps_cmp_lower, state);
+  } else {
+    no_gaps_radix_sort(state->type.kind, state->pending, state->npending);
+  }
+  no_gaps_merge(state, state->pending, state->npending, true);
+  state->npending = 0;
+}
+
+// Adds [lower, upper], already clipped to the target, to the pending ranges.
+// Must be called in the memory context of the state.
+static void no_gaps_add_pending(no_gaps_state *state, RangeBound lower, RangeBound upper)
+{
+  if (state->npending == state->maxpending) {
+    if (state->maxpending == 0) {
+      state->maxpending = 64;
+      state->pending = (no_gaps_interval *)palloc(state->maxpending * sizeof(no_gaps_interval));
+    } else {
+      state->maxpending *= 2;
+      state->pending = (no_gaps_interval *)repalloc(state->pending, state->maxpending * sizeof(no_gaps_interval));
+    }
+  }
+  no_gaps_copy_bound(state, &state->pending[state->npending].lower, &lower);
+  no_gaps_copy_bound(state, &state->pending[state->npending].upper, &upper);
+  state->npending++;
+
+  // Merge from time to time, so memory stays bounded and we can still
+  // stop early once the target is covered.
+  if (state->npending == NO_GAPS_MAX_PENDING) no_gaps_flush(state);
+}
+
 Datum no_gaps_transfn(PG_FUNCTION_ARGS)
 {
   MemoryContext aggContext, oldContext;
@@ -71,10 +425,7 @@ Datum no_gaps_transfn(PG_FUNCTION_ARGS)
   RangeType *current_range,
             *target_range;
   RangeBound current_start, current_end;
-  TypeCacheEntry *typcache, *elem_typcache;
-  Oid elem_oid;
   bool current_empty;
-  bool first_time;
 
   if (!AggCheckCallContext(fcinfo, &aggContext)) {
     elog(ERROR, "no_gaps called in non-aggregate context");
@@ -83,63 +434,31 @@ Datum no_gaps_transfn(PG_FUNCTION_ARGS)
   // First run of the aggregate function.
   // Create the state and analyse the input arguments.
   if (PG_ARGISNULL(0)) {
-    // Need to use MemoryContextAlloc with aggContext, not just palloc0,
-    // or the state will get cleared in between invocations:
-    state = (no_gaps_state *)MemoryContextAlloc(aggContext, sizeof(no_gaps_state));
-    state->finished = false;
-    state->no_gaps = false;
-    first_time = true;
-
+    // Need to allocate in aggContext, not just palloc0,
+    // or the state will get cleared in between invocations.
     // Technically this will fail to detect an inconsistent target
     // if only the first row is NULL or has an empty range, however,
     // any target problem will be detected when the data is present.
-    if (PG_ARGISNULL(2) || RangeIsEmpty(target_range = PG_GETARG_RANGE_P(2))) {
-      // return NULL from the whole thing
-      state->answer_is_null = true;
-      state->finished = true;
-      PG_RETURN_POINTER(state);
-    }
-    state->answer_is_null = false;
-
-    state->target = (RangeType *)MemoryContextAlloc(aggContext, VARSIZE(PG_GETARG_RANGE_P(2)));
-    memcpy(state->target, target_range, VARSIZE(target_range));
-    typcache = range_get_typcache(fcinfo, RangeTypeGetOid(state->target));
-    range_deserialize(typcache, state->target, &state->target_start, &state->target_end, &state->target_empty);
-    elem_oid = typcache->rngelemtype->type_id;
-    elem_typcache = lookup_type_cache(elem_oid, 0);
-
-    //ereport(DEBUG1, (errmsg("target is [%s, %s)", DatumGetString(elem_oid, state->target_start), DatumGetString(elem_oid, state->target_end))));
-
-    // Initialize covered_to to negative infinity bound, and make sure it is allocated for regular free.
-    //if (!elem_typcache->typbyval && elem_typcache->typlen == -1) {
-    //  ereport(DEBUG1, (errmsg("Performing memory copy.")));  
-    //  oldContext = MemoryContextSwitchTo(aggContext);
-    //  state->covered_to.val = datumCopy(DatumNegativeInfinity(elem_oid), /*pass by reference when false*/ false, /*dynamic length when -1*/ -1);
-    //  MemoryContextSwitchTo(oldContext);
-    //} else {
-    //    ereport(DEBUG1, (errmsg("Skipping memory copy.")));
-        state->covered_to.val = DatumNegativeInfinity(elem_oid);
-    //}
-    state->covered_to.infinite = true;
-    state->covered_to.inclusive = true;
-    state->covered_to.lower = true;
-    //ereport(DEBUG1, (errmsg("initial covered_to is %s", DatumGetString(elem_oid, state->covered_to))));
+    oldContext = MemoryContextSwitchTo(aggContext);
+    state = no_gaps_new_state(fcinfo, PG_ARGISNULL(2) ? NULL : PG_GETARG_RANGE_P(2));
+    MemoryContextSwitchTo(oldContext);
+    if (state->finished) PG_RETURN_POINTER(state);
   } else {
-    // ereport(NOTICE, (errmsg("looking up state....")));
     state = (no_gaps_state *)PG_GETARG_POINTER(0);
 
     // TODO: Is there any better way to exit an aggregation early?
     // Even https://pgxn.org/dist/first_last_agg/ hits all the input rows:
     if (state->finished) PG_RETURN_POINTER(state);
 
-    first_time = false;
-
-    // Make sure the second arg is always the same:
-    typcache = range_get_typcache(fcinfo, RangeTypeGetOid(state->target));
-    elem_oid = typcache->rngelemtype->type_id;
-    elem_typcache = lookup_type_cache(elem_oid, 0);
-
-    if (PG_ARGISNULL(2) || range_ne_internal(typcache, state->target, PG_GETARG_RANGE_P(2))) {
+    // Make sure the second arg is always the same.
+    // It nearly always is the very same bytes, so check that first.
+    if (PG_ARGISNULL(2)) {
+      ereport(ERROR, (errmsg("no_gaps second argument must be constant across the group")));
+    }
+    target_range = PG_GETARG_RANGE_P(2);
+    if ((VARSIZE(target_range) != VARSIZE(state->target) ||
+         memcmp(target_range, state->target, VARSIZE(target_range)) != 0) &&
+        range_ne_internal(state->typcache, state->target, target_range)) {
       ereport(ERROR, (errmsg("no_gaps second argument must be constant across the group")));
     }
   }
@@ -147,94 +466,169 @@ Datum no_gaps_transfn(PG_FUNCTION_ARGS)
   if (PG_ARGISNULL(1)) PG_RETURN_POINTER(state);
 
   current_range = PG_GETARG_RANGE_P(1);
-  if (first_time) {
-    if (RangeTypeGetOid(current_range) != RangeTypeGetOid(state->target)
-        ) {
-      elog(ERROR, "range types do not match");
-    }
+  if (RangeTypeGetOid(current_range) != RangeTypeGetOid(state->target)) {
+    elog(ERROR, "range types do not match");
   }
 
-  range_deserialize(typcache, current_range, &current_start, &current_end, &current_empty);
+  range_deserialize(state->typcache, current_range, &current_start, &current_end, &current_empty);
+  if (current_empty || !no_gaps_clip(state, &current_start, &current_end)) PG_RETURN_POINTER(state);
 
   oldContext = MemoryContextSwitchTo(aggContext);
-  //ereport(DEBUG1, (errmsg("current is [%s, %s)", DatumGetString(elem_oid, current_start), DatumGetString(elem_oid, current_end))));
-  //ereport(DEBUG1, (errmsg("pre state->covered_to is %s", DatumGetString(elem_oid, state->covered_to))));
+  // In order input only ever touches the last interval, anything else waits
+  if (state->nintervals == 0 ||
+      coverage_cmp_bounds(&state->type, &current_start, &state->intervals[state->nintervals - 1].lower) >= 0) {
+    no_gaps_add(state, current_start, current_end);
+  } else {
+    no_gaps_add_pending(state, current_start, current_end);
+  }
   MemoryContextSwitchTo(oldContext);
 
-  if (first_time) {
-    // If the target range start is unbounded, but the current range start is not, then we cannot have full coverage
-    if (state->target_start.infinite && !current_start.infinite) {
-      state->finished = true;
-      state->no_gaps = false;
-      PG_RETURN_POINTER(state);
-    }
-    // If the current range starts after the target range starts, then we have a gap
-    if (range_cmp_bounds(typcache, &current_start, &state->target_start) > 0) {
-      state->finished = true;
-      state->no_gaps = false;
-      PG_RETURN_POINTER(state);
+  PG_RETURN_POINTER(state);
+}
+
+Datum no_gaps_combinefn(PG_FUNCTION_ARGS)
+{
+  MemoryContext aggContext, oldContext;
+  no_gaps_state *state1, *state2;
+
+  if (!AggCheckCallContext(fcinfo, &aggContext)) {
+    elog(ERROR, "no_gaps_combinefn called in non-aggregate context");
+  }
+
+  state1 = PG_ARGISNULL(0) ? NULL : (no_gaps_state *)PG_GETARG_POINTER(0);
+  state2 = PG_ARGISNULL(1) ? NULL : (no_gaps_state *)PG_GETARG_POINTER(1);
+
+  if (state2 == NULL) {
+    if (state1 == NULL) PG_RETURN_NULL();
+    PG_RETURN_POINTER(state1);
+  }
+
+  // The first state must live in aggContext, so it is never just state2
+  oldContext = MemoryContextSwitchTo(aggContext);
+  if (state1 == NULL) {
+    state1 = no_gaps_new_state(fcinfo, state2->target);
+  } else if (state1->answer_is_null != state2->answer_is_null ||
+      (!state1->answer_is_null && range_ne_internal(state1->typcache, state1->target, state2->target))) {
+    ereport(ERROR, (errmsg("no_gaps second argument must be constant across the group")));
+  }
+  if (!state1->finished) {
+    no_gaps_flush(state1);
+    no_gaps_flush(state2);
+    no_gaps_merge(state1, state2->intervals, state2->nintervals, false);
+  }
+  MemoryContextSwitchTo(oldContext);
+
+  PG_RETURN_POINTER(state1);
+}
+
+// The serialized state is whether the answer is NULL,
+// then the target and the covered intervals, each as a range.
+static void no_gaps_send_range(StringInfo buf, RangeType *range)
+{
+  pq_sendint32(buf, VARSIZE(range));
+  pq_sendbytes(buf, (char *)range, VARSIZE(range));
+}
+
+static RangeType *no_gaps_recv_range(StringInfo buf)
+{
+  int len = pq_getmsgint(buf, 4);
+  RangeType *range = (RangeType *)palloc(len);
+
+  // Copy to get the alignment right
+  memcpy(range, pq_getmsgbytes(buf, len), len);
+  return range;
+}
+
+Datum no_gaps_serialfn(PG_FUNCTION_ARGS)
+{
+  MemoryContext aggContext, oldContext;
+  no_gaps_state *state;
+  StringInfoData buf;
+  int i;
+
+  if (!AggCheckCallContext(fcinfo, &aggContext)) {
+    elog(ERROR, "no_gaps_serialfn called in non-aggregate context");
+  }
+
+  state = (no_gaps_state *)PG_GETARG_POINTER(0);
+  oldContext = MemoryContextSwitchTo(aggContext);
+  no_gaps_flush(state);
+  MemoryContextSwitchTo(oldContext);
+
+  pq_begintypsend(&buf);
+  pq_sendbyte(&buf, state->answer_is_null);
+  if (!state->answer_is_null) {
+    no_gaps_send_range(&buf, state->target);
+    pq_sendint32(&buf, state->nintervals);
+    for (i = 0; i < state->nintervals; i++) {
+#if (PG_VERSION_NUM < 160000)
+      no_gaps_send_range(&buf, range_serialize(state->typcache, &state->intervals[i].lower, &state->intervals[i].upper, false));
+#else
+      no_gaps_send_range(&buf, range_serialize(state->typcache, &state->intervals[i].lower, &state->intervals[i].upper, false, NULL));
+#endif
     }
+  }
+
+  PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+Datum no_gaps_deserialfn(PG_FUNCTION_ARGS)
+{
+  bytea *serialized;
+  no_gaps_state *state;
+  StringInfoData buf;
+  int nintervals, i;
+
+  if (!AggCheckCallContext(fcinfo, NULL)) {
+    elog(ERROR, "no_gaps_deserialfn called in non-aggregate context");
+  }
+
+  serialized = PG_GETARG_BYTEA_PP(0);
+  initStringInfo(&buf);
+  appendBinaryStringInfo(&buf, VARDATA_ANY(serialized), VARSIZE_ANY_EXHDR(serialized));
+
+  if (pq_getmsgbyte(&buf)) {
+    state = no_gaps_new_state(fcinfo, NULL);
   } else {
-    // For subsequent ranges, check if there is a gap between the end of the covered range and the start of the current range
-    if (range_cmp_bounds(typcache, &state->covered_to, &current_start) < 0) {
-      state->finished = true;
-      state->no_gaps = false;
-      PG_RETURN_POINTER(state);
+    state = no_gaps_new_state(fcinfo, no_gaps_recv_range(&buf));
+    nintervals = pq_getmsgint(&buf, 4);
+    if (nintervals > state->maxintervals) {
+      state->maxintervals = nintervals;
+      state->intervals = (no_gaps_interval *)repalloc(state->intervals, nintervals * sizeof(no_gaps_interval));
     }
-  }
-  
-  // If the current range starts after the last covered range, it means the ranges are not sorted
-  if (range_cmp_bounds(typcache, &current_start, &state->covered_to) < 0) {
-    //ereport(ERROR, (errmsg(
-    //    "no_gaps first argument should be sorted but got %s after covering up to %s",
-    //    DatumGetString(elem_oid, current_start),
-    //    DatumGetString(elem_oid, state->covered_to)
-    //)));
-    ereport(ERROR, (errmsg(
-      "no_gaps first argument should be sorted but got a range ending before the last covered_to"
-    )));
-  }
-  
-  // Update the covered range if the current range extends beyond it
-  if (range_cmp_bounds(typcache, &current_end, &state->covered_to) > 0) {
-    state->covered_to = current_end;
-    if (!elem_typcache->typbyval && elem_typcache->typlen == -1) {
-        //ereport(DEBUG1, (errmsg("Performing memory copy.")));
-        //ereport(DEBUG1, (errmsg("Before pfree(state->covered_to.val)")));
-        oldContext = MemoryContextSwitchTo(aggContext);
-        // The first covered_to is not allocated on the stack, so it can not be freed...
-        //pfree(state->covered_to.val);
-        //ereport(DEBUG1, (errmsg("Before datumCopy.")));
-        state->covered_to.val = datumCopy(current_end.val, /*pass by reference when false*/ false, /*dynamic length when -1*/ -1);
-        //ereport(DEBUG1, (errmsg("After datumCopy.")));
-        MemoryContextSwitchTo(oldContext);
-    } else {
-        //ereport(DEBUG1, (errmsg("Skipping memory copy.")));
+    // The bounds point into the received ranges. That is fine since the
+    // combinefn copies them and never frees them in its second argument.
+    for (i = 0; i < nintervals; i++) {
+      bool empty;
+
+      range_deserialize(state->typcache, no_gaps_recv_range(&buf),
+          &state->intervals[i].lower, &state->intervals[i].upper, &empty);
     }
-    
-    // Notice that the previous non-inclusive end is included in the next start.
-    state->covered_to.inclusive = true;
+    state->nintervals = nintervals;
+    no_gaps_check_covered(state);
   }
-  
-  // If the covered range now extends to or beyond the target end, we have full coverage
-  if (!state->target_end.infinite && range_cmp_bounds(typcache, &state->covered_to, &state->target_end) >= 0) {
-    state->no_gaps = true;
-    state->finished = true;
-  }
-  //oldContext = MemoryContextSwitchTo(aggContext);
-  //ereport(DEBUG1, (errmsg("post state->covered_to is %s", DatumGetString(elem_oid, state->covered_to))));
-  //MemoryContextSwitchTo(oldContext);
-  
+
+  pq_getmsgend(&buf);
+  pfree(buf.data);
+
   PG_RETURN_POINTER(state);
 }
 
 Datum no_gaps_finalfn(PG_FUNCTION_ARGS)
 {
+  MemoryContext aggContext, oldContext;
   no_gaps_state *state;
 
   if (PG_ARGISNULL(0)) PG_RETURN_NULL();
 
+  if (!AggCheckCallContext(fcinfo, &aggContext)) {
+    elog(ERROR, "no_gaps_finalfn called in non-aggregate context");
+  }
+
   state = (no_gaps_state *)PG_GETARG_POINTER(0);
+  oldContext = MemoryContextSwitchTo(aggContext);
+  no_gaps_flush(state);
+  MemoryContextSwitchTo(oldContext);
   if (state->answer_is_null) {
     PG_RETURN_NULL();
   } else {
@@ -243,65 +637,260 @@ Datum no_gaps_finalfn(PG_FUNCTION_ARGS)
 }
 
 
-Datum DatumNegativeInfinity(Oid elem_oid)
+// The plans of no_gaps_lookup, one per table, era and key columns.
+typedef struct no_gaps_lookup_key {
+  Oid relid;
+  NameData era_name;
+  int nkeys;
+  AttrNumber attnums[INDEX_MAX_KEYS];
+} no_gaps_lookup_key;
+
+typedef struct no_gaps_lookup_entry {
+  no_gaps_lookup_key key; // The hash key; must be first
+  uint32 generation;      // Of the cached era we planned for
+  SPIPlanPtr qplan;
+} no_gaps_lookup_entry;
+
+static HTAB *no_gaps_lookup_plans = NULL;
+
+
+/*
+ * Reads (start, end) rows sorted by start from the cursor and returns true if
+ * they cover the target from target_start to target_end without any gap.
+ *
+ * The rows are fetched a few at a time and reading stops at the first gap or
+ * as soon as the target is covered, so only the rows that are needed for the
+ * answer are read (and locked, for a FOR KEY SHARE cursor).
+ * The rows are half open [start, end) like the eras; the target end can be
+ * inclusive.
+ */
+bool SagaCoveredByCursor(Portal portal, Oid element_type, Datum target_start, Datum target_end, bool end_inclusive)
 {
-    switch (elem_oid)
-    {
-        case INT4OID:
-            return Int32GetDatum(INT32_MIN);
-        case INT8OID:
-            return Int64GetDatum(INT64_MIN);
-        case DATEOID:
-            return DateADTGetDatum(DATEVAL_NOBEGIN);
-        case NUMERICOID:
-            return NumericGetDatum(NUMERIC_NINF);
-        case TIMESTAMPOID:
-        case TIMESTAMPTZOID:
-            return DatumGetTimestampTz(DT_NOBEGIN);
-        default:
-            elog(ERROR, "Unsupported range type: %u", elem_oid);
-            return (Datum) 0;  // This line will not be reached due to the elog(ERROR) above
+  TypeCacheEntry *typcache = lookup_type_cache(element_type, TYPECACHE_CMP_PROC_FINFO);
+  coverage_type type;
+  coverage_sweep sweep;
+  RangeBound target_lower = {target_start, false, true, true};
+  RangeBound target_upper = {target_end, false, end_inclusive, false};
+  bool covered;
+  long fetch_count = 4;
+
+  if (!OidIsValid(typcache->cmp_proc_finfo.fn_oid)) {
+    ereport(ERROR, (errcode(ERRCODE_UNDEFINED_FUNCTION),
+        errmsg("could not identify a comparison function for type %s", format_type_be(element_type))));
+  }
+
+  coverage_type_of_element(&type, typcache);
+  coverage_sweep_init(&sweep, &type, &target_lower, &target_upper);
+
+  while (!sweep.finished) {
+    uint64 i;
+
+    SPI_cursor_fetch(portal, true, fetch_count);
+    if (SPI_processed == 0) break;
+
+    // The sweep keeps a copy of what it needs of the rows,
+    // since the fetched rows go away with the next fetch
+    for (i = 0; i < SPI_processed && !sweep.finished; i++) {
+      HeapTuple tuple = SPI_tuptable->vals[i];
+      TupleDesc tupdesc = SPI_tuptable->tupdesc;
+      bool isnull;
+      RangeBound lower = {SPI_getbinval(tuple, tupdesc, 1, &isnull), false, true, true};
+      RangeBound upper = {SPI_getbinval(tuple, tupdesc, 2, &isnull), false, false, false};
+
+      if (!coverage_sweep_next(&sweep, &lower, &upper)) {
+        elog(ERROR, "rows are not sorted by their start");
+      }
+    }
+
+    SPI_freetuptable(SPI_tuptable);
+
+    // Deep histories need more rows, so fetch more each time
+    if (fetch_count < 1024) fetch_count *= 2;
+  }
+
+  covered = sweep.covered;
+  coverage_sweep_free(&sweep);
+
+  return covered;
+}
+
+
+static SPIPlanPtr no_gaps_lookup_plan(const SagaEra *era, int nkeys, char **column_names, AttrNumber *attnums, Oid *types)
+{
+  no_gaps_lookup_key key;
+  no_gaps_lookup_entry *entry;
+  bool found;
+  StringInfoData buf;
+  const char *start_column = quote_identifier(NameStr(era->start_column_name));
+  const char *end_column = quote_identifier(NameStr(era->end_column_name));
+  int i;
+
+  if (no_gaps_lookup_plans == NULL) {
+    HASHCTL ctl;
+
+    memset(&ctl, 0, sizeof(ctl));
+    ctl.keysize = sizeof(no_gaps_lookup_key);
+    ctl.entrysize = sizeof(no_gaps_lookup_entry);
+    no_gaps_lookup_plans = hash_create("no_gaps_lookup plans", 16, &ctl, HASH_ELEM | HASH_BLOBS);
+  }
+
+  // The key is hashed as a blob, so clear out the padding
+  memset(&key, 0, sizeof(key));
+  key.relid = era->key.relid;
+  key.era_name = era->key.era_name;
+  key.nkeys = nkeys;
+  memcpy(key.attnums, attnums, nkeys * sizeof(AttrNumber));
+
+  entry = (no_gaps_lookup_entry *) hash_search(no_gaps_lookup_plans, &key, HASH_ENTER, &found);
+  if (!found) entry->qplan = NULL;
+
+  // A new generation of the era means its table or columns might have changed
+  if (entry->qplan != NULL && entry->generation == era->generation) return entry->qplan;
+
+  if (entry->qplan != NULL) {
+    SPI_freeplan(entry->qplan);
+    entry->qplan = NULL;
+  }
+
+  initStringInfo(&buf);
+  appendStringInfo(&buf, "SELECT t.%s, t.%s FROM %s AS t WHERE ",
+      start_column, end_column,
+      quote_qualified_identifier(get_namespace_name(get_rel_namespace(era->key.relid)),
+                                 get_rel_name(era->key.relid)));
+  for (i = 0; i < nkeys; i++) {
+    appendStringInfo(&buf, "t.%s = $%d AND ", quote_identifier(column_names[i]), i + 1);
+  }
+  appendStringInfo(&buf, "t.%s <= $%d AND t.%s > $%d ORDER BY t.%s",
+      start_column, nkeys + 2, end_column, nkeys + 1, start_column);
+
+  types[nkeys] = era->element_type;
+  types[nkeys + 1] = era->element_type;
+
+  // Ask for a plan that returns the first rows fast, since we rarely need all of them
+  entry->qplan = SPI_prepare_cursor(buf.data, nkeys + 2, types, CURSOR_OPT_NO_SCROLL | CURSOR_OPT_FAST_PLAN);
+  if (entry->qplan == NULL) {
+    elog(ERROR, "SPI_prepare_cursor returned %s for %s", SPI_result_code_string(SPI_result), buf.data);
+  }
+  if (SPI_keepplan(entry->qplan) != 0) {
+    elog(ERROR, "SPI_keepplan failed");
+  }
+  entry->generation = era->generation;
+
+  return entry->qplan;
+}
+
+
+/*
+ * no_gaps_lookup(table_name regclass, column_names name[], key_values text[], target anyrange, era_name name)
+ * Returns true if the rows of the era with the given key cover the target
+ * without any gap.  It gives the same answer as no_gaps over those rows, but
+ * reads them in order from the table and stops as soon as the answer is known.
+ */
+Datum no_gaps_lookup(PG_FUNCTION_ARGS)
+{
+  Oid relid = PG_GETARG_OID(0);
+  ArrayType *column_names_array = PG_GETARG_ARRAYTYPE_P(1);
+  ArrayType *key_values_array = PG_GETARG_ARRAYTYPE_P(2);
+  RangeType *target = PG_GETARG_RANGE_P(3);
+  Name era_name = PG_GETARG_NAME(4);
+  TypeCacheEntry *typcache;
+  RangeBound target_start, target_end;
+  bool target_empty;
+  const SagaEra *era;
+  Datum *names, *texts;
+  bool *name_nulls, *text_nulls;
+  int nkeys, nvalues;
+  char *column_names[INDEX_MAX_KEYS];
+  AttrNumber attnums[INDEX_MAX_KEYS];
+  Oid types[INDEX_MAX_KEYS + 2];
+  Datum values[INDEX_MAX_KEYS + 2];
+  char nulls[INDEX_MAX_KEYS + 2];
+  SPIPlanPtr qplan;
+  Portal portal;
+  bool covered;
+  int i;
+
+  deconstruct_array(column_names_array, NAMEOID, NAMEDATALEN, false, 'c', &names, &name_nulls, &nkeys);
+  deconstruct_array(key_values_array, TEXTOID, -1, false, 'i', &texts, &text_nulls, &nvalues);
+
+  if (nkeys != nvalues) {
+    ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+        errmsg("no_gaps_lookup column_names and key_values must have the same length")));
+  }
+  if (nkeys > INDEX_MAX_KEYS) {
+    ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+        errmsg("no_gaps_lookup can not use more than %d key columns", INDEX_MAX_KEYS)));
+  }
+
+  // Same as no_gaps: an empty target gives NULL
+  typcache = range_get_typcache(fcinfo, RangeTypeGetOid(target));
+  range_deserialize(typcache, target, &target_start, &target_end, &target_empty);
+  if (target_empty) PG_RETURN_NULL();
+
+  if (SPI_connect() != SPI_OK_CONNECT) elog(ERROR, "SPI_connect failed");
+
+  era = SagaLookupEra(relid, NameStr(*era_name), false);
+  if (era->range_type != RangeTypeGetOid(target)) {
+    ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+        errmsg("range types do not match")));
+  }
+
+  for (i = 0; i < nkeys; i++) {
+    if (name_nulls[i]) {
+      ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+          errmsg("no_gaps_lookup column_names can not contain NULL")));
     }
+    column_names[i] = NameStr(*DatumGetName(names[i]));
+    attnums[i] = get_attnum(relid, column_names[i]);
+    if (attnums[i] == InvalidAttrNumber) {
+      ereport(ERROR, (errcode(ERRCODE_UNDEFINED_COLUMN),
+          errmsg("column \"%s\" does not exist", column_names[i])));
+    }
+    types[i] = get_atttype(relid, attnums[i]);
+
+    // The key values are given as text, so parse them as the column type
+    if (text_nulls[i]) {
+      values[i] = (Datum) 0;
+      nulls[i] = 'n';
+    } else {
+      Oid input_func, ioparam;
+
+      getTypeInputInfo(types[i], &input_func, &ioparam);
+      values[i] = OidInputFunctionCall(input_func, TextDatumGetCString(texts[i]), ioparam, -1);
+      nulls[i] = ' ';
+    }
+  }
+
+  // The era columns hold values, so they can never cover an unbounded target
+  if (target_start.infinite || target_end.infinite) {
+    if (SPI_finish() != SPI_OK_FINISH) elog(ERROR, "SPI_finish failed");
+    PG_RETURN_BOOL(false);
+  }
+
+  values[nkeys] = target_start.val;
+  nulls[nkeys] = ' ';
+  values[nkeys + 1] = target_end.val;
+  nulls[nkeys + 1] = ' ';
+
+  qplan = no_gaps_lookup_plan(era, nkeys, column_names, attnums, types);
+  portal = SPI_cursor_open(NULL, qplan, values, nulls, true);
+  covered = SagaCoveredByCursor(portal, typcache->rngelemtype->type_id,
+      target_start.val, target_end.val, target_end.inclusive);
+  SPI_cursor_close(portal);
+
+  if (SPI_finish() != SPI_OK_FINISH) elog(ERROR, "SPI_finish failed");
+
+  PG_RETURN_BOOL(covered);
 }
 
 
 char *DatumGetString(Oid elem_oid, RangeBound bound) {
-    char *result;
-
-    switch (elem_oid) {
-        case INT4OID:
-            result = psprintf("%d", DatumGetInt32(bound.val));
-            break;
-        case INT8OID:
-            result = psprintf("%ld", DatumGetInt64(bound.val));
-            break;
-        case DATEOID: {
-            char *dateStr = DatumGetCString(DirectFunctionCall1(date_out, bound.val));
-            result = psprintf("%s", dateStr);
-            //pfree(dateStr);
-            break;
-        }
-        case NUMERICOID: {
-            char *numericStr = DatumGetCString(DirectFunctionCall1(numeric_out, bound.val));
-            result = psprintf("%s", numericStr);
-            //pfree(numericStr);
-            break;
-        }
-        case TIMESTAMPOID: {
-            char *timestampStr = DatumGetCString(DirectFunctionCall1(timestamp_out, bound.val));
-            result = psprintf("%s", timestampStr);
-            //pfree(timestampStr);
-            break;
-        }
-        case TIMESTAMPTZOID: {
-            char *timestamptzStr = DatumGetCString(DirectFunctionCall1(timestamptz_out, bound.val));
-            result = psprintf("%s", timestamptzStr);
-            //pfree(timestamptzStr);
-            break;
-        }
-        default:
-            elog(ERROR, "Unsupported element type id: %u", elem_oid);
-            return NULL; // This line will not be reached due to the elog(ERROR) above
+    Oid typoutput;
+    bool typisvarlena;
+
+    if (bound.infinite) {
+        return pstrdup(bound.lower ? "-infinity" : "infinity");
     }
-    return result;
+    getTypeOutputInfo(elem_oid, &typoutput, &typisvarlena);
+    return OidOutputFunctionCall(typoutput, bound.val);
 }
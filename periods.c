@@ -2,6 +2,9 @@
 #include "fmgr.h"
 
 #include "access/htup_details.h"
+#if (PG_VERSION_NUM < 130000)
+#include "access/hash.h"
+#endif
 #include "access/heapam.h"
 #if (PG_VERSION_NUM < 120000)
 #define table_open(r, l)	heap_open(r, l)
@@ -12,12 +15,18 @@
 #include "access/tupconvert.h"
 #include "access/xact.h"
 #include "catalog/pg_type.h"
+#if (PG_VERSION_NUM >= 130000)
+#include "common/hashfn.h"
+#endif
 #include "commands/trigger.h"
 #include "datatype/timestamp.h"
 #include "executor/spi.h"
 #include "funcapi.h"
 #include "lib/stringinfo.h"
+#include "miscadmin.h"
 #include "nodes/bitmapset.h"
+#include "nodes/parsenodes.h"
+#include "storage/lock.h"
 #include "utils/builtins.h"
 #include "utils/date.h"
 #include "utils/datum.h"
@@ -27,16 +36,38 @@
 #include "utils/fmgrprotos.h"
 #endif
 #include "utils/hsearch.h"
+#include "utils/inval.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
+#include "utils/snapmgr.h"
 #include "utils/timestamp.h"
+#include "utils/typcache.h"
+#if (PG_VERSION_NUM < 120000)
+#include "utils/tqual.h"
+#else
+#include "access/tableam.h"
+#endif
+
+#include "sql_saga.h"
 
 PGDLLEXPORT Datum generated_always_as_row_start_end(PG_FUNCTION_ARGS);
 PGDLLEXPORT Datum write_history(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum fk_insert_check(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum fk_update_check(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum uk_update_check(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum uk_delete_check(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum uk_overlap_check(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum update_portion_of(PG_FUNCTION_ARGS);
 
 PG_FUNCTION_INFO_V1(generated_always_as_row_start_end);
 PG_FUNCTION_INFO_V1(write_history);
+PG_FUNCTION_INFO_V1(fk_insert_check);
+PG_FUNCTION_INFO_V1(fk_update_check);
+PG_FUNCTION_INFO_V1(uk_update_check);
+PG_FUNCTION_INFO_V1(uk_delete_check);
+PG_FUNCTION_INFO_V1(uk_overlap_check);
+PG_FUNCTION_INFO_V1(update_portion_of);
 
 /* Define some SQLSTATEs that might not exist */
 #if (PG_VERSION_NUM < 100000)
@@ -81,6 +112,95 @@ CreateInsertHistoryPlanHash(void)
 	return hash_create("Insert History Hash", 16, &ctl, HASH_ELEM | HASH_BLOBS);
 }
 
+/* Plan caches for checking temporal foreign keys */
+static HTAB *ForeignKeyPlanHash = NULL;
+
+typedef enum ForeignKeyPlanKind
+{
+	FK_PLAN_NEW_ROW,			/* is a referencing row covered? */
+	FK_PLAN_OLD_ROW				/* are the rows referencing a removed row still covered? */
+} ForeignKeyPlanKind;
+
+typedef struct ForeignKeyPlanKey
+{
+	NameData	key_name;
+	ForeignKeyPlanKind kind;
+} ForeignKeyPlanKey;
+
+typedef struct ForeignKeyPlanEntry
+{
+	ForeignKeyPlanKey key;		/* the hash key; must be first */
+	uint32		generation;		/* of the cached foreign key we planned for */
+	SPIPlanPtr	qplan;
+} ForeignKeyPlanEntry;
+
+static HTAB *
+CreateForeignKeyPlanHash(void)
+{
+	HASHCTL	ctl;
+
+	ctl.keysize = sizeof(ForeignKeyPlanKey);
+	ctl.entrysize = sizeof(ForeignKeyPlanEntry);
+
+	return hash_create("Foreign Key Plan Hash", 16, &ctl, HASH_ELEM | HASH_BLOBS);
+}
+
+/*
+ * Ranges of referenced keys already found covered by this transaction.
+ * During a bulk load many rows reference the same key over much the same
+ * period, and the referenced rows that covered the first of them stay locked
+ * by us until we commit, so a row inside such a range can skip the query.
+ *
+ * The key values are flattened to bytes, so equal values with different
+ * representations just miss.  Anything this transaction does to the
+ * referenced rows throws the whole cache away: updates and deletes fire
+ * uk_update_check() and uk_delete_check(), a truncate invalidates the
+ * relcache entry of the table, and an aborted subtransaction releases the
+ * locks it took.
+ */
+typedef struct ForeignKeyCoverageKey
+{
+	NameData	key_name;
+	uint32		hash;			/* of the flattened key values */
+} ForeignKeyCoverageKey;
+
+typedef struct ForeignKeyCoverageEntry
+{
+	ForeignKeyCoverageKey key;	/* the hash key; must be first */
+	uint32		generation;		/* of the cached foreign key */
+	Oid			uk_relid;
+	char	   *values;
+	int			values_len;
+	Datum		start;
+	Datum		end;
+} ForeignKeyCoverageEntry;
+
+static HTAB *ForeignKeyCoverageHash = NULL;
+static MemoryContext ForeignKeyCoverageContext = NULL;
+static bool ForeignKeyCoverageStale = false;
+static bool ForeignKeyCoverageCallbacksRegistered = false;
+
+/* Plan cache for checking unique keys without an exclusion constraint */
+static HTAB *UniqueKeyPlanHash = NULL;
+
+typedef struct UniqueKeyPlanEntry
+{
+	NameData	key_name;		/* the hash key; must be first */
+	uint32		generation;		/* of the cached unique key we planned for */
+	SPIPlanPtr	qplan;
+} UniqueKeyPlanEntry;
+
+static HTAB *
+CreateUniqueKeyPlanHash(void)
+{
+	HASHCTL	ctl;
+
+	ctl.keysize = sizeof(NameData);
+	ctl.entrysize = sizeof(UniqueKeyPlanEntry);
+
+	return hash_create("Unique Key Plan Hash", 16, &ctl, HASH_ELEM | HASH_BLOBS);
+}
+
 static void
 GetPeriodColumnNames(Relation rel, char *period_name, char **start_name, char **end_name)
 {
@@ -542,8 +662,8 @@ insert_into_history(Relation history_rel, HeapTuple history_tuple)
 
 	/* If we didn't find it or the name changed, re-plan it */
 	if (!found ||
-		!strcmp(hentry->schemaname, schemaname) ||
-		!strcmp(hentry->tablename, tablename))
+		strcmp(hentry->schemaname, schemaname) != 0 ||
+		strcmp(hentry->tablename, tablename) != 0)
 	{
 		StringInfo	buf = makeStringInfo();
 		Oid			type = HeapTupleHeaderGetTypeId(history_tuple->t_data);
@@ -786,3 +906,1681 @@ write_history(PG_FUNCTION_ARGS)
 
 	return PointerGetDatum(NULL);
 }
+
+/*
+ * Get the attribute numbers of the referencing columns, or the referenced
+ * columns if uk_side is true, in the relation the trigger fired on.
+ */
+static void
+GetForeignKeyAttnums(const SagaForeignKey *fk, Relation rel, bool uk_side, int16 *attnums)
+{
+	TupleDesc	tupdesc = RelationGetDescr(rel);
+	const NameData *column_names = uk_side ? fk->uk_column_names : fk->fk_column_names;
+	int			i;
+
+	if (rel->rd_id == (uk_side ? fk->uk_relid : fk->fk_relid))
+	{
+		for (i = 0; i < fk->nkeys; i++)
+			attnums[i] = uk_side ? fk->uk_attnums[i] : fk->fk_attnums[i];
+		attnums[fk->nkeys] = uk_side ? fk->uk_start_attnum : fk->fk_start_attnum;
+		attnums[fk->nkeys + 1] = uk_side ? fk->uk_end_attnum : fk->fk_end_attnum;
+		return;
+	}
+
+	/* Look them up by name */
+	for (i = 0; i < fk->nkeys + 2; i++)
+	{
+		const char *attname;
+
+		if (i < fk->nkeys)
+			attname = NameStr(column_names[i]);
+		else if (i == fk->nkeys)
+			attname = NameStr(uk_side ? fk->uk_start_column_name : fk->fk_start_column_name);
+		else
+			attname = NameStr(uk_side ? fk->uk_end_column_name : fk->fk_end_column_name);
+
+		attnums[i] = SPI_fnumber(tupdesc, attname);
+
+		/* Make sure it's valid (should always be) */
+		if (attnums[i] == SPI_ERROR_NOATTRIBUTE || attnums[i] < 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_COLUMN),
+					 errmsg("column \"%s\" does not exist", attname)));
+	}
+}
+
+/*
+ * Append the coverage subquery for a temporal foreign key: one row with the
+ * no_gaps() of the referenced ranges that match the given key expressions and
+ * overlap the range from start_expr to end_expr.
+ *
+ * The referenced rows are read in order from the unique key's index, so
+ * no_gaps() sees them sorted without any sort step.
+ */
+static void
+AppendForeignKeyCoverage(StringInfo buf, const SagaForeignKey *fk,
+						 char **key_exprs, const char *start_expr,
+						 const char *end_expr)
+{
+	const char *range_type = format_type_be_qualified(fk->range_type);
+	const char *uk_start = quote_identifier(NameStr(fk->uk_start_column_name));
+	const char *uk_end = quote_identifier(NameStr(fk->uk_end_column_name));
+	int			i;
+
+	appendStringInfo(buf,
+		"SELECT coalesce(sql_saga.no_gaps(uk.r, %s(%s, %s)), false) "
+		"FROM (SELECT %s(uk.%s, uk.%s) AS r "
+		"      FROM %s AS uk "
+		"      WHERE ",
+		range_type, start_expr, end_expr,
+		range_type, uk_start, uk_end,
+		quote_qualified_identifier(NameStr(fk->uk_schema_name),
+								   NameStr(fk->uk_table_name)));
+
+	for (i = 0; i < fk->nkeys; i++)
+		appendStringInfo(buf, "uk.%s = %s AND ",
+						 quote_identifier(NameStr(fk->uk_column_names[i])),
+						 key_exprs[i]);
+
+	appendStringInfo(buf,
+		"uk.%s < %s AND uk.%s > %s "
+		"      ORDER BY uk.%s "
+		"     ) AS uk",
+		uk_start, end_expr, uk_end, start_expr,
+		uk_start);
+}
+
+/*
+ * Get one of the queries checking a temporal foreign key, preparing it if we
+ * haven't already.  The caller must already be connected to SPI.
+ *
+ * Both plans take key values followed by start and end values:
+ *
+ *	FK_PLAN_NEW_ROW: those of a referencing row.  This is a cursor over the
+ *	referenced rows that can cover it, sorted by start, to be read with
+ *	SagaCoveredByCursor() so that we stop at the first gap or once the row is
+ *	covered.
+ *
+ *	FK_PLAN_OLD_ROW: those of a referenced row that was updated or deleted.
+ *	This returns a single boolean that is true if every referencing row with
+ *	that key overlapping that range is still covered.
+ */
+static SPIPlanPtr
+GetForeignKeyPlan(const SagaForeignKey *fk, ForeignKeyPlanKind kind)
+{
+	ForeignKeyPlanKey key;
+	ForeignKeyPlanEntry *fkentry;
+	bool		found;
+	int			ret;
+	int			i;
+	Oid			types[INDEX_MAX_KEYS + 2];
+	char	   *key_exprs[INDEX_MAX_KEYS];
+	StringInfo	buf;
+
+	if (!ForeignKeyPlanHash)
+		ForeignKeyPlanHash = CreateForeignKeyPlanHash();
+
+	/* The key is hashed as a blob, so clear out the padding */
+	memset(&key, 0, sizeof(key));
+	key.key_name = fk->key_name;
+	key.kind = kind;
+
+	fkentry = (ForeignKeyPlanEntry *) hash_search(
+			ForeignKeyPlanHash,
+			&key,
+			HASH_ENTER,
+			&found);
+
+	if (!found)
+		fkentry->qplan = NULL;
+
+	/* If the foreign key changed since we planned, re-plan it */
+	if (fkentry->qplan != NULL && fkentry->generation == fk->generation)
+		return fkentry->qplan;
+
+	if (fkentry->qplan != NULL)
+	{
+		SPI_freeplan(fkentry->qplan);
+		fkentry->qplan = NULL;
+	}
+
+	buf = makeStringInfo();
+	if (kind == FK_PLAN_NEW_ROW)
+	{
+		const char *uk_start = quote_identifier(NameStr(fk->uk_start_column_name));
+		const char *uk_end = quote_identifier(NameStr(fk->uk_end_column_name));
+
+		appendStringInfo(buf,
+			"SELECT uk.%s, uk.%s "
+			"FROM %s AS uk "
+			"WHERE ",
+			uk_start, uk_end,
+			quote_qualified_identifier(NameStr(fk->uk_schema_name),
+									   NameStr(fk->uk_table_name)));
+
+		for (i = 0; i < fk->nkeys; i++)
+			appendStringInfo(buf, "uk.%s = $%d AND ",
+							 quote_identifier(NameStr(fk->uk_column_names[i])),
+							 i + 1);
+
+		/* The rows we read are locked as we go */
+		appendStringInfo(buf,
+			"uk.%s < $%d AND uk.%s > $%d "
+			"ORDER BY uk.%s "
+			"FOR KEY SHARE",
+			uk_start, fk->nkeys + 2, uk_end, fk->nkeys + 1,
+			uk_start);
+	}
+	else
+	{
+		const char *fk_start = quote_identifier(NameStr(fk->fk_start_column_name));
+		const char *fk_end = quote_identifier(NameStr(fk->fk_end_column_name));
+
+		appendStringInfo(buf,
+			"SELECT NOT EXISTS ( "
+			"    SELECT FROM %s AS fk "
+			"    WHERE ",
+			quote_qualified_identifier(NameStr(fk->fk_schema_name),
+									   NameStr(fk->fk_table_name)));
+
+		for (i = 0; i < fk->nkeys; i++)
+		{
+			key_exprs[i] = psprintf("fk.%s",
+									quote_identifier(NameStr(fk->fk_column_names[i])));
+			appendStringInfo(buf, "%s = $%d AND ", key_exprs[i], i + 1);
+		}
+
+		/*
+		 * Only the referencing rows that overlap the removed range can have
+		 * lost their coverage, and each of them must be covered by what is
+		 * left.
+		 */
+		appendStringInfo(buf,
+			"fk.%s < $%d AND fk.%s > $%d "
+			"      AND NOT (",
+			fk_start, fk->nkeys + 2, fk_end, fk->nkeys + 1);
+
+		AppendForeignKeyCoverage(buf, fk, key_exprs,
+								 psprintf("fk.%s", fk_start),
+								 psprintf("fk.%s", fk_end));
+
+		appendStringInfoString(buf, ")) ");
+	}
+
+	/* The parameters have the types of the referencing columns */
+	for (i = 0; i < fk->nkeys; i++)
+		types[i] = fk->fk_types[i];
+	types[fk->nkeys] = fk->element_type;
+	types[fk->nkeys + 1] = fk->element_type;
+
+	if (kind == FK_PLAN_NEW_ROW)
+		fkentry->qplan = SPI_prepare_cursor(buf->data, fk->nkeys + 2, types,
+											CURSOR_OPT_NO_SCROLL | CURSOR_OPT_FAST_PLAN);
+	else
+		fkentry->qplan = SPI_prepare(buf->data, fk->nkeys + 2, types);
+	if (fkentry->qplan == NULL)
+		elog(ERROR, "SPI_prepare returned %s for %s",
+			 SPI_result_code_string(SPI_result), buf->data);
+
+	ret = SPI_keepplan(fkentry->qplan);
+	if (ret != 0)
+		elog(ERROR, "SPI_keepplan returned %s", SPI_result_code_string(ret));
+
+	fkentry->generation = fk->generation;
+
+	return fkentry->qplan;
+}
+
+/*
+ * Forget every covered range, as described above ForeignKeyCoverageKey.
+ */
+static void
+ResetForeignKeyCoverage(void)
+{
+	if (ForeignKeyCoverageContext != NULL)
+		MemoryContextDelete(ForeignKeyCoverageContext);
+	ForeignKeyCoverageContext = NULL;
+	ForeignKeyCoverageHash = NULL;
+	ForeignKeyCoverageStale = false;
+}
+
+static void
+ForeignKeyCoverageXactCallback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PREPARE:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		case XACT_EVENT_PARALLEL_ABORT:
+			/* The memory goes away with the transaction */
+			ForeignKeyCoverageContext = NULL;
+			ForeignKeyCoverageHash = NULL;
+			ForeignKeyCoverageStale = false;
+			break;
+
+		default:
+			break;
+	}
+}
+
+static void
+ForeignKeyCoverageSubXactCallback(SubXactEvent event, SubTransactionId mySubid,
+								  SubTransactionId parentSubid, void *arg)
+{
+	if (event == SUBXACT_EVENT_ABORT_SUB)
+		ResetForeignKeyCoverage();
+}
+
+/*
+ * We can't free anything in here, someone may be using the entries, so
+ * just note that the cache must go before its next use.
+ */
+static void
+ForeignKeyCoverageRelcacheCallback(Datum arg, Oid relid)
+{
+	HASH_SEQ_STATUS status;
+	ForeignKeyCoverageEntry *entry;
+
+	if (ForeignKeyCoverageHash == NULL || ForeignKeyCoverageStale)
+		return;
+
+	if (!OidIsValid(relid))
+	{
+		ForeignKeyCoverageStale = true;
+		return;
+	}
+
+	hash_seq_init(&status, ForeignKeyCoverageHash);
+	while ((entry = (ForeignKeyCoverageEntry *) hash_seq_search(&status)) != NULL)
+	{
+		if (entry->uk_relid == relid)
+		{
+			ForeignKeyCoverageStale = true;
+			hash_seq_term(&status);
+			break;
+		}
+	}
+}
+
+/*
+ * Flatten the key values of a referencing row into buf.
+ */
+static void
+FlattenForeignKeyValues(StringInfo buf, TupleDesc tupdesc, const int16 *attnums,
+						const Datum *values, int nkeys)
+{
+	int			i;
+
+	for (i = 0; i < nkeys; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, attnums[i] - 1);
+
+		if (attr->attbyval)
+			appendBinaryStringInfo(buf, (const char *) &values[i], sizeof(Datum));
+		else if (attr->attlen > 0)
+			appendBinaryStringInfo(buf, DatumGetPointer(values[i]), attr->attlen);
+		else if (attr->attlen == -1)
+		{
+			struct varlena *value = PG_DETOAST_DATUM_PACKED(values[i]);
+			int32		len = VARSIZE_ANY_EXHDR(value);
+
+			appendBinaryStringInfo(buf, (const char *) &len, sizeof(len));
+			appendBinaryStringInfo(buf, VARDATA_ANY(value), len);
+		}
+		else
+			appendBinaryStringInfo(buf, DatumGetCString(values[i]),
+								   strlen(DatumGetCString(values[i])) + 1);
+	}
+}
+
+/*
+ * Find the entry for the key values of a referencing row, creating the cache
+ * and the entry if asked to.
+ */
+static ForeignKeyCoverageEntry *
+GetForeignKeyCoverageEntry(const char *key_name, StringInfo values, bool create)
+{
+	ForeignKeyCoverageKey key;
+	ForeignKeyCoverageEntry *entry;
+	bool		found;
+
+	if (ForeignKeyCoverageStale)
+		ResetForeignKeyCoverage();
+
+	if (ForeignKeyCoverageHash == NULL)
+	{
+		HASHCTL		ctl;
+
+		if (!create)
+			return NULL;
+
+		if (!ForeignKeyCoverageCallbacksRegistered)
+		{
+			RegisterXactCallback(ForeignKeyCoverageXactCallback, NULL);
+			RegisterSubXactCallback(ForeignKeyCoverageSubXactCallback, NULL);
+			CacheRegisterRelcacheCallback(ForeignKeyCoverageRelcacheCallback, (Datum) 0);
+			ForeignKeyCoverageCallbacksRegistered = true;
+		}
+
+		ForeignKeyCoverageContext = AllocSetContextCreate(TopTransactionContext,
+														  "Foreign Key Coverage",
+														  ALLOCSET_DEFAULT_SIZES);
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(ForeignKeyCoverageKey);
+		ctl.entrysize = sizeof(ForeignKeyCoverageEntry);
+		ctl.hcxt = ForeignKeyCoverageContext;
+		ForeignKeyCoverageHash = hash_create("Foreign Key Coverage Hash", 256, &ctl,
+											 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	/* The key is hashed as a blob, so clear out the padding */
+	memset(&key, 0, sizeof(key));
+	namestrcpy(&key.key_name, key_name);
+	key.hash = DatumGetUInt32(hash_any((const unsigned char *) values->data, values->len));
+
+	entry = (ForeignKeyCoverageEntry *) hash_search(ForeignKeyCoverageHash, &key,
+													create ? HASH_ENTER : HASH_FIND, &found);
+	if (create && !found)
+		entry->values = NULL;
+
+	return entry;
+}
+
+/*
+ * Is the entry for the same values, under the same definition of the key?
+ * Different values can share a hash.
+ */
+static bool
+ForeignKeyCoverageMatches(const ForeignKeyCoverageEntry *entry, uint32 generation,
+						  Oid uk_relid, StringInfo values)
+{
+	return entry->values != NULL &&
+		entry->generation == generation &&
+		entry->uk_relid == uk_relid &&
+		entry->values_len == values->len &&
+		memcmp(entry->values, values->data, values->len) == 0;
+}
+
+/*
+ * Is [start, end) inside a range of the key values that we already found
+ * covered?
+ */
+static bool
+ForeignKeyRangeKnownCovered(const char *key_name, uint32 generation, Oid uk_relid,
+							Oid element_type, StringInfo values, Datum start, Datum end)
+{
+	ForeignKeyCoverageEntry *entry;
+	TypeCacheEntry *typentry;
+	FmgrInfo   *cmp;
+	Oid			collation;
+
+	typentry = lookup_type_cache(element_type, TYPECACHE_CMP_PROC_FINFO);
+	cmp = &typentry->cmp_proc_finfo;
+	collation = typentry->typcollation;
+
+	entry = GetForeignKeyCoverageEntry(key_name, values, false);
+	if (entry == NULL || !ForeignKeyCoverageMatches(entry, generation, uk_relid, values))
+		return false;
+
+	return DatumGetInt32(FunctionCall2Coll(cmp, collation, entry->start, start)) <= 0 &&
+		   DatumGetInt32(FunctionCall2Coll(cmp, collation, end, entry->end)) <= 0;
+}
+
+/*
+ * Remember that [start, end) of the key values is covered.  A range touching
+ * the one already there is merged with it, since both are covered, and any
+ * other replaces it.
+ */
+static void
+RememberForeignKeyCoverage(const char *key_name, uint32 generation, Oid uk_relid,
+						   Oid element_type, StringInfo values, Datum start, Datum end)
+{
+	ForeignKeyCoverageEntry *entry;
+	MemoryContext oldcontext;
+	TypeCacheEntry *typentry;
+	FmgrInfo   *cmp;
+	Oid			collation;
+	int16		typlen;
+	bool		typbyval;
+
+	typentry = lookup_type_cache(element_type, TYPECACHE_CMP_PROC_FINFO);
+	cmp = &typentry->cmp_proc_finfo;
+	collation = typentry->typcollation;
+	get_typlenbyval(element_type, &typlen, &typbyval);
+
+	entry = GetForeignKeyCoverageEntry(key_name, values, true);
+
+	oldcontext = MemoryContextSwitchTo(ForeignKeyCoverageContext);
+
+	if (ForeignKeyCoverageMatches(entry, generation, uk_relid, values) &&
+		DatumGetInt32(FunctionCall2Coll(cmp, collation, start, entry->end)) <= 0 &&
+		DatumGetInt32(FunctionCall2Coll(cmp, collation, entry->start, end)) <= 0)
+	{
+		if (DatumGetInt32(FunctionCall2Coll(cmp, collation, start, entry->start)) < 0)
+			entry->start = datumCopy(start, typbyval, typlen);
+		if (DatumGetInt32(FunctionCall2Coll(cmp, collation, end, entry->end)) > 0)
+			entry->end = datumCopy(end, typbyval, typlen);
+	}
+	else
+	{
+		if (entry->values != NULL)
+			pfree(entry->values);
+		entry->generation = generation;
+		entry->uk_relid = uk_relid;
+		entry->values = (char *) palloc(values->len);
+		memcpy(entry->values, values->data, values->len);
+		entry->values_len = values->len;
+		entry->start = datumCopy(start, typbyval, typlen);
+		entry->end = datumCopy(end, typbyval, typlen);
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * Check that the row we were given is covered by the referenced table,
+ * raising an error if it is not.
+ */
+static void
+CheckForeignKeyNewRow(TriggerData *trigdata, HeapTuple new_row)
+{
+	Relation	rel = trigdata->tg_relation;
+	TupleDesc	tupdesc = RelationGetDescr(rel);
+	Trigger	   *trigger = trigdata->tg_trigger;
+	const SagaForeignKey *fk;
+	SPIPlanPtr	qplan;
+	int16		attnums[INDEX_MAX_KEYS + 2];
+	Datum		values[INDEX_MAX_KEYS + 2];
+	bool		has_nulls = false;
+	bool		all_nulls = true;
+	bool		isnull;
+	bool		covered;
+	StringInfoData flattened;
+	Oid			fk_relid;
+	Oid			uk_relid;
+	Oid			element_type;
+	uint32		generation;
+	char		match_type;
+	int			nkeys;
+	Portal		portal;
+	uint64		scanned;
+	instr_time	start;
+	int			i;
+
+	if (trigger->tgnargs != 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("trigger \"%s\" must be given the foreign key name",
+						trigger->tgname)));
+
+	INSTR_TIME_SET_CURRENT(start);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	/*
+	 * Take what we need from the cache entry now, it can be reloaded under
+	 * us once we start running queries.
+	 */
+	fk = SagaLookupForeignKey(trigger->tgargs[0], false);
+	nkeys = fk->nkeys;
+	fk_relid = fk->fk_relid;
+	uk_relid = fk->uk_relid;
+	element_type = fk->element_type;
+	generation = fk->generation;
+	match_type = fk->match_type;
+	GetForeignKeyAttnums(fk, rel, false, attnums);
+	qplan = GetForeignKeyPlan(fk, FK_PLAN_NEW_ROW);
+
+	for (i = 0; i < nkeys; i++)
+	{
+		values[i] = SPI_getbinval(new_row, tupdesc, attnums[i], &isnull);
+		if (isnull)
+			has_nulls = true;
+		else
+			all_nulls = false;
+	}
+
+	/*
+	 * If there are no values at all, all three types pass.
+	 *
+	 * Period columns are by definition NOT NULL so the FULL MATCH type is only
+	 * concerned with the non-period columns of the constraint.  SQL:2016
+	 * 4.23.3.3
+	 */
+	if (all_nulls)
+	{
+		if (SPI_finish() != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish failed");
+		SagaStatsCount(SAGA_STATS_FOREIGN_KEY, trigger->tgargs[0], start, 0, 0, false);
+		return;
+	}
+
+	if (has_nulls)
+	{
+		switch (match_type)
+		{
+			case FKCONSTR_MATCH_SIMPLE:
+				if (SPI_finish() != SPI_OK_FINISH)
+					elog(ERROR, "SPI_finish failed");
+				SagaStatsCount(SAGA_STATS_FOREIGN_KEY, trigger->tgargs[0], start, 0, 0, false);
+				return;
+
+			case FKCONSTR_MATCH_PARTIAL:
+				ereport(ERROR,
+						(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						 errmsg("partial not implemented")));
+				break;
+
+			case FKCONSTR_MATCH_FULL:
+				SagaStatsCount(SAGA_STATS_FOREIGN_KEY, trigger->tgargs[0], start, 1, 0, true);
+				ereport(ERROR,
+						(errcode(ERRCODE_FOREIGN_KEY_VIOLATION),
+						 errmsg("foreign key violated (nulls in FULL)")));
+				break;
+		}
+	}
+
+	values[nkeys] = SPI_getbinval(new_row, tupdesc, attnums[nkeys], &isnull);
+	values[nkeys + 1] = SPI_getbinval(new_row, tupdesc, attnums[nkeys + 1], &isnull);
+
+	/* Rows loaded together tend to repeat their keys, see if we did this one */
+	initStringInfo(&flattened);
+	FlattenForeignKeyValues(&flattened, tupdesc, attnums, values, nkeys);
+
+	if (ForeignKeyRangeKnownCovered(trigger->tgargs[0], generation, uk_relid, element_type,
+									&flattened, values[nkeys], values[nkeys + 1]))
+	{
+		if (SPI_finish() != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish failed");
+		SagaStatsCount(SAGA_STATS_FOREIGN_KEY, trigger->tgargs[0], start, 0, 0, false);
+		return;
+	}
+
+	/* We need to lock the referenced rows, so this can't be read only */
+	portal = SPI_cursor_open(NULL, qplan, values, NULL, false);
+	covered = SagaCoveredByCursor(portal, element_type,
+								  values[nkeys], values[nkeys + 1], false);
+	scanned = portal->portalPos;
+	SPI_cursor_close(portal);
+
+	if (covered)
+		RememberForeignKeyCoverage(trigger->tgargs[0], generation, uk_relid, element_type,
+								   &flattened, values[nkeys], values[nkeys + 1]);
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+
+	SagaStatsCount(SAGA_STATS_FOREIGN_KEY, trigger->tgargs[0], start, 1, scanned, !covered);
+
+	if (!covered)
+		ereport(ERROR,
+				(errcode(ERRCODE_FOREIGN_KEY_VIOLATION),
+				 errmsg("insert or update on table \"%s\" violates foreign key constraint \"%s\"",
+						DatumGetCString(DirectFunctionCall1(regclassout, ObjectIdGetDatum(fk_relid))),
+						trigger->tgargs[0])));
+}
+
+/*
+ * Common trigger protocol checks for the foreign key triggers.  Returns the
+ * row to check, or NULL if the row is no longer live and so there is nothing
+ * to check.
+ */
+static HeapTuple
+GetForeignKeyNewRow(FunctionCallInfo fcinfo, const char *funcname, bool for_update)
+{
+	TriggerData	   *trigdata = (TriggerData *) fcinfo->context;
+	HeapTuple		new_row;
+
+	/*
+	 * Make sure this is being called as an AFTER ROW trigger.  Note:
+	 * translatable error strings are shared with ri_triggers.c, so resist the
+	 * temptation to fold the function name into them.
+	 */
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" was not called by trigger manager",
+						funcname)));
+
+	if (!TRIGGER_FIRED_AFTER(trigdata->tg_event) ||
+		!TRIGGER_FIRED_FOR_ROW(trigdata->tg_event))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" must be fired AFTER ROW",
+						funcname)));
+
+	if (for_update)
+	{
+		if (!TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event))
+			ereport(ERROR,
+					(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+					 errmsg("function \"%s\" must be fired for UPDATE",
+							funcname)));
+		new_row = trigdata->tg_newtuple;
+	}
+	else
+	{
+		if (!TRIGGER_FIRED_BY_INSERT(trigdata->tg_event))
+			ereport(ERROR,
+					(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+					 errmsg("function \"%s\" must be fired for INSERT",
+							funcname)));
+		new_row = trigdata->tg_trigtuple;
+	}
+
+	/*
+	 * These triggers are deferrable, so the row might have been deleted or
+	 * updated again by the time we get here.  In that case there is nothing
+	 * to check; whatever replaced it has its own trigger event queued.
+	 */
+#if (PG_VERSION_NUM < 120000)
+	if (!HeapTupleSatisfiesVisibility(new_row, SnapshotSelf,
+			for_update ? trigdata->tg_newtuplebuf : trigdata->tg_trigtuplebuf))
+		return NULL;
+#else
+	if (!table_tuple_satisfies_snapshot(trigdata->tg_relation,
+			for_update ? trigdata->tg_newslot : trigdata->tg_trigslot,
+			SnapshotSelf))
+		return NULL;
+#endif
+
+	return new_row;
+}
+
+/*
+ * Check that the rows referencing the row we were given, which was just
+ * updated or deleted, are still covered by the referenced table, raising an
+ * error if they are not.
+ */
+static void
+CheckForeignKeyOldRow(TriggerData *trigdata, HeapTuple old_row, HeapTuple new_row)
+{
+	Relation	rel = trigdata->tg_relation;
+	TupleDesc	tupdesc = RelationGetDescr(rel);
+	Trigger	   *trigger = trigdata->tg_trigger;
+	const SagaForeignKey *fk;
+	NameData	unique_key_name;
+	SPIPlanPtr	qplan;
+	int16		attnums[INDEX_MAX_KEYS + 2];
+	Datum		values[INDEX_MAX_KEYS + 2];
+	bool		isnull;
+	bool		covered;
+	bool		changed;
+	Oid			fk_relid;
+	Oid			uk_relid;
+	int			nkeys;
+	int			ret;
+	instr_time	start;
+	int			i;
+
+	if (trigger->tgnargs != 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("trigger \"%s\" must be given the foreign key name",
+						trigger->tgname)));
+
+	INSTR_TIME_SET_CURRENT(start);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	fk = SagaLookupForeignKey(trigger->tgargs[0], false);
+	nkeys = fk->nkeys;
+	fk_relid = fk->fk_relid;
+	uk_relid = fk->uk_relid;
+	unique_key_name = fk->unique_key_name;
+	GetForeignKeyAttnums(fk, rel, true, attnums);
+
+	/*
+	 * If the key and the period didn't actually change, nothing that
+	 * referenced the row can have lost its coverage.
+	 */
+	changed = (new_row == NULL);
+	for (i = 0; i < nkeys + 2 && !changed; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, attnums[i] - 1);
+		Datum		old_value;
+		Datum		new_value;
+		bool		new_isnull;
+
+		old_value = SPI_getbinval(old_row, tupdesc, attnums[i], &isnull);
+		new_value = SPI_getbinval(new_row, tupdesc, attnums[i], &new_isnull);
+
+		if (isnull != new_isnull ||
+			(!isnull && !datumIsEqual(old_value, new_value, attr->attbyval, attr->attlen)))
+			changed = true;
+	}
+
+	/*
+	 * If the removed row had nulls in the referenced columns then there was
+	 * no possible referencing row (until we implement PARTIAL) so we can just
+	 * stop here.
+	 */
+	for (i = 0; i < nkeys + 2 && changed; i++)
+	{
+		values[i] = SPI_getbinval(old_row, tupdesc, attnums[i], &isnull);
+		if (isnull)
+			changed = false;
+	}
+
+	if (!changed)
+	{
+		if (SPI_finish() != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish failed");
+		SagaStatsCount(SAGA_STATS_UNIQUE_KEY, NameStr(unique_key_name), start, 0, 0, false);
+		return;
+	}
+
+	/* Whatever we knew to be covered may not be anymore */
+	ResetForeignKeyCoverage();
+
+	qplan = GetForeignKeyPlan(fk, FK_PLAN_OLD_ROW);
+
+	ret = SPI_execute_plan(qplan, values, NULL, true, 1);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	covered = DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+
+	/*
+	 * This checks the referenced side, so it counts for the unique key.  The
+	 * check is a single query, so we don't know how much it read.
+	 */
+	SagaStatsCount(SAGA_STATS_UNIQUE_KEY, NameStr(unique_key_name), start, 1, 0, !covered);
+
+	if (!covered)
+		ereport(ERROR,
+				(errcode(ERRCODE_FOREIGN_KEY_VIOLATION),
+				 errmsg("update or delete on table \"%s\" violates foreign key constraint \"%s\" on table \"%s\"",
+						DatumGetCString(DirectFunctionCall1(regclassout, ObjectIdGetDatum(uk_relid))),
+						trigger->tgargs[0],
+						DatumGetCString(DirectFunctionCall1(regclassout, ObjectIdGetDatum(fk_relid))))));
+}
+
+Datum
+fk_insert_check(PG_FUNCTION_ARGS)
+{
+	HeapTuple	new_row = GetForeignKeyNewRow(fcinfo, "fk_insert_check", false);
+
+	if (new_row != NULL)
+		CheckForeignKeyNewRow((TriggerData *) fcinfo->context, new_row);
+
+	return PointerGetDatum(NULL);
+}
+
+Datum
+fk_update_check(PG_FUNCTION_ARGS)
+{
+	HeapTuple	new_row = GetForeignKeyNewRow(fcinfo, "fk_update_check", true);
+
+	if (new_row != NULL)
+		CheckForeignKeyNewRow((TriggerData *) fcinfo->context, new_row);
+
+	return PointerGetDatum(NULL);
+}
+
+/*
+ * Common trigger protocol checks for the unique key triggers.
+ */
+static void
+CheckUniqueKeyTrigger(FunctionCallInfo fcinfo, const char *funcname, bool for_update)
+{
+	TriggerData	   *trigdata = (TriggerData *) fcinfo->context;
+
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" was not called by trigger manager",
+						funcname)));
+
+	if (!TRIGGER_FIRED_AFTER(trigdata->tg_event) ||
+		!TRIGGER_FIRED_FOR_ROW(trigdata->tg_event))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" must be fired AFTER ROW",
+						funcname)));
+
+	if (for_update ? !TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event)
+				   : !TRIGGER_FIRED_BY_DELETE(trigdata->tg_event))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" must be fired for %s",
+						funcname, for_update ? "UPDATE" : "DELETE")));
+}
+
+Datum
+uk_update_check(PG_FUNCTION_ARGS)
+{
+	TriggerData	   *trigdata = (TriggerData *) fcinfo->context;
+
+	CheckUniqueKeyTrigger(fcinfo, "uk_update_check", true);
+	CheckForeignKeyOldRow(trigdata, trigdata->tg_trigtuple, trigdata->tg_newtuple);
+
+	return PointerGetDatum(NULL);
+}
+
+Datum
+uk_delete_check(PG_FUNCTION_ARGS)
+{
+	TriggerData	   *trigdata = (TriggerData *) fcinfo->context;
+
+	CheckUniqueKeyTrigger(fcinfo, "uk_delete_check", false);
+	CheckForeignKeyOldRow(trigdata, trigdata->tg_trigtuple, NULL);
+
+	return PointerGetDatum(NULL);
+}
+
+/*
+ * Get the query checking a row of a unique key for overlaps, preparing it if
+ * we haven't already.  The caller must already be connected to SPI.
+ *
+ * The plan takes the key values followed by the start and end values of the
+ * row, and returns a single boolean that is true if another row with the same
+ * key overlaps it.  Since the rows of a key never overlap each other, only the
+ * rows just before and just after it by start can, and each of them is found
+ * with one descent of the btree index of the unique constraint.  The row
+ * itself is the only other one with the same key and bounds.
+ */
+static SPIPlanPtr
+GetUniqueKeyOverlapPlan(const SagaUniqueKey *uk)
+{
+	UniqueKeyPlanEntry *ukentry;
+	NameData	key;
+	bool		found;
+	int			ret;
+	int			i;
+	Oid			types[INDEX_MAX_KEYS + 2];
+	const char *table_name;
+	const char *uk_start;
+	const char *uk_end;
+	StringInfo	keys;
+	StringInfo	buf;
+
+	if (!UniqueKeyPlanHash)
+		UniqueKeyPlanHash = CreateUniqueKeyPlanHash();
+
+	/* The key is hashed as a blob, so clear out the padding */
+	memset(&key, 0, sizeof(key));
+	namestrcpy(&key, NameStr(uk->key_name));
+
+	ukentry = (UniqueKeyPlanEntry *) hash_search(
+			UniqueKeyPlanHash,
+			&key,
+			HASH_ENTER,
+			&found);
+
+	if (!found)
+		ukentry->qplan = NULL;
+
+	/* If the unique key changed since we planned, re-plan it */
+	if (ukentry->qplan != NULL && ukentry->generation == uk->generation)
+		return ukentry->qplan;
+
+	if (ukentry->qplan != NULL)
+	{
+		SPI_freeplan(ukentry->qplan);
+		ukentry->qplan = NULL;
+	}
+
+	table_name = quote_qualified_identifier(NameStr(uk->schema_name),
+											NameStr(uk->table_name));
+	uk_start = quote_identifier(NameStr(uk->start_column_name));
+	uk_end = quote_identifier(NameStr(uk->end_column_name));
+
+	keys = makeStringInfo();
+	for (i = 0; i < uk->nkeys; i++)
+		appendStringInfo(keys, "uk.%s = $%d AND ",
+						 quote_identifier(NameStr(uk->column_names[i])),
+						 i + 1);
+
+	buf = makeStringInfo();
+	appendStringInfo(buf,
+		"SELECT coalesce(( "
+		"    SELECT uk.%s FROM %s AS uk "
+		"    WHERE %suk.%s <= $%d AND (uk.%s, uk.%s) <> ($%d, $%d) "
+		"    ORDER BY uk.%s DESC LIMIT 1) > $%d, false) "
+		"    OR coalesce(( "
+		"    SELECT uk.%s FROM %s AS uk "
+		"    WHERE %suk.%s > $%d "
+		"    ORDER BY uk.%s LIMIT 1) < $%d, false)",
+		uk_end, table_name,
+		keys->data, uk_start, uk->nkeys + 1, uk_start, uk_end, uk->nkeys + 1, uk->nkeys + 2,
+		uk_start, uk->nkeys + 1,
+		uk_start, table_name,
+		keys->data, uk_start, uk->nkeys + 1,
+		uk_start, uk->nkeys + 2);
+
+	for (i = 0; i < uk->nkeys; i++)
+		types[i] = uk->types[i];
+	types[uk->nkeys] = uk->element_type;
+	types[uk->nkeys + 1] = uk->element_type;
+
+	ukentry->qplan = SPI_prepare(buf->data, uk->nkeys + 2, types);
+	if (ukentry->qplan == NULL)
+		elog(ERROR, "SPI_prepare returned %s for %s",
+			 SPI_result_code_string(SPI_result), buf->data);
+
+	ret = SPI_keepplan(ukentry->qplan);
+	if (ret != 0)
+		elog(ERROR, "SPI_keepplan returned %s", SPI_result_code_string(ret));
+
+	ukentry->generation = uk->generation;
+
+	return ukentry->qplan;
+}
+
+/*
+ * uk_overlap_check -
+ * Constraint trigger standing in for the EXCLUDE constraint of a unique key,
+ * on partitioned tables and on keys added with btree => true.
+ *
+ * An exclusion constraint would make concurrent writers of the same key wait
+ * for each other, so we do the same with a transaction advisory lock on a
+ * hash of the key values, and then look for overlaps with a fresh snapshot
+ * that sees whatever they committed.
+ */
+Datum
+uk_overlap_check(PG_FUNCTION_ARGS)
+{
+	TriggerData *trigdata = (TriggerData *) fcinfo->context;
+	bool		for_update = CALLED_AS_TRIGGER(fcinfo) &&
+							 TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event);
+	HeapTuple	new_row = GetForeignKeyNewRow(fcinfo, "uk_overlap_check", for_update);
+	Relation	rel;
+	TupleDesc	tupdesc;
+	Trigger	   *trigger;
+	const SagaUniqueKey *uk;
+	SPIPlanPtr	qplan;
+	int16		attnums[INDEX_MAX_KEYS + 2];
+	Datum		values[INDEX_MAX_KEYS + 2];
+	NameData	exclude_constraint;
+	uint32		hashkey = 0;
+	LOCKTAG		tag;
+	bool		isnull;
+	bool		overlaps;
+	Oid			uk_relid;
+	int			nkeys;
+	int			ret;
+	instr_time	start;
+	int			i;
+
+	if (new_row == NULL)
+		return PointerGetDatum(NULL);
+
+	rel = trigdata->tg_relation;
+	tupdesc = RelationGetDescr(rel);
+	trigger = trigdata->tg_trigger;
+
+	if (trigger->tgnargs != 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("trigger \"%s\" must be given the unique key name",
+						trigger->tgname)));
+
+	INSTR_TIME_SET_CURRENT(start);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	/*
+	 * Take what we need from the cache entry now, it can be reloaded under
+	 * us once we start running queries.  The trigger fires on the partitions
+	 * of a partitioned table, whose columns are looked up by name.
+	 */
+	uk = SagaLookupUniqueKey(trigger->tgargs[0], false);
+	nkeys = uk->nkeys;
+	uk_relid = uk->relid;
+	exclude_constraint = uk->exclude_constraint;
+	for (i = 0; i < nkeys + 2; i++)
+	{
+		const char *attname;
+
+		if (i < nkeys)
+			attname = NameStr(uk->column_names[i]);
+		else if (i == nkeys)
+			attname = NameStr(uk->start_column_name);
+		else
+			attname = NameStr(uk->end_column_name);
+
+		if (rel->rd_id != uk_relid)
+			attnums[i] = SPI_fnumber(tupdesc, attname);
+		else if (i < nkeys)
+			attnums[i] = uk->attnums[i];
+		else if (i == nkeys)
+			attnums[i] = uk->start_attnum;
+		else
+			attnums[i] = uk->end_attnum;
+
+		if (attnums[i] == SPI_ERROR_NOATTRIBUTE || attnums[i] < 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_COLUMN),
+					 errmsg("column \"%s\" does not exist", attname)));
+	}
+
+	qplan = GetUniqueKeyOverlapPlan(uk);
+
+	/* As with the = operator of an exclusion constraint, nulls never conflict */
+	for (i = 0; i < nkeys; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, attnums[i] - 1);
+		TypeCacheEntry *typentry;
+		uint32		hashvalue;
+
+		values[i] = SPI_getbinval(new_row, tupdesc, attnums[i], &isnull);
+		if (isnull)
+		{
+			if (SPI_finish() != SPI_OK_FINISH)
+				elog(ERROR, "SPI_finish failed");
+			SagaStatsCount(SAGA_STATS_UNIQUE_KEY, trigger->tgargs[0], start, 0, 0, false);
+			return PointerGetDatum(NULL);
+		}
+
+		typentry = lookup_type_cache(attr->atttypid, TYPECACHE_HASH_PROC_FINFO);
+		if (!OidIsValid(typentry->hash_proc_finfo.fn_oid))
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_FUNCTION),
+					 errmsg("could not identify a hash function for type %s",
+							format_type_be(attr->atttypid))));
+
+		hashvalue = DatumGetUInt32(FunctionCall1Coll(&typentry->hash_proc_finfo,
+													 attr->attcollation,
+													 values[i]));
+		hashkey = ((hashkey << 1) | (hashkey >> 31)) ^ hashvalue;
+	}
+
+	values[nkeys] = SPI_getbinval(new_row, tupdesc, attnums[nkeys], &isnull);
+	values[nkeys + 1] = SPI_getbinval(new_row, tupdesc, attnums[nkeys + 1], &isnull);
+
+	/*
+	 * The advisory locks taken by the SQL functions use 1 and 2 in the last
+	 * field, so ours can't collide with them.
+	 */
+	SET_LOCKTAG_ADVISORY(tag, MyDatabaseId, uk_relid, hashkey, 3);
+	(void) LockAcquire(&tag, ExclusiveLock, false, false);
+
+	ret = SPI_execute_snapshot(qplan, values, NULL,
+							   GetLatestSnapshot(), InvalidSnapshot,
+							   false, false, 1);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	overlaps = DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+
+	/* At most the neighbours on either side are read */
+	SagaStatsCount(SAGA_STATS_UNIQUE_KEY, trigger->tgargs[0], start, 1, 0, overlaps);
+
+	if (overlaps)
+		ereport(ERROR,
+				(errcode(ERRCODE_EXCLUSION_VIOLATION),
+				 errmsg("conflicting key value violates exclusion constraint \"%s\"",
+						NameStr(exclude_constraint)),
+				 errtableconstraint(rel, NameStr(exclude_constraint))));
+
+	return PointerGetDatum(NULL);
+}
+
+/*
+ * Plan caches for the FOR PORTION OF views.  What is needed to split a row is
+ * worked out once per view, and the UPDATE is planned once per set of
+ * columns it changes.
+ */
+static HTAB *PortionOfViewHash = NULL;
+static SPIPlanPtr SetConstraintsDeferredPlan = NULL;
+
+typedef struct PortionOfUpdatePlan
+{
+	Bitmapset  *set_columns;	/* the view columns the UPDATE sets */
+	SPIPlanPtr	qplan;
+} PortionOfUpdatePlan;
+
+typedef struct PortionOfViewEntry
+{
+	Oid			view_relid;		/* the hash key; must be first */
+	bool		valid;
+	uint32		generation;		/* of the cached era we planned for */
+	int			natts;			/* of the view */
+	AttrNumber	start_attnum;	/* in the view */
+	AttrNumber	end_attnum;
+	TypeCacheEntry *typcache;	/* of the start and end columns */
+	bool	   *inserted;		/* is the view column copied into split off rows? */
+	bool	   *matched;		/* is the view column used to find the row to update? */
+	SPIPlanPtr	insert_plan;
+	List	   *update_plans;	/* of PortionOfUpdatePlan */
+} PortionOfViewEntry;
+
+static HTAB *
+CreatePortionOfViewHash(void)
+{
+	HASHCTL	ctl;
+
+	ctl.keysize = sizeof(Oid);
+	ctl.entrysize = sizeof(PortionOfViewEntry);
+
+	return hash_create("Portion Of View Hash", 16, &ctl, HASH_ELEM | HASH_BLOBS);
+}
+
+static void
+ResetPortionOfView(PortionOfViewEntry *entry)
+{
+	ListCell   *lc;
+
+	if (entry->inserted != NULL)
+		pfree(entry->inserted);
+	if (entry->matched != NULL)
+		pfree(entry->matched);
+	if (entry->insert_plan != NULL)
+		SPI_freeplan(entry->insert_plan);
+
+	foreach(lc, entry->update_plans)
+	{
+		PortionOfUpdatePlan *plan = (PortionOfUpdatePlan *) lfirst(lc);
+
+		SPI_freeplan(plan->qplan);
+		bms_free(plan->set_columns);
+		pfree(plan);
+	}
+	list_free(entry->update_plans);
+
+	entry->inserted = NULL;
+	entry->matched = NULL;
+	entry->insert_plan = NULL;
+	entry->update_plans = NIL;
+	entry->valid = false;
+}
+
+/*
+ * Marks the view columns whose names the query returns.
+ */
+static void
+MarkPortionOfViewColumns(const char *sql, Oid table_relid, TupleDesc tupdesc, bool *marks)
+{
+	int			ret;
+	uint64		i;
+	int			j;
+	Oid			types[1] = {OIDOID};
+	Datum		values[1];
+	SPIPlanPtr	qplan;
+
+	qplan = SPI_prepare(sql, 1, types);
+	if (qplan == NULL)
+		elog(ERROR, "SPI_prepare returned %s for %s",
+			 SPI_result_code_string(SPI_result), sql);
+
+	values[0] = ObjectIdGetDatum(table_relid);
+	ret = SPI_execute_plan(qplan, values, NULL, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	for (i = 0; i < SPI_processed; i++)
+	{
+		char	   *attname = SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1);
+
+		for (j = 0; j < tupdesc->natts; j++)
+		{
+			if (strcmp(NameStr(TupleDescAttr(tupdesc, j)->attname), attname) == 0)
+				marks[j] = true;
+		}
+	}
+
+	SPI_freeplan(qplan);
+}
+
+/*
+ * Look up, and if needed work out, what we need to split the rows of a FOR
+ * PORTION OF view.  Must be called while connected to SPI.
+ */
+static PortionOfViewEntry *
+GetPortionOfView(Relation view_rel, const SagaEra *era)
+{
+	Oid			view_relid = RelationGetRelid(view_rel);
+	TupleDesc	tupdesc = RelationGetDescr(view_rel);
+	Oid			table_relid = era->key.relid;
+	uint32		generation = era->generation;
+	PortionOfViewEntry *entry;
+	bool		found;
+	int			i;
+
+	/*
+	 * The rows that are split off leave out the same columns as
+	 * apply_portion_of() does.
+	 */
+	const char *generated_columns_sql =
+		"SELECT u.attname "
+		"FROM unnest(sql_saga._portion_of_excluded_columns($1::regclass)) AS u (attname)";
+
+	/* The row to update is found by the columns of all the constraints */
+	const char *matched_columns_sql =
+		"SELECT a.attname "
+		"FROM pg_catalog.pg_attribute AS a "
+		"JOIN pg_catalog.pg_constraint AS c ON c.conkey @> ARRAY[a.attnum] "
+		"WHERE a.attrelid = $1 "
+		"  AND c.conrelid = $1";
+
+	if (!PortionOfViewHash)
+		PortionOfViewHash = CreatePortionOfViewHash();
+
+	entry = (PortionOfViewEntry *) hash_search(
+			PortionOfViewHash,
+			&view_relid,
+			HASH_ENTER,
+			&found);
+
+	if (!found)
+	{
+		entry->valid = false;
+		entry->inserted = NULL;
+		entry->matched = NULL;
+		entry->insert_plan = NULL;
+		entry->update_plans = NIL;
+	}
+
+	/* If the table or the view changed since we looked, look again */
+	if (entry->valid && entry->generation == generation &&
+		entry->natts == tupdesc->natts)
+		return entry;
+
+	ResetPortionOfView(entry);
+
+	entry->natts = tupdesc->natts;
+	entry->start_attnum = SPI_fnumber(tupdesc, NameStr(era->start_column_name));
+	entry->end_attnum = SPI_fnumber(tupdesc, NameStr(era->end_column_name));
+	if (entry->start_attnum <= 0 || entry->end_attnum <= 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("view \"%s\" does not have the columns of era \"%s\"",
+						RelationGetRelationName(view_rel), NameStr(era->key.era_name))));
+
+	entry->typcache = lookup_type_cache(era->element_type, TYPECACHE_CMP_PROC_FINFO);
+	if (!OidIsValid(entry->typcache->cmp_proc_finfo.fn_oid))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_FUNCTION),
+				 errmsg("could not identify a comparison function for type %s",
+						format_type_be(era->element_type))));
+
+	entry->inserted = MemoryContextAllocZero(TopMemoryContext, tupdesc->natts * sizeof(bool));
+	entry->matched = MemoryContextAllocZero(TopMemoryContext, tupdesc->natts * sizeof(bool));
+
+	/* Mark the generated columns, then flip that to what gets inserted */
+	MarkPortionOfViewColumns(generated_columns_sql, table_relid, tupdesc, entry->inserted);
+	for (i = 0; i < tupdesc->natts; i++)
+		entry->inserted[i] = !entry->inserted[i];
+
+	/*
+	 * The era always goes in, even when a partitioned table needs the start
+	 * column in its primary key.
+	 */
+	entry->inserted[entry->start_attnum - 1] = true;
+	entry->inserted[entry->end_attnum - 1] = true;
+	MarkPortionOfViewColumns(matched_columns_sql, table_relid, tupdesc, entry->matched);
+
+	/* The rows that are split off go in with a single prepared INSERT */
+	{
+		StringInfo	buf = makeStringInfo();
+		StringInfo	params = makeStringInfo();
+		Oid		   *types = palloc(tupdesc->natts * sizeof(Oid));
+		int			nparams = 0;
+		int			ret;
+
+		appendStringInfo(buf, "INSERT INTO %s (",
+						 quote_qualified_identifier(get_namespace_name(get_rel_namespace(table_relid)),
+													get_rel_name(table_relid)));
+		for (i = 0; i < tupdesc->natts; i++)
+		{
+			if (!entry->inserted[i])
+				continue;
+
+			types[nparams++] = TupleDescAttr(tupdesc, i)->atttypid;
+			appendStringInfo(buf, "%s%s", nparams > 1 ? ", " : "",
+							 quote_identifier(NameStr(TupleDescAttr(tupdesc, i)->attname)));
+			appendStringInfo(params, "%s$%d", nparams > 1 ? ", " : "", nparams);
+		}
+		appendStringInfo(buf, ") VALUES (%s)", params->data);
+
+		entry->insert_plan = SPI_prepare(buf->data, nparams, types);
+		if (entry->insert_plan == NULL)
+			elog(ERROR, "SPI_prepare returned %s for %s",
+				 SPI_result_code_string(SPI_result), buf->data);
+
+		ret = SPI_keepplan(entry->insert_plan);
+		if (ret != 0)
+			elog(ERROR, "SPI_keepplan returned %s", SPI_result_code_string(ret));
+	}
+
+	entry->generation = generation;
+	entry->valid = true;
+
+	return entry;
+}
+
+/*
+ * Get the plan to UPDATE the given view columns of the row matching the old
+ * row's constraint columns, where it overlaps the given portion.  The
+ * parameters are the new values of the columns set, then the old values of
+ * the matched columns, then the start and the end of the portion.
+ */
+static SPIPlanPtr
+GetPortionOfUpdatePlan(PortionOfViewEntry *entry, TupleDesc tupdesc, Oid table_relid,
+					   Bitmapset *set_columns)
+{
+	PortionOfUpdatePlan *plan;
+	MemoryContext oldcontext;
+	SPIPlanPtr	qplan;
+	ListCell   *lc;
+	StringInfo	buf;
+	Oid		   *types;
+	int			nparams = 0;
+	int			ret;
+	int			i;
+
+	foreach(lc, entry->update_plans)
+	{
+		plan = (PortionOfUpdatePlan *) lfirst(lc);
+		if (bms_equal(plan->set_columns, set_columns))
+			return plan->qplan;
+	}
+
+	buf = makeStringInfo();
+	types = palloc((2 * tupdesc->natts + 2) * sizeof(Oid));
+
+	appendStringInfo(buf, "UPDATE %s SET ",
+					 quote_qualified_identifier(get_namespace_name(get_rel_namespace(table_relid)),
+												get_rel_name(table_relid)));
+	i = -1;
+	while ((i = bms_next_member(set_columns, i)) >= 0)
+	{
+		types[nparams++] = TupleDescAttr(tupdesc, i)->atttypid;
+		appendStringInfo(buf, "%s%s = $%d", nparams > 1 ? ", " : "",
+						 quote_identifier(NameStr(TupleDescAttr(tupdesc, i)->attname)),
+						 nparams);
+	}
+
+	appendStringInfoString(buf, " WHERE ");
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		if (!entry->matched[i])
+			continue;
+
+		types[nparams++] = TupleDescAttr(tupdesc, i)->atttypid;
+		appendStringInfo(buf, "%s = $%d AND ",
+						 quote_identifier(NameStr(TupleDescAttr(tupdesc, i)->attname)),
+						 nparams);
+	}
+
+	types[nparams] = TupleDescAttr(tupdesc, entry->start_attnum - 1)->atttypid;
+	types[nparams + 1] = TupleDescAttr(tupdesc, entry->end_attnum - 1)->atttypid;
+	appendStringInfo(buf, "%s > $%d AND %s < $%d",
+					 quote_identifier(NameStr(TupleDescAttr(tupdesc, entry->end_attnum - 1)->attname)),
+					 nparams + 1,
+					 quote_identifier(NameStr(TupleDescAttr(tupdesc, entry->start_attnum - 1)->attname)),
+					 nparams + 2);
+	nparams += 2;
+
+	qplan = SPI_prepare(buf->data, nparams, types);
+	if (qplan == NULL)
+		elog(ERROR, "SPI_prepare returned %s for %s",
+			 SPI_result_code_string(SPI_result), buf->data);
+
+	ret = SPI_keepplan(qplan);
+	if (ret != 0)
+		elog(ERROR, "SPI_keepplan returned %s", SPI_result_code_string(ret));
+
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+	plan = palloc(sizeof(PortionOfUpdatePlan));
+	plan->set_columns = bms_copy(set_columns);
+	plan->qplan = qplan;
+	entry->update_plans = lappend(entry->update_plans, plan);
+	MemoryContextSwitchTo(oldcontext);
+
+	return qplan;
+}
+
+/*
+ * Insert a row split off the old row, with the period given, leaving out
+ * the generated columns.
+ */
+static void
+InsertPortionOfRow(PortionOfViewEntry *entry, Datum *values, bool *nulls,
+				   Datum start, Datum end)
+{
+	Datum	   *params = palloc(entry->natts * sizeof(Datum));
+	char	   *params_nulls = palloc(entry->natts * sizeof(char));
+	int			nparams = 0;
+	int			ret;
+	int			i;
+
+	for (i = 0; i < entry->natts; i++)
+	{
+		if (!entry->inserted[i])
+			continue;
+
+		if (i == entry->start_attnum - 1)
+		{
+			params[nparams] = start;
+			params_nulls[nparams] = ' ';
+		}
+		else if (i == entry->end_attnum - 1)
+		{
+			params[nparams] = end;
+			params_nulls[nparams] = ' ';
+		}
+		else
+		{
+			params[nparams] = values[i];
+			params_nulls[nparams] = nulls[i] ? 'n' : ' ';
+		}
+		nparams++;
+	}
+
+	ret = SPI_execute_plan(entry->insert_plan, params, params_nulls, false, 0);
+	if (ret != SPI_OK_INSERT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+}
+
+static int
+ComparePortionOfBounds(PortionOfViewEntry *entry, Datum a, Datum b)
+{
+	return DatumGetInt32(FunctionCall2Coll(&entry->typcache->cmp_proc_finfo,
+										   entry->typcache->typcollation,
+										   a, b));
+}
+
+/*
+ * update_portion_of -
+ * INSTEAD OF UPDATE trigger on the FOR PORTION OF views.  The start and end
+ * columns of the new row give the portion of the old row to update; the
+ * parts of the old row before and after that portion are split off into new
+ * rows.
+ *
+ * REFERENCES:
+ *     SQL:2016 15.13 GR 10
+ */
+Datum
+update_portion_of(PG_FUNCTION_ARGS)
+{
+	TriggerData	   *trigdata = (TriggerData *) fcinfo->context;
+	Relation		view_rel;
+	TupleDesc		tupdesc;
+	const SagaEra  *era;
+	PortionOfViewEntry *entry;
+	SPIPlanPtr		qplan;
+	Oid				table_relid;
+	Datum		   *old_values;
+	bool		   *old_nulls;
+	Datum		   *new_values;
+	bool		   *new_nulls;
+	Datum		   *params;
+	char		   *params_nulls;
+	Bitmapset	   *set_columns = NULL;
+	Datum			bstartval, bendval, fromval, toval;
+	bool			fromnull, tonull;
+	bool			changed = false;
+	bool			pre_assigned = false;
+	bool			post_assigned = false;
+	int				start_index, end_index;
+	int				nparams = 0;
+	int				natts;
+	int				ret;
+	int				i;
+
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" was not called by trigger manager",
+						"update_portion_of")));
+
+	if (!TRIGGER_FIRED_INSTEAD(trigdata->tg_event) ||
+		!TRIGGER_FIRED_FOR_ROW(trigdata->tg_event) ||
+		!TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" must be fired INSTEAD OF UPDATE FOR EACH ROW",
+						"update_portion_of")));
+
+	view_rel = trigdata->tg_relation;
+	tupdesc = RelationGetDescr(view_rel);
+	natts = tupdesc->natts;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	/* Get the table information from this view */
+	era = SagaLookupApiView(RelationGetRelid(view_rel), false);
+	table_relid = era->key.relid;
+	entry = GetPortionOfView(view_rel, era);
+	start_index = entry->start_attnum - 1;
+	end_index = entry->end_attnum - 1;
+
+	old_values = palloc(natts * sizeof(Datum));
+	old_nulls = palloc(natts * sizeof(bool));
+	new_values = palloc(natts * sizeof(Datum));
+	new_nulls = palloc(natts * sizeof(bool));
+	heap_deform_tuple(trigdata->tg_trigtuple, tupdesc, old_values, old_nulls);
+	heap_deform_tuple(trigdata->tg_newtuple, tupdesc, new_values, new_nulls);
+
+	/* Find what the update changes besides the period */
+	for (i = 0; i < natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+
+		if (i == start_index || i == end_index)
+			continue;
+
+		if (old_nulls[i] != new_nulls[i] ||
+			(!old_nulls[i] &&
+			 !datumIsEqual(old_values[i], new_values[i], attr->attbyval, attr->attlen)))
+		{
+			set_columns = bms_add_member(set_columns, i);
+			changed = true;
+		}
+	}
+
+	/* If the period is the only thing changed, do nothing */
+	if (!changed)
+	{
+		if (SPI_finish() != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish failed");
+		return PointerGetDatum(NULL);
+	}
+
+	bstartval = old_values[start_index];
+	bendval = old_values[end_index];
+	fromval = new_values[start_index];
+	fromnull = new_nulls[start_index];
+	toval = new_values[end_index];
+	tonull = new_nulls[end_index];
+
+	if (!old_nulls[start_index] && !old_nulls[end_index])
+	{
+		if (!fromnull &&
+			ComparePortionOfBounds(entry, bstartval, fromval) < 0 &&
+			ComparePortionOfBounds(entry, fromval, bendval) < 0)
+		{
+			pre_assigned = true;
+			set_columns = bms_add_member(set_columns, start_index);
+		}
+
+		if (!tonull &&
+			ComparePortionOfBounds(entry, bstartval, toval) < 0 &&
+			ComparePortionOfBounds(entry, toval, bendval) < 0)
+		{
+			post_assigned = true;
+			set_columns = bms_add_member(set_columns, end_index);
+		}
+	}
+
+	if (pre_assigned || post_assigned)
+	{
+		/* Don't validate foreign keys until all this is done */
+		if (SetConstraintsDeferredPlan == NULL)
+		{
+			SetConstraintsDeferredPlan = SPI_prepare("SET CONSTRAINTS ALL DEFERRED", 0, NULL);
+			if (SetConstraintsDeferredPlan == NULL)
+				elog(ERROR, "SPI_prepare returned %s",
+					 SPI_result_code_string(SPI_result));
+
+			ret = SPI_keepplan(SetConstraintsDeferredPlan);
+			if (ret != 0)
+				elog(ERROR, "SPI_keepplan returned %s", SPI_result_code_string(ret));
+		}
+
+		ret = SPI_execute_plan(SetConstraintsDeferredPlan, NULL, NULL, false, 0);
+		if (ret != SPI_OK_UTILITY)
+			elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+	}
+
+	/*
+	 * The leftovers go in before the update, so that checks run at the end of
+	 * the update (batch foreign keys are not deferred) still find the
+	 * portions the update doesn't change.  They don't overlap the portion, so
+	 * the update doesn't see them.
+	 */
+	if (pre_assigned)
+		InsertPortionOfRow(entry, old_values, old_nulls, bstartval, fromval);
+	if (post_assigned)
+		InsertPortionOfRow(entry, old_values, old_nulls, toval, bendval);
+
+	qplan = GetPortionOfUpdatePlan(entry, tupdesc, table_relid, set_columns);
+
+	params = palloc((2 * natts + 2) * sizeof(Datum));
+	params_nulls = palloc((2 * natts + 2) * sizeof(char));
+
+	i = -1;
+	while ((i = bms_next_member(set_columns, i)) >= 0)
+	{
+		params[nparams] = new_values[i];
+		params_nulls[nparams] = new_nulls[i] ? 'n' : ' ';
+		nparams++;
+	}
+	for (i = 0; i < natts; i++)
+	{
+		if (!entry->matched[i])
+			continue;
+
+		params[nparams] = old_values[i];
+		params_nulls[nparams] = old_nulls[i] ? 'n' : ' ';
+		nparams++;
+	}
+	params[nparams] = fromval;
+	params_nulls[nparams] = fromnull ? 'n' : ' ';
+	params[nparams + 1] = toval;
+	params_nulls[nparams + 1] = tonull ? 'n' : ' ';
+
+	ret = SPI_execute_plan(qplan, params, params_nulls, false, 0);
+	if (ret != SPI_OK_UPDATE)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+
+	return PointerGetDatum(trigdata->tg_newtuple);
+}
@@ -0,0 +1,348 @@
+/**
+ * predicates.c -
+ * Planner support for the sql_saga.contains() and sql_saga.overlaps()
+ * predicates.
+ *
+ * The predicates are SQL functions that inline to comparisons of the start
+ * and end columns, which a btree index on either column can only half use.
+ * When the columns are those of an era that a GiST or SP-GiST index covers
+ * with a range, as the exclusion constraint of a unique key does, the call is
+ * rewritten to the range operator on that index expression instead, so the
+ * index can be used and the range statistics give the estimate.
+ */
+
+#include <postgres.h>
+#include <fmgr.h>
+
+#if (PG_VERSION_NUM >= 120000)
+#include <access/genam.h>
+#include <access/table.h>
+#include <catalog/pg_am.h>
+#include <catalog/pg_operator.h>
+#include <catalog/pg_type.h>
+#include <nodes/makefuncs.h>
+#include <nodes/supportnodes.h>
+#include <optimizer/optimizer.h>
+#include <parser/parsetree.h>
+#include <utils/builtins.h>
+#include <utils/lsyscache.h>
+#include <utils/rel.h>
+#include <utils/relcache.h>
+#include <utils/typcache.h>
+#endif
+
+#include "sql_saga.h"
+
+PGDLLEXPORT Datum predicate_support(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(predicate_support);
+
+#if (PG_VERSION_NUM >= 120000)
+
+/*
+ * Both columns must be plain columns of one table of this query.
+ */
+static bool
+IsEraColumnPair(Node *start, Node *end)
+{
+	Var		   *s;
+	Var		   *e;
+
+	if (!IsA(start, Var) || !IsA(end, Var))
+		return false;
+
+	s = (Var *) start;
+	e = (Var *) end;
+	return s->varno == e->varno &&
+		s->varlevelsup == 0 && e->varlevelsup == 0 &&
+		s->varattno > 0 && e->varattno > 0 &&
+		s->vartype == e->vartype;
+}
+
+static bool
+IsNotNullConst(Node *node)
+{
+	return IsA(node, Const) && !((Const *) node)->constisnull;
+}
+
+/*
+ * Does the table check that the start is before the end, like the bounds
+ * check constraint of an era?  Without that a row with start = end would be
+ * an empty range, which overlaps nothing.
+ */
+static bool
+HasBoundsCheck(Relation rel, AttrNumber start_attnum, AttrNumber end_attnum, Oid type)
+{
+	TupleConstr *constr = rel->rd_att->constr;
+	TypeCacheEntry *typcache;
+	int			i;
+
+	if (constr == NULL)
+		return false;
+
+	typcache = lookup_type_cache(type, TYPECACHE_LT_OPR);
+
+	for (i = 0; i < constr->num_check; i++)
+	{
+		Node	   *expr;
+		OpExpr	   *op;
+		Var		   *s;
+		Var		   *e;
+
+		if (!constr->check[i].ccvalid)
+			continue;
+
+		expr = stringToNode(constr->check[i].ccbin);
+		if (!IsA(expr, OpExpr))
+			continue;
+
+		op = (OpExpr *) expr;
+		if (op->opno != typcache->lt_opr || list_length(op->args) != 2 ||
+			!IsA(linitial(op->args), Var) || !IsA(lsecond(op->args), Var))
+			continue;
+
+		s = (Var *) linitial(op->args);
+		e = (Var *) lsecond(op->args);
+		if (s->varattno == start_attnum && e->varattno == end_attnum)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Is this index expression the range of the two columns, as in the exclusion
+ * constraint of a unique key: range_type(start, end[, '[)'])?
+ */
+static bool
+IsEraRange(Node *node, AttrNumber start_attnum, AttrNumber end_attnum, Oid type)
+{
+	FuncExpr   *func;
+	Node	   *bounds;
+
+	if (!IsA(node, FuncExpr))
+		return false;
+
+	func = (FuncExpr *) node;
+	if (!type_is_range(func->funcresulttype) ||
+		get_range_subtype(func->funcresulttype) != type)
+		return false;
+
+	if (list_length(func->args) != 2 && list_length(func->args) != 3)
+		return false;
+
+	if (!IsA(linitial(func->args), Var) || ((Var *) linitial(func->args))->varattno != start_attnum ||
+		!IsA(lsecond(func->args), Var) || ((Var *) lsecond(func->args))->varattno != end_attnum)
+		return false;
+
+	if (list_length(func->args) == 2)
+		return true;
+
+	bounds = lthird(func->args);
+	return IsNotNullConst(bounds) &&
+		((Const *) bounds)->consttype == TEXTOID &&
+		strcmp(TextDatumGetCString(((Const *) bounds)->constvalue), "[)") == 0;
+}
+
+/*
+ * Returns the range expression of the columns from a GiST or SP-GiST index of
+ * the table, if the table also keeps the columns not null and in order.
+ */
+static FuncExpr *
+FindEraRange(Relation rel, AttrNumber start_attnum, AttrNumber end_attnum, Oid type)
+{
+	FuncExpr   *result = NULL;
+	List	   *indexes;
+	ListCell   *lc;
+
+	if (!TupleDescAttr(rel->rd_att, start_attnum - 1)->attnotnull ||
+		!TupleDescAttr(rel->rd_att, end_attnum - 1)->attnotnull ||
+		!HasBoundsCheck(rel, start_attnum, end_attnum, type))
+		return NULL;
+
+	indexes = RelationGetIndexList(rel);
+	foreach(lc, indexes)
+	{
+		Relation	index = index_open(lfirst_oid(lc), AccessShareLock);
+		List	   *exprs;
+		ListCell   *elc;
+
+		if ((index->rd_rel->relam == GIST_AM_OID || index->rd_rel->relam == SPGIST_AM_OID) &&
+			index->rd_index->indisvalid)
+		{
+			exprs = RelationGetIndexExpressions(index);
+			foreach(elc, exprs)
+			{
+				if (IsEraRange(lfirst(elc), start_attnum, end_attnum, type))
+				{
+					result = (FuncExpr *) lfirst(elc);
+					break;
+				}
+			}
+		}
+
+		/* Keep the lock, as the planner does */
+		index_close(index, NoLock);
+
+		if (result != NULL)
+			break;
+	}
+	list_free(indexes);
+
+	return result;
+}
+
+/*
+ * The same range constructor, over other arguments.
+ */
+static FuncExpr *
+MakeRange(FuncExpr *range, Node *start, Node *end)
+{
+	FuncExpr   *result = (FuncExpr *) copyObject(range);
+
+	if (list_length(range->args) == 3)
+		result->args = list_make3(start, end, lthird(result->args));
+	else
+		result->args = list_make2(start, end);
+	result->location = -1;
+
+	return result;
+}
+
+/*
+ * Compared like the range constructor will, with the range's collation.
+ */
+static bool
+ConstsInOrder(FuncExpr *range, Const *start, Const *end)
+{
+	TypeCacheEntry *typcache = lookup_type_cache(range->funcresulttype, TYPECACHE_RANGE_INFO);
+
+	return DatumGetInt32(FunctionCall2Coll(&typcache->rng_cmp_proc_finfo,
+										   typcache->rng_collation,
+										   start->constvalue,
+										   end->constvalue)) < 0;
+}
+
+/*
+ * contains(s, e, value)            => range(s, e) @> value
+ * contains(s, e, start, end)       => range(s, e) @> range(start, end)
+ * overlaps(s, e, start, end)       => range(s, e) && range(start, end)
+ * overlaps(start, end, s, e)       => range(s, e) && range(start, end)
+ *
+ * Only when the other side is constant, and for two values only when they
+ * are in order: an empty range would not give the same answer.
+ */
+static Node *
+SimplifyPredicate(SupportRequestSimplify *req)
+{
+	FuncExpr   *fcall = req->fcall;
+	char	   *name = get_func_name(fcall->funcid);
+	List	   *args = fcall->args;
+	Node	   *start;
+	Node	   *end;
+	List	   *others;
+	Oid			opno;
+	Var		   *s;
+	RangeTblEntry *rte;
+	Relation	rel;
+	FuncExpr   *range;
+	Node	   *left;
+	Node	   *right;
+	Expr	   *result;
+
+	if (req->root == NULL || name == NULL)
+		return NULL;
+
+	if (strcmp(name, "contains") == 0 && list_length(args) == 3)
+	{
+		start = linitial(args);
+		end = lsecond(args);
+		others = list_make1(lthird(args));
+		opno = OID_RANGE_CONTAINS_ELEM_OP;
+	}
+	else if (strcmp(name, "contains") == 0 && list_length(args) == 4)
+	{
+		start = linitial(args);
+		end = lsecond(args);
+		others = list_make2(lthird(args), lfourth(args));
+		opno = OID_RANGE_CONTAINS_OP;
+	}
+	else if (strcmp(name, "overlaps") == 0 && list_length(args) == 4)
+	{
+		if (IsEraColumnPair(linitial(args), lsecond(args)))
+		{
+			start = linitial(args);
+			end = lsecond(args);
+			others = list_make2(lthird(args), lfourth(args));
+		}
+		else
+		{
+			start = lthird(args);
+			end = lfourth(args);
+			others = list_make2(linitial(args), lsecond(args));
+		}
+		opno = OID_RANGE_OVERLAP_OP;
+	}
+	else
+		return NULL;
+
+	if (!IsEraColumnPair(start, end))
+		return NULL;
+
+	if (!IsNotNullConst(linitial(others)) ||
+		(list_length(others) == 2 && !IsNotNullConst(lsecond(others))))
+		return NULL;
+
+	s = (Var *) start;
+	if (s->varno > list_length(req->root->parse->rtable))
+		return NULL;
+	rte = rt_fetch(s->varno, req->root->parse->rtable);
+	if (rte->rtekind != RTE_RELATION)
+		return NULL;
+
+	/* The query already holds a lock on the table */
+	rel = table_open(rte->relid, NoLock);
+	range = FindEraRange(rel, s->varattno, ((Var *) end)->varattno, s->vartype);
+	table_close(rel, NoLock);
+
+	if (range == NULL)
+		return NULL;
+
+	if (list_length(others) == 2 &&
+		!ConstsInOrder(range, (Const *) linitial(others), (Const *) lsecond(others)))
+		return NULL;
+
+	left = (Node *) MakeRange(range, copyObject(start), copyObject(end));
+	if (list_length(others) == 1)
+		right = linitial(others);
+	else
+		right = (Node *) MakeRange(range, linitial(others), lsecond(others));
+
+	result = make_opclause(opno, BOOLOID, false,
+						   (Expr *) left, (Expr *) right,
+						   InvalidOid, InvalidOid);
+	((OpExpr *) result)->opfuncid = get_opcode(opno);
+
+	/* Fold the constant range */
+	return eval_const_expressions(req->root, (Node *) result);
+}
+
+#endif							/* PG_VERSION_NUM >= 120000 */
+
+/*
+ * predicate_support -
+ * The planner support function of the predicates.  Returning NULL leaves
+ * the call to be inlined like any SQL function.
+ */
+Datum
+predicate_support(PG_FUNCTION_ARGS)
+{
+#if (PG_VERSION_NUM >= 120000)
+	Node	   *rawreq = (Node *) PG_GETARG_POINTER(0);
+
+	if (IsA(rawreq, SupportRequestSimplify))
+		PG_RETURN_POINTER(SimplifyPredicate((SupportRequestSimplify *) rawreq));
+#endif
+
+	PG_RETURN_POINTER(NULL);
+}
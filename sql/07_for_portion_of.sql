@@ -86,3 +86,41 @@ TABLE bt ORDER BY s, e;
 
 SELECT sql_saga.drop_api('bt', 'p');
 DROP TABLE bt;
+
+/* Batch foreign keys must find every portion of a split row */
+CREATE TABLE shops (
+    id serial PRIMARY KEY,
+    shop integer,
+    name text,
+    s integer,
+    e integer
+);
+SELECT sql_saga.add_era('shops', 's', 'e', 'p');
+SELECT sql_saga.add_unique_key('shops', ARRAY['shop'], 'p');
+SELECT sql_saga.add_api('shops', 'p');
+CREATE TABLE stalls (
+    id integer,
+    shop integer,
+    s integer,
+    e integer
+);
+SELECT sql_saga.add_era('stalls', 's', 'e', 'p');
+SELECT sql_saga.add_foreign_key('stalls', ARRAY['shop'], 'p', 'shops_shop_p', batch => true);
+
+INSERT INTO shops (shop, name, s, e) VALUES (1, 'corner', 10, 40);
+INSERT INTO stalls VALUES (1, 1, 10, 40);
+UPDATE shops__for_portion_of_p SET name = 'market', s = 20, e = 30;
+TABLE shops ORDER BY s, e;
+
+-- The view's plans are made again once the table changes
+ALTER TABLE shops ADD CONSTRAINT shops_name_check CHECK (name <> '');
+UPDATE shops__for_portion_of_p SET name = 'bazaar', s = 22, e = 28;
+TABLE shops ORDER BY s, e;
+
+SELECT sql_saga.drop_foreign_key('stalls', 'stalls_shop_p');
+SELECT sql_saga.drop_era('stalls', 'p');
+DROP TABLE stalls;
+SELECT sql_saga.drop_api('shops', 'p');
+SELECT sql_saga.drop_unique_key('shops', 'shops_shop_p');
+SELECT sql_saga.drop_era('shops', 'p');
+DROP TABLE shops;
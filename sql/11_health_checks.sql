@@ -8,3 +8,41 @@ ALTER TABLE log SET LOGGED;
 SELECT sql_saga.add_era('log', 's', 'e', 'p'); -- passes
 ALTER TABLE log SET UNLOGGED; -- fails
 DROP TABLE log;
+
+/* The checks only run for commands that could have touched something of ours */
+RESET ROLE;
+CREATE SCHEMA stands;
+CREATE TABLE stands.kiosks (id integer, s date, e date);
+SELECT sql_saga.add_era('stands.kiosks', 's', 'e');
+SELECT sql_saga.add_unique_key('stands.kiosks', ARRAY['id']);
+SELECT sql_saga.add_current_view('stands.kiosks');
+CREATE TABLE stands.rents (id integer, s integer, e integer) PARTITION BY RANGE (s);
+SELECT sql_saga.add_era('stands.rents', 's', 'e');
+
+-- The index of a current view is found by the drop protection
+DROP INDEX stands.kiosks_valid_current_idx; -- fails
+
+BEGIN;
+SET LOCAL track_functions = 'all';
+-- Unrelated tables are skipped
+CREATE TABLE stands.staging (id integer);
+DROP TABLE stands.staging;
+SELECT coalesce(pg_stat_get_xact_function_calls('sql_saga.health_checks'::regproc), 0) AS health_checks,
+       coalesce(pg_stat_get_xact_function_calls('sql_saga.drop_protection'::regproc), 0) AS drop_protection;
+-- A grant on a whole schema is checked
+GRANT SELECT ON ALL TABLES IN SCHEMA stands TO PUBLIC;
+SELECT coalesce(pg_stat_get_xact_function_calls('sql_saga.health_checks'::regproc), 0) AS health_checks,
+       coalesce(pg_stat_get_xact_function_calls('sql_saga.drop_protection'::regproc), 0) AS drop_protection;
+-- So is a new partition of one of our tables
+CREATE TABLE stands.rents_all PARTITION OF stands.rents FOR VALUES FROM (MINVALUE) TO (MAXVALUE);
+SELECT coalesce(pg_stat_get_xact_function_calls('sql_saga.health_checks'::regproc), 0) AS health_checks,
+       coalesce(pg_stat_get_xact_function_calls('sql_saga.drop_protection'::regproc), 0) AS drop_protection;
+COMMIT;
+
+SELECT sql_saga.drop_era('stands.rents');
+DROP TABLE stands.rents;
+SELECT sql_saga.drop_current_view('stands.kiosks');
+SELECT sql_saga.drop_unique_key('stands.kiosks', 'kiosks_id_valid');
+SELECT sql_saga.drop_era('stands.kiosks');
+DROP TABLE stands.kiosks;
+DROP SCHEMA stands;
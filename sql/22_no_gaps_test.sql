@@ -126,13 +126,26 @@ SELECT  sql_saga.no_gaps(tstzrange(valid_from,valid_to), null)
 FROM    shifts
 WHERE   job_id = 1;
 
--- Errors:
+-- Unsorted input:
 
--- it fails if the input ranges go backwards:
+-- it does not need the input ranges to be sorted:
 SELECT  sql_saga.no_gaps(tstzrange(valid_from,valid_to), tstzrange('2017-11-27 13:00:00', '2017-11-27 20:00:00') ORDER BY worker_id DESC)
 FROM    shifts
 WHERE   job_id = 1;
 
+-- it can combine the ranges seen by parallel workers:
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+SET max_parallel_workers_per_gather = 2;
+SELECT  sql_saga.no_gaps(tstzrange(valid_from,valid_to), tstzrange('2017-11-27 06:00:00', '2017-11-27 17:00:00'))
+FROM    shifts
+WHERE   job_id = 1;
+RESET parallel_setup_cost;
+RESET parallel_tuple_cost;
+RESET min_parallel_table_scan_size;
+RESET max_parallel_workers_per_gather;
+
 -- TODO: handle an empty target range? e.g. [5, 5)
 -- Or maybe since that is a self-contradiction maybe ignore that case?
 
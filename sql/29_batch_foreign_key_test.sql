@@ -0,0 +1,63 @@
+-- Foreign keys added with batch => true are checked once per statement
+DELETE FROM rooms;
+DELETE FROM houses;
+
+SELECT sql_saga.add_era('houses', 'valid_from', 'valid_to', 'valid');
+SELECT sql_saga.add_unique_key('houses', ARRAY['id'], 'valid');
+SELECT sql_saga.add_era('rooms', 'valid_from', 'valid_to');
+
+-- Batch mode does not support MATCH PARTIAL
+SELECT sql_saga.add_foreign_key('rooms', ARRAY['house_id'], 'valid', 'houses_id_valid', match_type => 'PARTIAL', batch => true);
+
+SELECT sql_saga.add_foreign_key('rooms', ARRAY['house_id'], 'valid', 'houses_id_valid', batch => true);
+
+SELECT tgname, tgconstraint <> 0 AS is_constraint, tgoldtable, tgnewtable
+FROM pg_catalog.pg_trigger
+WHERE tgrelid = 'rooms'::regclass
+ORDER BY tgname;
+
+INSERT INTO houses VALUES
+  (1, 150000, '2015-01-01', '2016-01-01'),
+  (1, 200000, '2016-01-01', '2017-01-01'),
+  (2, 300000, '2015-01-01', '2016-01-01')
+;
+
+-- You can insert many covered rows at once, including a NULL fk
+INSERT INTO rooms VALUES
+  (1, 1, '2015-01-01', '2017-01-01'),
+  (2, 1, '2015-06-01', '2016-06-01'),
+  (3, 2, '2015-01-01', '2016-01-01'),
+  (4, NULL, '2010-01-01', '2011-01-01')
+;
+
+-- You can't insert a set with one row not covered
+INSERT INTO rooms VALUES
+  (5, 1, '2015-01-01', '2016-01-01'),
+  (6, 2, '2015-01-01', '2017-01-01')
+;
+
+-- You can't insert a row with a missing key
+INSERT INTO rooms VALUES (7, 7, '2015-01-01', '2016-01-01');
+
+-- You can update rows as long as they stay covered
+UPDATE rooms SET valid_to = '2016-06-01' WHERE house_id = 1;
+
+-- You can't update a row out of what is covered
+UPDATE rooms SET valid_to = '2018-01-01' WHERE id = 1;
+
+SELECT id, house_id FROM rooms ORDER BY id;
+
+-- Existing rows are checked when the foreign key is added
+SELECT sql_saga.drop_foreign_key('rooms', 'rooms_house_id_valid');
+INSERT INTO rooms VALUES (8, 2, '2016-01-01', '2017-01-01');
+SELECT sql_saga.add_foreign_key('rooms', ARRAY['house_id'], 'valid', 'houses_id_valid', batch => true);
+DELETE FROM rooms WHERE id = 8;
+SELECT sql_saga.add_foreign_key('rooms', ARRAY['house_id'], 'valid', 'houses_id_valid', batch => true);
+
+-- Clean up
+SELECT sql_saga.drop_foreign_key('rooms', 'rooms_house_id_valid');
+SELECT sql_saga.drop_era('rooms');
+SELECT sql_saga.drop_unique_key('houses', 'houses_id_valid');
+SELECT sql_saga.drop_era('houses');
+DELETE FROM rooms;
+DELETE FROM houses;
@@ -0,0 +1,50 @@
+-- Unique keys can be kept with the btree index of the unique constraint alone
+CREATE TABLE rotas (
+  id INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+SELECT sql_saga.add_era('rotas', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('rotas', ARRAY['id'], btree => true);
+SELECT key_name, unique_constraint, exclude_constraint FROM sql_saga.unique_keys WHERE table_name = 'rotas'::regclass;
+
+INSERT INTO rotas VALUES
+  (1, 1, 5),
+  (1, 5, 10),
+  (2, 1, 10)
+;
+
+-- Overlapping the row before
+INSERT INTO rotas VALUES (1, 4, 6);
+-- Overlapping the row after
+INSERT INTO rotas VALUES (1, 0, 2);
+-- Starting with another row
+INSERT INTO rotas VALUES (1, 1, 3);
+-- Covering other rows
+INSERT INTO rotas VALUES (1, -5, 20);
+-- Adjacent rows don't overlap
+INSERT INTO rotas VALUES (1, 10, 15);
+-- Updates are checked too
+UPDATE rotas SET valid_to = 7 WHERE (id, valid_from) = (1, 1);
+-- And rows of the same statement
+INSERT INTO rotas VALUES (3, 1, 5), (3, 2, 6);
+-- Nulls never conflict
+INSERT INTO rotas VALUES (NULL, 1, 5), (NULL, 1, 5);
+
+-- The check can be deferred
+BEGIN;
+SET CONSTRAINTS rotas_id_valid_overlap DEFERRED;
+INSERT INTO rotas VALUES (1, 12, 20);
+UPDATE rotas SET valid_from = 15 WHERE (id, valid_from) = (1, 12);
+COMMIT;
+
+SELECT id, valid_from, valid_to FROM rotas ORDER BY id, valid_from;
+
+-- Rows that already overlap are found when the key is added
+SELECT sql_saga.drop_unique_key('rotas', 'rotas_id_valid');
+INSERT INTO rotas VALUES (3, 1, 5), (3, 2, 6);
+SELECT sql_saga.add_unique_key('rotas', ARRAY['id'], btree => true);
+
+-- Clean up
+SELECT sql_saga.drop_era('rotas');
+DROP TABLE rotas;
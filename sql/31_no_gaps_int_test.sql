@@ -67,6 +67,23 @@ SELECT sql_saga.no_gaps(int4range(valid_from, valid_to), int4range(1, 15))
 FROM int_shifts
 WHERE job_id = 1;
 
+-- Test 9: Unsorted Ranges
+-- Expected: TRUE
+SELECT sql_saga.no_gaps(int4range(valid_from, valid_to), int4range(1, 12) ORDER BY worker_id DESC)
+FROM int_shifts
+WHERE job_id = 1;
+
+-- Test 10: Many Unsorted Ranges
+-- Expected: TRUE
+SELECT sql_saga.no_gaps(int4range(g, g + 1), int4range(1, 10001) ORDER BY g DESC)
+FROM generate_series(1, 10000) AS g;
+
+-- Test 11: Many Unsorted Ranges with a Gap
+-- Expected: FALSE
+SELECT sql_saga.no_gaps(int4range(g, g + 1), int4range(1, 10001) ORDER BY g DESC)
+FROM generate_series(1, 10000) AS g
+WHERE g <> 5000;
+
 
 SELECT sql_saga.drop_unique_key('int_shifts', 'int_shifts_job_id_worker_id_valid');
 SELECT sql_saga.drop_era('int_shifts');
@@ -68,6 +68,12 @@ SELECT sql_saga.no_gaps(numrange(valid_from, valid_to), numrange(1.5, 15.5))
 FROM numeric_shifts
 WHERE job_id = 1;
 
+-- Test 9: Unsorted Ranges
+-- Expected: TRUE
+SELECT sql_saga.no_gaps(numrange(valid_from, valid_to), numrange(1.5, 12.5) ORDER BY worker_id DESC)
+FROM numeric_shifts
+WHERE job_id = 1;
+
 SET client_min_messages TO NOTICE;
 
 SELECT sql_saga.drop_unique_key('numeric_shifts', 'numeric_shifts_job_id_worker_id_valid');
@@ -141,9 +141,9 @@ SELECT  sql_saga.no_gaps(daterange(valid_from,valid_to), null)
 FROM    date_shifts
 WHERE   job_id = 1;
 
--- Errors:
+-- Unsorted input:
 
--- it fails if the input ranges go backwards:
+-- it does not need the input ranges to be sorted:
 SELECT  sql_saga.no_gaps(daterange(valid_from,valid_to), daterange('2017-11-25', '2017-11-27') ORDER BY worker_id DESC)
 FROM    date_shifts
 WHERE   job_id = 1;
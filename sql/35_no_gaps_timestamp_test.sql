@@ -139,9 +139,9 @@ SELECT  sql_saga.no_gaps(tstzrange(valid_from,valid_to), null)
 FROM    timestamp_shifts
 WHERE   job_id = 1;
 
--- Errors:
+-- Unsorted input:
 
--- it fails if the input ranges go backwards:
+-- it does not need the input ranges to be sorted:
 SELECT  sql_saga.no_gaps(tstzrange(valid_from,valid_to), tstzrange('2017-11-27 13:00:00', '2017-11-27 20:00:00') ORDER BY worker_id DESC)
 FROM    timestamp_shifts
 WHERE   job_id = 1;
@@ -0,0 +1,65 @@
+CREATE TABLE lookup_shifts (
+  job_id INTEGER,
+  worker_id INTEGER,
+  valid_from timestamptz,
+  valid_to timestamptz
+);
+SELECT sql_saga.add_era('lookup_shifts', 'valid_from', 'valid_to');
+
+INSERT INTO lookup_shifts(job_id, worker_id, valid_from, valid_to) VALUES
+  (1, 1, '2017-11-27 06:00:00', '2017-11-27 12:00:00'),
+  (1, 1, '2017-11-27 12:00:00', '2017-11-27 17:00:00'),
+  (2, 1, '2017-11-27 06:00:00', '2017-11-27 12:00:00'),
+  (2, 1, '2017-11-27 13:00:00', '2017-11-27 17:00:00'),
+  (2, 2, '2017-11-27 06:00:00', '2017-11-27 17:00:00')
+;
+
+-- TRUE:
+
+-- it covers when the range matches two exactly:
+SELECT sql_saga.no_gaps_lookup('lookup_shifts', ARRAY['job_id'], ARRAY['1'], tstzrange('2017-11-27 06:00:00', '2017-11-27 17:00:00'));
+
+-- it covers when the range has extra on both sides:
+SELECT sql_saga.no_gaps_lookup('lookup_shifts', ARRAY['job_id'], ARRAY['1'], tstzrange('2017-11-27 08:00:00', '2017-11-27 14:00:00'));
+
+-- it covers with several key columns:
+SELECT sql_saga.no_gaps_lookup('lookup_shifts', ARRAY['job_id', 'worker_id'], ARRAY['2', '2'], tstzrange('2017-11-27 06:00:00', '2017-11-27 17:00:00'));
+
+-- FALSE:
+
+-- it does not cover when there is a gap:
+SELECT sql_saga.no_gaps_lookup('lookup_shifts', ARRAY['job_id', 'worker_id'], ARRAY['2', '1'], tstzrange('2017-11-27 06:00:00', '2017-11-27 17:00:00'));
+
+-- it does not cover when the range has something at the beginning:
+SELECT sql_saga.no_gaps_lookup('lookup_shifts', ARRAY['job_id'], ARRAY['1'], tstzrange('2017-11-27 04:00:00', '2017-11-27 14:00:00'));
+
+-- it does not cover when the range has something at the end:
+SELECT sql_saga.no_gaps_lookup('lookup_shifts', ARRAY['job_id'], ARRAY['1'], tstzrange('2017-11-27 06:00:00', '2017-11-27 20:00:00'));
+
+-- it does not cover an inclusive end that no row contains:
+SELECT sql_saga.no_gaps_lookup('lookup_shifts', ARRAY['job_id'], ARRAY['1'], tstzrange('2017-11-27 06:00:00', '2017-11-27 17:00:00', '[]'));
+
+-- it does not cover when there is no such key:
+SELECT sql_saga.no_gaps_lookup('lookup_shifts', ARRAY['job_id'], ARRAY['3'], tstzrange('2017-11-27 06:00:00', '2017-11-27 12:00:00'));
+
+-- it does not cover an unbounded target:
+SELECT sql_saga.no_gaps_lookup('lookup_shifts', ARRAY['job_id'], ARRAY['1'], tstzrange(NULL, '2017-11-27 12:00:00'));
+
+-- NULL:
+
+-- it is unknown when the target is empty:
+SELECT sql_saga.no_gaps_lookup('lookup_shifts', ARRAY['job_id'], ARRAY['1'], tstzrange('2017-11-27 06:00:00', '2017-11-27 06:00:00'));
+
+-- Errors:
+
+-- it fails when the key doesn't match the columns:
+SELECT sql_saga.no_gaps_lookup('lookup_shifts', ARRAY['job_id', 'worker_id'], ARRAY['1'], tstzrange('2017-11-27 06:00:00', '2017-11-27 12:00:00'));
+
+-- it fails for an unknown column:
+SELECT sql_saga.no_gaps_lookup('lookup_shifts', ARRAY['shift_id'], ARRAY['1'], tstzrange('2017-11-27 06:00:00', '2017-11-27 12:00:00'));
+
+-- it fails when the target is not of the era's range type:
+SELECT sql_saga.no_gaps_lookup('lookup_shifts', ARRAY['job_id'], ARRAY['1'], int4range(1, 2));
+
+SELECT sql_saga.drop_era('lookup_shifts');
+DROP TABLE lookup_shifts;
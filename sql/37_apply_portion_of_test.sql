@@ -0,0 +1,58 @@
+CREATE TABLE prices (
+  id INTEGER,
+  price INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+SELECT sql_saga.add_era('prices', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('prices', ARRAY['id']);
+
+INSERT INTO prices VALUES
+  (1, 100, 1, 13),
+  (2, 200, 1, 13),
+  (3, 300, 1, 13)
+;
+
+CREATE TABLE price_changes (
+  id INTEGER,
+  price INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+
+INSERT INTO price_changes VALUES
+  (1, 110, 3, 6),
+  (1, 120, 9, 20),
+  (2, 250, 0, 20)
+;
+
+-- Each change only goes to its portion of the rows it overlaps
+SELECT sql_saga.apply_portion_of('prices', 'price_changes');
+TABLE prices ORDER BY id, valid_from;
+
+-- Changes to the same key can't overlap
+DELETE FROM price_changes;
+INSERT INTO price_changes VALUES
+  (3, 310, 2, 6),
+  (3, 320, 5, 8)
+;
+SELECT sql_saga.apply_portion_of('prices', 'price_changes');
+
+-- The changes can only have columns the target has
+DELETE FROM price_changes;
+ALTER TABLE price_changes ADD COLUMN currency TEXT;
+SELECT sql_saga.apply_portion_of('prices', 'price_changes');
+ALTER TABLE price_changes DROP COLUMN currency;
+
+-- The unique key is checked right away again once the changes are in
+INSERT INTO price_changes VALUES (3, 330, 4, 8);
+BEGIN;
+SELECT sql_saga.apply_portion_of('prices', 'price_changes', coalesce_versions => true);
+INSERT INTO prices VALUES (3, 340, 5, 6);
+ROLLBACK;
+
+-- Clean up
+DROP TABLE price_changes;
+SELECT sql_saga.drop_unique_key('prices', 'prices_id_valid');
+SELECT sql_saga.drop_era('prices');
+DROP TABLE prices;
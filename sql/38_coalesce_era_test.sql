@@ -0,0 +1,41 @@
+CREATE TABLE stock (
+  id INTEGER,
+  amount INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+SELECT sql_saga.add_era('stock', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('stock', ARRAY['id']);
+
+INSERT INTO stock VALUES
+  (1, 10, 1, 3),
+  (1, 10, 3, 5),
+  (1, 20, 5, 7),
+  (1, 20, 7, 9),
+  (1, 10, 9, 11),
+  (2, 10, 1, 3),
+  (2, 10, 4, 6),
+  (3, NULL, 1, 3),
+  (3, NULL, 3, 5)
+;
+
+-- Only adjacent rows with the same values are merged
+SELECT sql_saga.coalesce_era('stock');
+TABLE stock ORDER BY id, valid_from;
+
+-- Changes can be coalesced as they are applied
+CREATE TABLE stock_changes (
+  id INTEGER,
+  amount INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+INSERT INTO stock_changes VALUES (1, 10, 5, 9);
+SELECT sql_saga.apply_portion_of('stock', 'stock_changes', coalesce_versions => true);
+TABLE stock ORDER BY id, valid_from;
+
+-- Clean up
+DROP TABLE stock_changes;
+SELECT sql_saga.drop_unique_key('stock', 'stock_id_valid');
+SELECT sql_saga.drop_era('stock');
+DROP TABLE stock;
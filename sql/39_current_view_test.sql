@@ -0,0 +1,45 @@
+CREATE TABLE employees (
+  id INTEGER,
+  name TEXT,
+  valid_from DATE,
+  valid_to DATE
+);
+SELECT sql_saga.add_era('employees', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('employees', ARRAY['id']);
+
+INSERT INTO employees VALUES
+  (1, 'Alice', '2020-01-01', '2021-01-01'),
+  (1, 'Alicia', '2021-01-01', 'infinity'),
+  (2, 'Bob', '2020-01-01', '2022-01-01')
+;
+
+-- The current view only has the rows that are still valid
+SELECT sql_saga.add_current_view('employees');
+TABLE sql_saga.current_view;
+SELECT id, name FROM employees__current_valid ORDER BY id;
+
+-- It follows changes to the table
+UPDATE employees SET valid_to = 'infinity' WHERE id = 2;
+SELECT id, name FROM employees__current_valid ORDER BY id;
+
+-- It can't be dropped behind our back
+DROP VIEW employees__current_valid;
+
+SELECT sql_saga.drop_current_view('employees');
+SELECT sql_saga.drop_current_view('employees');
+
+-- Only eras that can end at infinity have current rows
+CREATE TABLE versions (
+  id INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+SELECT sql_saga.add_era('versions', 'valid_from', 'valid_to');
+SELECT sql_saga.add_current_view('versions');
+
+-- Clean up
+SELECT sql_saga.drop_era('versions');
+DROP TABLE versions;
+SELECT sql_saga.drop_unique_key('employees', 'employees_id_valid');
+SELECT sql_saga.drop_era('employees');
+DROP TABLE employees;
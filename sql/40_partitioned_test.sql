@@ -0,0 +1,97 @@
+-- Eras on partitioned tables must be partitioned by their start column
+CREATE TABLE prices_by_id (
+  id INTEGER,
+  price INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+) PARTITION BY RANGE (id);
+SELECT sql_saga.add_era('prices_by_id', 'valid_from', 'valid_to');
+DROP TABLE prices_by_id;
+
+CREATE TABLE prices_by_year (
+  id INTEGER,
+  price INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+) PARTITION BY RANGE (valid_from);
+CREATE TABLE prices_by_year_1 PARTITION OF prices_by_year FOR VALUES FROM (MINVALUE) TO (10);
+CREATE TABLE prices_by_year_2 PARTITION OF prices_by_year FOR VALUES FROM (10) TO (MAXVALUE);
+SELECT sql_saga.add_era('prices_by_year', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('prices_by_year', ARRAY['id']);
+
+INSERT INTO prices_by_year VALUES
+  (1, 100, 1, 15),
+  (1, 110, 15, 20),
+  (2, 200, 5, 12)
+;
+
+-- Overlaps are found across partitions
+INSERT INTO prices_by_year VALUES (1, 120, 12, 14);
+
+-- Foreign keys are checked across partitions
+CREATE TABLE orders (
+  id INTEGER,
+  price_id INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+SELECT sql_saga.add_era('orders', 'valid_from', 'valid_to');
+SELECT sql_saga.add_foreign_key('orders', ARRAY['price_id'], 'valid', 'prices_by_year_id_valid');
+INSERT INTO orders VALUES (1, 1, 5, 18);
+INSERT INTO orders VALUES (2, 2, 10, 14);
+DELETE FROM prices_by_year WHERE (id, valid_from) = (1, 15);
+
+-- Clean up
+SELECT sql_saga.drop_foreign_key('orders', 'orders_price_id_valid');
+SELECT sql_saga.drop_era('orders');
+DROP TABLE orders;
+SELECT sql_saga.drop_unique_key('prices_by_year', 'prices_by_year_id_valid');
+SELECT sql_saga.drop_era('prices_by_year');
+DROP TABLE prices_by_year;
+
+-- Rows are found by partition as well as by ctid when they are split
+CREATE TABLE rates (
+  id SERIAL,
+  rate_id INTEGER,
+  rate INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER,
+  PRIMARY KEY (id, valid_from)
+) PARTITION BY RANGE (valid_from);
+CREATE TABLE rates_1 PARTITION OF rates FOR VALUES FROM (MINVALUE) TO (10);
+CREATE TABLE rates_2 PARTITION OF rates FOR VALUES FROM (10) TO (MAXVALUE);
+SELECT sql_saga.add_era('rates', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('rates', ARRAY['rate_id']);
+SELECT sql_saga.add_api('rates');
+
+INSERT INTO rates (rate_id, rate, valid_from, valid_to) VALUES
+  (1, 100, 1, 15),
+  (2, 200, 10, 20)
+;
+
+CREATE TABLE rate_changes (
+  rate_id INTEGER,
+  rate INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+INSERT INTO rate_changes VALUES
+  (1, 110, 3, 6),
+  (2, 250, 15, 25)
+;
+SELECT sql_saga.apply_portion_of('rates', 'rate_changes');
+SELECT tableoid::regclass AS partition, rate_id, rate, valid_from, valid_to FROM rates ORDER BY rate_id, valid_from;
+
+-- The updated portion and the leftovers can land in other partitions
+UPDATE rates__for_portion_of_valid SET rate = 120, valid_from = 11, valid_to = 13 WHERE rate_id = 1;
+SELECT tableoid::regclass AS partition, rate_id, rate, valid_from, valid_to FROM rates ORDER BY rate_id, valid_from;
+
+UPDATE rates__for_portion_of_valid SET rate = 100 WHERE (rate_id, valid_from) = (1, 11);
+SELECT sql_saga.coalesce_era('rates');
+SELECT tableoid::regclass AS partition, rate_id, rate, valid_from, valid_to FROM rates ORDER BY rate_id, valid_from;
+
+DROP TABLE rate_changes;
+SELECT sql_saga.drop_api('rates', 'valid');
+SELECT sql_saga.drop_unique_key('rates', 'rates_rate_id_valid');
+SELECT sql_saga.drop_era('rates');
+DROP TABLE rates;
@@ -0,0 +1,41 @@
+CREATE TABLE stores (
+  id INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+SELECT sql_saga.add_era('stores', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('stores', ARRAY['id']);
+
+CREATE TABLE sales (
+  id INTEGER,
+  store_id INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+SELECT sql_saga.add_era('sales', 'valid_from', 'valid_to');
+SELECT sql_saga.add_foreign_key('sales', ARRAY['store_id'], 'valid', 'stores_id_valid');
+
+-- The unique key has the index of its unique constraint, the foreign key has none
+SELECT * FROM sql_saga.index_advice() WHERE table_name IN ('stores'::regclass, 'sales'::regclass);
+
+-- Foreign keys can create their index
+SELECT sql_saga.drop_foreign_key('sales', 'sales_store_id_valid');
+SELECT sql_saga.add_foreign_key('sales', ARRAY['store_id'], 'valid', 'stores_id_valid', create_index => true);
+SELECT indexname FROM pg_catalog.pg_indexes WHERE tablename = 'sales' ORDER BY indexname;
+SELECT * FROM sql_saga.index_advice() WHERE table_name IN ('stores'::regclass, 'sales'::regclass);
+
+-- Any index with the key columns first will do
+DROP INDEX sales_store_id_valid_from_valid_to_idx;
+CREATE INDEX sales_store_id_idx ON sales (store_id);
+SELECT * FROM sql_saga.index_advice() WHERE table_name IN ('stores'::regclass, 'sales'::regclass);
+SELECT sql_saga.drop_foreign_key('sales', 'sales_store_id_valid');
+SELECT sql_saga.add_foreign_key('sales', ARRAY['store_id'], 'valid', 'stores_id_valid', create_index => true);
+SELECT indexname FROM pg_catalog.pg_indexes WHERE tablename = 'sales' ORDER BY indexname;
+
+-- Clean up
+SELECT sql_saga.drop_foreign_key('sales', 'sales_store_id_valid');
+SELECT sql_saga.drop_era('sales');
+DROP TABLE sales;
+SELECT sql_saga.drop_unique_key('stores', 'stores_id_valid');
+SELECT sql_saga.drop_era('stores');
+DROP TABLE stores;
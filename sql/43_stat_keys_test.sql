@@ -0,0 +1,76 @@
+CREATE TABLE depots (
+  id INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+SELECT sql_saga.add_era('depots', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('depots', ARRAY['id'], btree => true);
+
+CREATE TABLE deliveries (
+  id INTEGER,
+  depot_id INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+SELECT sql_saga.add_era('deliveries', 'valid_from', 'valid_to');
+SELECT sql_saga.add_foreign_key('deliveries', ARRAY['depot_id'], 'valid', 'depots_id_valid');
+
+SELECT sql_saga.stat_reset();
+
+INSERT INTO depots VALUES
+  (1, 0, 10),
+  (1, 10, 20),
+  (2, 0, 20)
+;
+INSERT INTO depots VALUES (2, 5, 15);
+
+-- The first delivery is covered by two rows of its depot
+INSERT INTO deliveries VALUES
+  (1, 1, 5, 15),
+  (2, 2, 0, 20)
+;
+INSERT INTO deliveries VALUES (3, 1, 15, 25);
+DELETE FROM depots WHERE id = 2;
+DELETE FROM deliveries WHERE id = 2;
+DELETE FROM depots WHERE id = 2;
+
+-- Failed checks are counted although their statement was rolled back
+SELECT key_name, calls, rows_checked, rows_scanned, violations, total_time >= max_time AS times_add_up
+FROM sql_saga.stat_foreign_keys
+WHERE table_name = 'deliveries'::regclass;
+
+SELECT key_name, calls, rows_checked, rows_scanned, violations, total_time >= max_time AS times_add_up
+FROM sql_saga.stat_unique_keys
+WHERE table_name = 'depots'::regclass;
+
+SELECT sql_saga.stat_reset();
+
+SELECT key_name, calls, violations
+FROM sql_saga.stat_foreign_keys
+WHERE table_name = 'deliveries'::regclass;
+
+-- Batch foreign keys are counted once per statement
+SELECT sql_saga.drop_foreign_key('deliveries', 'deliveries_depot_id_valid');
+SELECT sql_saga.add_foreign_key('deliveries', ARRAY['depot_id'], 'valid', 'depots_id_valid', batch => true);
+SELECT sql_saga.stat_reset();
+INSERT INTO deliveries VALUES
+  (4, 1, 0, 5),
+  (5, 1, 5, 10)
+;
+DELETE FROM depots WHERE (id, valid_from) = (1, 10);
+
+SELECT key_name, calls, rows_checked, rows_scanned, violations, total_time >= max_time AS times_add_up
+FROM sql_saga.stat_foreign_keys
+WHERE table_name = 'deliveries'::regclass;
+
+SELECT key_name, calls, rows_checked, rows_scanned, violations, total_time >= max_time AS times_add_up
+FROM sql_saga.stat_unique_keys
+WHERE table_name = 'depots'::regclass;
+
+-- Clean up
+SELECT sql_saga.drop_foreign_key('deliveries', 'deliveries_depot_id_valid');
+SELECT sql_saga.drop_era('deliveries');
+DROP TABLE deliveries;
+SELECT sql_saga.drop_unique_key('depots', 'depots_id_valid');
+SELECT sql_saga.drop_era('depots');
+DROP TABLE depots;
@@ -0,0 +1,69 @@
+-- The referenced side of a batch foreign key is checked once per statement
+CREATE TABLE plots (
+  line_id SERIAL PRIMARY KEY,
+  id INTEGER,
+  owner TEXT,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+SELECT sql_saga.add_era('plots', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('plots', ARRAY['id']);
+SELECT sql_saga.add_api('plots');
+
+CREATE TABLE crops (
+  id INTEGER,
+  plot_id INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+SELECT sql_saga.add_era('crops', 'valid_from', 'valid_to');
+SELECT sql_saga.add_foreign_key('crops', ARRAY['plot_id'], 'valid', 'plots_id_valid', batch => true);
+
+SELECT tgname, tgconstraint <> 0 AS is_constraint, tgoldtable, tgnewtable
+FROM pg_catalog.pg_trigger
+WHERE tgrelid = 'plots'::regclass
+  AND tgname LIKE 'crops%'
+ORDER BY tgname;
+
+INSERT INTO plots (id, owner, valid_from, valid_to) VALUES
+  (1, 'ann', 0, 10),
+  (1, 'bob', 10, 20),
+  (1, 'cid', 20, 30),
+  (2, 'ann', 0, 30),
+  (3, 'ann', 0, 10)
+;
+INSERT INTO crops VALUES
+  (1, 1, 5, 15),
+  (2, 2, 0, 30)
+;
+
+-- Changing other columns of every version of a key is fine
+UPDATE plots SET owner = 'dan' WHERE id = 1;
+
+-- So is deleting keys and versions nothing references
+DELETE FROM plots WHERE id = 3;
+DELETE FROM plots WHERE id = 1 AND valid_from = 20;
+
+-- You can't delete all the versions of a referenced key
+DELETE FROM plots WHERE id = 1;
+
+-- You can't shrink a referenced version
+UPDATE plots SET valid_to = 20 WHERE id = 2;
+
+-- Splitting a version through the API keeps every portion covered
+UPDATE plots__for_portion_of_valid SET owner = 'eve', valid_from = 10, valid_to = 20 WHERE id = 2;
+UPDATE plots__for_portion_of_valid SET owner = 'ann', valid_from = 10, valid_to = 20 WHERE id = 2;
+
+-- And so does merging the versions back
+SELECT sql_saga.coalesce_era('plots');
+
+SELECT id, owner, valid_from, valid_to FROM plots ORDER BY id, valid_from;
+
+-- Clean up
+SELECT sql_saga.drop_foreign_key('crops', 'crops_plot_id_valid');
+SELECT sql_saga.drop_era('crops');
+DROP TABLE crops;
+SELECT sql_saga.drop_api('plots', NULL);
+SELECT sql_saga.drop_unique_key('plots', 'plots_id_valid');
+SELECT sql_saga.drop_era('plots');
+DROP TABLE plots;
@@ -0,0 +1,61 @@
+-- Facts are matched to the version of the dimension valid at their time
+CREATE TABLE branches (
+  id INTEGER,
+  name TEXT,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+SELECT sql_saga.add_era('branches', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('branches', ARRAY['id']);
+
+INSERT INTO branches VALUES
+  (1, 'north', 0, 10),
+  (1, 'north-east', 10, 20),
+  (2, 'south', 5, 15);
+
+CREATE TABLE receipts (
+  id INTEGER,
+  branch_id INTEGER,
+  sold_at INTEGER
+);
+
+-- The end of an era is not part of it, and facts outside every era are left out
+INSERT INTO receipts VALUES
+  (1, 1, 0),
+  (2, 1, 9),
+  (3, 1, 10),
+  (4, 1, 25),
+  (5, 2, 4),
+  (6, 2, 5),
+  (7, 3, 1),
+  (8, NULL, 3),
+  (9, 2, 14);
+
+SELECT (j.fact).id, (j.fact).sold_at, (j.dimension).name
+FROM sql_saga.as_of_join('receipts', ARRAY['branch_id'], 'sold_at', 'branches')
+     AS j(fact receipts, dimension branches)
+ORDER BY 1;
+
+-- The same as a join on the era
+SELECT r.id, r.sold_at, b.name
+FROM receipts AS r
+JOIN branches AS b ON b.id = r.branch_id AND r.sold_at >= b.valid_from AND r.sold_at < b.valid_to
+EXCEPT
+SELECT (j.fact).id, (j.fact).sold_at, (j.dimension).name
+FROM sql_saga.as_of_join('receipts', ARRAY['branch_id'], 'sold_at', 'branches', 'branches_id_valid')
+     AS j(fact receipts, dimension branches);
+
+-- The column definition list must have the row types of both tables
+SELECT *
+FROM sql_saga.as_of_join('receipts', ARRAY['branch_id'], 'sold_at', 'branches')
+     AS j(fact branches, dimension receipts);
+
+-- The key columns must match those of the unique key
+SELECT *
+FROM sql_saga.as_of_join('receipts', ARRAY['branch_id', 'id'], 'sold_at', 'branches')
+     AS j(fact receipts, dimension branches);
+
+SELECT sql_saga.drop_unique_key('branches', 'branches_id_valid');
+SELECT sql_saga.drop_era('branches');
+DROP TABLE receipts;
+DROP TABLE branches;
@@ -0,0 +1,38 @@
+-- contains() and overlaps() on an era with a range index can use that index
+CREATE TABLE bookings (
+  id INTEGER,
+  room TEXT,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+SELECT sql_saga.add_era('bookings', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('bookings', ARRAY['id']);
+
+INSERT INTO bookings VALUES
+  (1, 'a', 0, 10),
+  (1, 'b', 10, 20),
+  (2, 'c', 5, 15);
+
+SET enable_seqscan = off;
+SET enable_bitmapscan = off;
+
+EXPLAIN (COSTS OFF) SELECT id, room FROM bookings WHERE sql_saga.overlaps(valid_from, valid_to, 10, 12);
+EXPLAIN (COSTS OFF) SELECT id, room FROM bookings WHERE sql_saga.overlaps(10, 12, valid_from, valid_to);
+EXPLAIN (COSTS OFF) SELECT id, room FROM bookings WHERE sql_saga.contains(valid_from, valid_to, 5);
+EXPLAIN (COSTS OFF) SELECT id, room FROM bookings WHERE sql_saga.contains(valid_from, valid_to, 11, 16);
+
+-- An empty range would not give the same answer, so it is inlined as before
+EXPLAIN (COSTS OFF) SELECT id, room FROM bookings WHERE sql_saga.overlaps(valid_from, valid_to, 12, 12);
+
+SELECT id, room FROM bookings WHERE sql_saga.overlaps(valid_from, valid_to, 10, 12) ORDER BY id, room;
+SELECT id, room FROM bookings WHERE sql_saga.overlaps(10, 12, valid_from, valid_to) ORDER BY id, room;
+SELECT id, room FROM bookings WHERE sql_saga.contains(valid_from, valid_to, 5) ORDER BY id, room;
+SELECT id, room FROM bookings WHERE sql_saga.contains(valid_from, valid_to, 11, 16) ORDER BY id, room;
+SELECT id, room FROM bookings WHERE sql_saga.overlaps(valid_from, valid_to, 12, 12) ORDER BY id, room;
+
+RESET enable_seqscan;
+RESET enable_bitmapscan;
+
+SELECT sql_saga.drop_unique_key('bookings', 'bookings_id_valid');
+SELECT sql_saga.drop_era('bookings');
+DROP TABLE bookings;
@@ -0,0 +1,43 @@
+-- A foreign key added NOT VALID checks the changes, and validate_foreign_key() the existing rows
+CREATE TABLE warehouses (
+  id INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+SELECT sql_saga.add_era('warehouses', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('warehouses', ARRAY['id']);
+INSERT INTO warehouses VALUES (1, 0, 10);
+
+CREATE TABLE shipments (
+  id INTEGER,
+  warehouse_id INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+SELECT sql_saga.add_era('shipments', 'valid_from', 'valid_to');
+INSERT INTO shipments VALUES
+  (1, 1, 0, 5),
+  (2, 1, 5, 20);
+
+SELECT sql_saga.add_foreign_key('shipments', ARRAY['warehouse_id'], 'valid', 'warehouses_id_valid', not_valid => true);
+SELECT key_name, validated FROM sql_saga.foreign_keys WHERE table_name = 'shipments'::regclass;
+
+-- New rows are checked
+INSERT INTO shipments VALUES (3, 1, 8, 12);
+
+-- The existing rows are checked when validating
+SELECT sql_saga.validate_foreign_key('shipments_warehouse_id_valid');
+SELECT key_name, validated FROM sql_saga.foreign_keys WHERE table_name = 'shipments'::regclass;
+
+UPDATE warehouses SET valid_to = 20 WHERE id = 1;
+SELECT sql_saga.validate_foreign_key('shipments_warehouse_id_valid');
+SELECT key_name, validated FROM sql_saga.foreign_keys WHERE table_name = 'shipments'::regclass;
+
+SELECT sql_saga.validate_foreign_key('no_such_key');
+
+SELECT sql_saga.drop_foreign_key('shipments', 'shipments_warehouse_id_valid');
+SELECT sql_saga.drop_era('shipments');
+SELECT sql_saga.drop_unique_key('warehouses', 'warehouses_id_valid');
+SELECT sql_saga.drop_era('warehouses');
+DROP TABLE shipments;
+DROP TABLE warehouses;
@@ -0,0 +1,68 @@
+-- completely_covers needs its input sorted, and works for any range type
+
+-- Consecutive ranges cover the target
+-- Expected: TRUE
+SELECT sql_saga.completely_covers(r, int4range(1, 12) ORDER BY r) FROM (VALUES (int4range(1, 6)), (int4range(6, 12))) AS t(r);
+
+-- A gap in between
+-- Expected: FALSE
+SELECT sql_saga.completely_covers(r, int4range(1, 12) ORDER BY r) FROM (VALUES (int4range(1, 5)), (int4range(6, 12))) AS t(r);
+
+-- Overlapping ranges
+-- Expected: TRUE
+SELECT sql_saga.completely_covers(r, int4range(1, 12) ORDER BY r) FROM (VALUES (int4range(1, 8)), (int4range(3, 5)), (int4range(3, 12))) AS t(r);
+
+-- Ranges that end before the target do not leave a gap
+-- Expected: TRUE
+SELECT sql_saga.completely_covers(r, int4range(5, 10) ORDER BY r) FROM (VALUES (int4range(0, 3)), (int4range(5, 10))) AS t(r);
+
+-- The target starts before the first range
+-- Expected: FALSE
+SELECT sql_saga.completely_covers(r, int4range(1, 12) ORDER BY r) FROM (VALUES (int4range(2, 6)), (int4range(6, 12))) AS t(r);
+
+-- bigint
+-- Expected: TRUE
+SELECT sql_saga.completely_covers(r, int8range(5000000000, 7000000000) ORDER BY r) FROM (VALUES (int8range(4000000000, 6000000000)), (int8range(6000000000, 8000000000))) AS t(r);
+
+-- date, with an inclusive end
+-- Expected: TRUE
+SELECT sql_saga.completely_covers(r, daterange('2024-01-01', '2024-12-31', '[]') ORDER BY r) FROM (VALUES (daterange('2024-01-01', '2024-07-01')), (daterange('2024-07-01', '2025-01-01'))) AS t(r);
+
+-- timestamp with time zone, up to an unbounded end
+-- Expected: TRUE
+SELECT sql_saga.completely_covers(r, tstzrange('2024-01-01', NULL) ORDER BY r) FROM (VALUES (tstzrange('2024-01-01', '2024-06-01')), (tstzrange('2024-06-01', NULL))) AS t(r);
+
+-- Expected: FALSE
+SELECT sql_saga.completely_covers(r, tstzrange('2024-01-01', NULL) ORDER BY r) FROM (VALUES (tstzrange('2024-01-01', '2024-06-01')), (tstzrange('2024-06-01', '2025-01-01'))) AS t(r);
+
+-- An unbounded start needs an unbounded first range
+-- Expected: FALSE
+SELECT sql_saga.completely_covers(r, tsrange(NULL, '2024-01-01') ORDER BY r) FROM (VALUES (tsrange('2000-01-01', '2024-01-01'))) AS t(r);
+
+-- Expected: TRUE
+SELECT sql_saga.completely_covers(r, tsrange(NULL, '2024-01-01') ORDER BY r) FROM (VALUES (tsrange(NULL, '2000-01-01')), (tsrange('2000-01-01', '2024-01-01'))) AS t(r);
+
+-- numeric, compared with the btree function of the type
+-- Expected: TRUE
+SELECT sql_saga.completely_covers(r, numrange(2, 4) ORDER BY r) FROM (VALUES (numrange(1.5, 3.0)), (numrange(3.0, 4.5))) AS t(r);
+
+-- Exclusive bounds on both sides leave out 3.0
+-- Expected: FALSE
+SELECT sql_saga.completely_covers(r, numrange(2, 4) ORDER BY r) FROM (VALUES (numrange(1.5, 3.0)), (numrange(3.0, 4.5, '()'))) AS t(r);
+
+-- NULL and empty ranges are skipped
+-- Expected: TRUE
+SELECT sql_saga.completely_covers(r, int4range(1, 12) ORDER BY r) FROM (VALUES (int4range(1, 6)), (NULL), (int4range(4, 4)), (int4range(6, 12))) AS t(r);
+
+-- A NULL or empty target gives NULL
+SELECT sql_saga.completely_covers(r, NULL::int4range ORDER BY r) FROM (VALUES (int4range(1, 6))) AS t(r);
+SELECT sql_saga.completely_covers(r, 'empty'::int4range ORDER BY r) FROM (VALUES (int4range(1, 6))) AS t(r);
+
+-- One answer per group
+SELECT k, sql_saga.completely_covers(r, int4range(1, 12) ORDER BY r) FROM (VALUES (1, int4range(1, 6)), (1, int4range(6, 12)), (2, int4range(1, 6)), (2, int4range(7, 12))) AS t(k, r) GROUP BY k ORDER BY k;
+
+-- Unsorted input is an error
+SELECT sql_saga.completely_covers(r, int4range(1, 20) ORDER BY n) FROM (VALUES (1, int4range(1, 10)), (2, int4range(0, 5))) AS t(n, r);
+
+-- So is a target that changes
+SELECT sql_saga.completely_covers(r, g ORDER BY r) FROM (VALUES (int4range(1, 6), int4range(1, 12)), (int4range(6, 12), int4range(1, 13))) AS t(r, g);
@@ -0,0 +1,51 @@
+-- From PostgreSQL 14 on coverage is checked with multiranges
+CREATE TABLE harbours (
+  id INTEGER,
+  name TEXT,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+SELECT sql_saga.add_era('harbours', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('harbours', ARRAY['id']);
+
+CREATE TABLE ferries (
+  id INTEGER,
+  harbour_id INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+SELECT sql_saga.add_era('ferries', 'valid_from', 'valid_to');
+SELECT sql_saga.add_foreign_key('ferries', ARRAY['harbour_id'], 'valid', 'harbours_id_valid', batch => true);
+
+INSERT INTO harbours VALUES
+  (1, 'north', 0, 10),
+  (1, 'north quay', 10, 20),
+  (2, 'south', 0, 5),
+  (2, 'south', 8, 12);
+
+-- Covered by two versions of the harbour
+INSERT INTO ferries VALUES (1, 1, 5, 15);
+
+-- Harbour 2 has a gap
+INSERT INTO ferries VALUES (2, 2, 3, 10);
+
+-- The ferry still needs the second version
+DELETE FROM harbours WHERE id = 1 AND valid_from = 10;
+
+SELECT current_setting('server_version_num')::integer >= 140000 AS multiranges \gset
+\if :multiranges
+-- What every key covers, one row per key
+SELECT * FROM sql_saga.covered_multirange('harbours') AS c(id integer, covered int4multirange) ORDER BY id;
+SELECT c.id FROM sql_saga.covered_multirange('harbours', 'harbours_id_valid') AS c(id integer, covered int4multirange) WHERE c.covered @> int4range(4, 9);
+SELECT * FROM sql_saga.covered_multirange('ferries') AS c(id integer, covered int4multirange);
+SELECT * FROM sql_saga.covered_multirange('harbours', 'no_such_key') AS c(id integer, covered int4multirange);
+\else
+SELECT * FROM sql_saga.covered_multirange('harbours') AS c(id integer, covered text);
+\endif
+
+SELECT sql_saga.drop_foreign_key('ferries', 'ferries_harbour_id_valid');
+SELECT sql_saga.drop_era('ferries');
+SELECT sql_saga.drop_unique_key('harbours', 'harbours_id_valid');
+SELECT sql_saga.drop_era('harbours');
+DROP TABLE ferries;
+DROP TABLE harbours;
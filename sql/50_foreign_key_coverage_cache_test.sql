@@ -0,0 +1,73 @@
+-- fk_insert_check() remembers what it found covered during the transaction
+CREATE TABLE kennels (
+  id INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+SELECT sql_saga.add_era('kennels', 'valid_from', 'valid_to');
+SELECT sql_saga.add_unique_key('kennels', ARRAY['id']);
+
+CREATE TABLE dogs (
+  id INTEGER,
+  kennel_id INTEGER,
+  valid_from INTEGER,
+  valid_to INTEGER
+);
+SELECT sql_saga.add_era('dogs', 'valid_from', 'valid_to');
+SELECT sql_saga.add_foreign_key('dogs', ARRAY['kennel_id'], 'valid', 'kennels_id_valid');
+
+INSERT INTO kennels VALUES
+  (1, 0, 10),
+  (1, 10, 20),
+  (2, 0, 20);
+
+SELECT sql_saga.stat_reset();
+
+-- Only the first row is checked, the next two are inside what it covered
+BEGIN;
+INSERT INTO dogs VALUES (1, 1, 0, 20);
+INSERT INTO dogs VALUES (2, 1, 5, 15);
+INSERT INTO dogs VALUES (3, 1, 10, 20);
+COMMIT;
+
+-- A new transaction checks again
+INSERT INTO dogs VALUES (4, 1, 5, 15);
+
+SELECT calls, rows_checked FROM sql_saga.stat_foreign_keys WHERE key_name = 'dogs_kennel_id_valid';
+
+-- Deleting a referenced row forgets what was covered
+BEGIN;
+INSERT INTO dogs VALUES (5, 2, 0, 10);
+DELETE FROM dogs WHERE id = 5;
+DELETE FROM kennels WHERE id = 2;
+INSERT INTO dogs VALUES (6, 2, 2, 8);
+ROLLBACK;
+
+-- So does updating one
+BEGIN;
+INSERT INTO dogs VALUES (5, 2, 0, 10);
+DELETE FROM dogs WHERE id = 5;
+UPDATE kennels SET valid_from = 5 WHERE id = 2;
+INSERT INTO dogs VALUES (6, 2, 2, 8);
+ROLLBACK;
+
+-- Rolling back to a savepoint forgets what was covered in it
+SELECT sql_saga.stat_reset();
+BEGIN;
+SAVEPOINT before_dog;
+INSERT INTO dogs VALUES (5, 2, 0, 10);
+ROLLBACK TO SAVEPOINT before_dog;
+INSERT INTO dogs VALUES (6, 2, 2, 8);
+COMMIT;
+
+SELECT calls, rows_checked FROM sql_saga.stat_foreign_keys WHERE key_name = 'dogs_kennel_id_valid';
+
+TABLE dogs ORDER BY id;
+
+-- Clean up
+SELECT sql_saga.drop_foreign_key('dogs', 'dogs_kennel_id_valid');
+SELECT sql_saga.drop_era('dogs');
+DROP TABLE dogs;
+SELECT sql_saga.drop_unique_key('kennels', 'kennels_id_valid');
+SELECT sql_saga.drop_era('kennels');
+DROP TABLE kennels;
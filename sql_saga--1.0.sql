@@ -75,6 +75,7 @@ CREATE TABLE sql_saga.foreign_keys (
     fk_update_trigger name NOT NULL,
     uk_update_trigger name NOT NULL,
     uk_delete_trigger name NOT NULL,
+    validated boolean NOT NULL DEFAULT true,
 
     PRIMARY KEY (key_name),
 
@@ -119,31 +120,167 @@ CREATE TABLE sql_saga.api_view (
 GRANT SELECT ON TABLE sql_saga.api_view TO PUBLIC;
 SELECT pg_catalog.pg_extension_config_dump('sql_saga.api_view', '');
 
+/*
+ * The rows of an era that are still valid, that is whose end is infinity, get
+ * a view of their own backed by a partial index so that looking up the
+ * current state of a key does not depend on how much history there is.
+ */
+CREATE TABLE sql_saga.current_view (
+    table_name regclass NOT NULL,
+    era_name name NOT NULL,
+    view_name regclass NOT NULL,
+    index_name regclass NOT NULL,
+
+    PRIMARY KEY (table_name, era_name),
+
+    FOREIGN KEY (table_name, era_name) REFERENCES sql_saga.era,
+
+    UNIQUE (view_name)
+);
+GRANT SELECT ON TABLE sql_saga.current_view TO PUBLIC;
+SELECT pg_catalog.pg_extension_config_dump('sql_saga.current_view', '');
+
 /*
  * C Helper functions
  */
 CREATE OR REPLACE FUNCTION sql_saga.no_gaps_transfn(internal, anyrange, anyrange)
 RETURNS internal
 AS 'sql_saga', 'no_gaps_transfn'
-LANGUAGE c;
+LANGUAGE c PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION sql_saga.no_gaps_combinefn(internal, internal)
+RETURNS internal
+AS 'sql_saga', 'no_gaps_combinefn'
+LANGUAGE c PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION sql_saga.no_gaps_serialfn(internal)
+RETURNS bytea
+AS 'sql_saga', 'no_gaps_serialfn'
+LANGUAGE c STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION sql_saga.no_gaps_deserialfn(bytea, internal)
+RETURNS internal
+AS 'sql_saga', 'no_gaps_deserialfn'
+LANGUAGE c STRICT PARALLEL SAFE;
 
 CREATE OR REPLACE FUNCTION sql_saga.no_gaps_finalfn(internal, anyrange, anyrange)
 RETURNS boolean
 AS 'sql_saga', 'no_gaps_finalfn'
+LANGUAGE c PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION sql_saga.completely_covers_transfn(internal, anyrange, anyrange)
+RETURNS internal
+AS 'sql_saga', 'completely_covers_transfn'
+LANGUAGE c PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION sql_saga.completely_covers_finalfn(internal, anyrange, anyrange)
+RETURNS boolean
+AS 'sql_saga', 'completely_covers_finalfn'
+LANGUAGE c PARALLEL SAFE;
+
+/*
+ * The C functions keep a backend-local cache of our catalogs.  Any change to
+ * them has to tell every backend to throw it away.
+ */
+CREATE FUNCTION sql_saga._invalidate_cache()
+RETURNS trigger
+AS 'sql_saga', 'invalidate_cache'
 LANGUAGE c;
 
+CREATE TRIGGER invalidate_cache AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON sql_saga.era
+    FOR EACH STATEMENT EXECUTE PROCEDURE sql_saga._invalidate_cache();
+CREATE TRIGGER invalidate_cache AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON sql_saga.unique_keys
+    FOR EACH STATEMENT EXECUTE PROCEDURE sql_saga._invalidate_cache();
+CREATE TRIGGER invalidate_cache AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON sql_saga.foreign_keys
+    FOR EACH STATEMENT EXECUTE PROCEDURE sql_saga._invalidate_cache();
+CREATE TRIGGER invalidate_cache AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON sql_saga.api_view
+    FOR EACH STATEMENT EXECUTE PROCEDURE sql_saga._invalidate_cache();
+CREATE TRIGGER invalidate_cache AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON sql_saga.current_view
+    FOR EACH STATEMENT EXECUTE PROCEDURE sql_saga._invalidate_cache();
+
+/*
+ * Cached lookups for the plpgsql functions.  They return no rows if the
+ * object doesn't exist.
+ */
+CREATE FUNCTION sql_saga._foreign_key_info(foreign_key_name name)
+RETURNS TABLE (fk_table_oid oid,
+               fk_schema_name name,
+               fk_table_name name,
+               fk_column_names name[],
+               fk_era_name name,
+               fk_start_column_name name,
+               fk_end_column_name name,
+               uk_table_oid oid,
+               uk_schema_name name,
+               uk_table_name name,
+               uk_column_names name[],
+               uk_era_name name,
+               uk_start_column_name name,
+               uk_end_column_name name,
+               match_type text,
+               update_action text,
+               delete_action text,
+               unique_key_name name,
+               range_type regtype)
+AS 'sql_saga', 'foreign_key_info'
+LANGUAGE c STABLE STRICT;
+
 /*
  * no_gaps(period anyrange, target anyrange) -
  * Returns true if the fixed arg `target`
  * is completely covered by the sum of the `period` values.
+ * The periods can come in any order, so the aggregate can run in parallel.
  */
 CREATE AGGREGATE sql_saga.no_gaps(anyrange, anyrange) (
   sfunc = sql_saga.no_gaps_transfn,
   stype = internal,
   finalfunc = sql_saga.no_gaps_finalfn,
+  finalfunc_extra,
+  combinefunc = sql_saga.no_gaps_combinefn,
+  serialfunc = sql_saga.no_gaps_serialfn,
+  deserialfunc = sql_saga.no_gaps_deserialfn,
+  parallel = safe
+);
+
+/*
+ * completely_covers(period anyrange, target anyrange) -
+ * Returns true if the fixed arg `target`
+ * is completely covered by the sum of the `period` values.
+ * The periods must come sorted, as in completely_covers(p, t ORDER BY p),
+ * which lets it stop at the first gap and keep no more than one bound.
+ */
+CREATE AGGREGATE sql_saga.completely_covers(anyrange, anyrange) (
+  sfunc = sql_saga.completely_covers_transfn,
+  stype = internal,
+  finalfunc = sql_saga.completely_covers_finalfn,
   finalfunc_extra
 );
 
+/*
+ * no_gaps_lookup(table_name regclass, column_names name[], key_values text[], target anyrange, era_name name) -
+ * Returns true if the rows of the era with the given key completely cover
+ * `target`, like no_gaps() over those rows would.  It reads the rows in order
+ * and stops at the first gap or as soon as `target` is covered, so only as
+ * much of a long history is read as is needed for the answer.
+ */
+CREATE FUNCTION sql_saga.no_gaps_lookup(table_name regclass, column_names name[], key_values text[], target anyrange, era_name name DEFAULT 'valid')
+RETURNS boolean
+AS 'sql_saga', 'no_gaps_lookup'
+LANGUAGE c STABLE STRICT;
+
+/*
+ * as_of_join(fact_table regclass, fact_key_columns name[], fact_time_column name, dimension_table regclass, dimension_key name) -
+ * Returns (fact, dimension) for every row of `fact_table` and the row of
+ * `dimension_table` with the same key whose era contains the fact's time.
+ * Both tables are read in key and time order and matched in one pass.
+ * The key is the first unique key of the dimension unless one is given.
+ * Call it with the row types of both tables as the column definition list.
+ */
+CREATE FUNCTION sql_saga.as_of_join(fact_table regclass, fact_key_columns name[], fact_time_column name, dimension_table regclass, dimension_key name DEFAULT NULL)
+RETURNS SETOF record
+AS 'sql_saga', 'as_of_join'
+LANGUAGE c STABLE;
+
 
 
 /*
@@ -287,16 +424,7 @@ BEGIN
     FROM pg_catalog.pg_class AS c
     WHERE c.oid = table_name;
 
-    IF kind <> 'r' THEN
-        /*
-         * The main reason partitioned tables aren't supported yet is simply
-         * because I haven't put any thought into it.
-         * Maybe it's trivial, maybe not.
-         */
-        IF kind = 'p' THEN
-            RAISE EXCEPTION 'partitioned tables are not supported yet';
-        END IF;
-
+    IF kind NOT IN ('r', 'p') THEN
         RAISE EXCEPTION 'relation % is not a table', $1;
     END IF;
 
@@ -350,6 +478,24 @@ BEGIN
         RAISE EXCEPTION 'system columns cannot be used in an era';
     END IF;
 
+    /*
+     * A partitioned table must be partitioned by range on the start column.
+     * That lets the unique constraints of its keys include the partition key,
+     * and searches for a portion of the era skip the partitions that start
+     * after it.
+     */
+    IF kind = 'p' THEN
+        IF NOT EXISTS (
+            SELECT FROM pg_catalog.pg_partitioned_table AS pt
+            WHERE pt.partrelid = table_name
+              AND pt.partstrat = 'r'
+              AND pt.partnatts = 1
+              AND pt.partattrs[0] = start_attnum)
+        THEN
+            RAISE EXCEPTION 'partitioned table "%" must be partitioned by range on column "%"', table_name, start_column_name;
+        END IF;
+    END IF;
+
     /* Get end column information */
     SELECT a.attnum, a.atttypid, a.attcollation, a.attnotnull
     INTO end_attnum, end_type, end_collation, end_notnull
@@ -748,7 +894,7 @@ BEGIN
 END;
 $function$;
 
-CREATE FUNCTION sql_saga.add_api(table_name regclass DEFAULT NULL, era_name name DEFAULT 'valid')
+CREATE FUNCTION sql_saga.add_api(table_name regclass DEFAULT NULL, era_name name DEFAULT 'valid', current_view boolean DEFAULT false)
  RETURNS boolean
  LANGUAGE plpgsql
  SECURITY DEFINER
@@ -811,6 +957,10 @@ BEGIN
             trigger_name, r.schema_name, view_name);
         INSERT INTO sql_saga.api_view (table_name, era_name, view_name, trigger_name)
             VALUES (format('%I.%I', r.schema_name, r.table_name), r.era_name, format('%I.%I', r.schema_name, view_name), trigger_name);
+
+        IF current_view THEN
+            PERFORM sql_saga.add_current_view(format('%I.%I', r.schema_name, r.table_name), r.era_name);
+        END IF;
     END LOOP;
 
     RETURN true;
@@ -826,6 +976,7 @@ $function$
 #variable_conflict use_variable
 DECLARE
     view_name regclass;
+    index_name regclass;
     trigger_name name;
 BEGIN
     /*
@@ -854,231 +1005,716 @@ BEGIN
         EXECUTE format('DROP VIEW %s %s', view_name, drop_behavior);
     END LOOP;
 
+    /* The current views go with the API */
+    FOR view_name, index_name IN
+        DELETE FROM sql_saga.current_view AS cv
+        WHERE (table_name IS NULL OR cv.table_name = table_name)
+          AND (era_name IS NULL OR cv.era_name = era_name)
+        RETURNING cv.view_name, cv.index_name
+    LOOP
+        EXECUTE format('DROP VIEW %s %s', view_name, drop_behavior);
+        EXECUTE format('DROP INDEX %s', index_name);
+    END LOOP;
+
     RETURN true;
 END;
 $function$;
 
-CREATE FUNCTION sql_saga.update_portion_of()
- RETURNS trigger
+/*
+ * add_current_view() makes a view of the rows of an era that end at infinity,
+ * and a partial index on the key for just those rows.  The key is the first
+ * unique key of the era, or else the primary key without the era columns.
+ */
+CREATE FUNCTION sql_saga.add_current_view(table_name regclass, era_name name DEFAULT 'valid')
+ RETURNS boolean
+ LANGUAGE plpgsql
+ SECURITY DEFINER
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    schema_name name;
+    bare_table_name name;
+    table_owner regrole;
+    start_column name;
+    end_column name;
+    end_type text;
+    key_columns name[];
+    view_name name;
+    index_name name;
+BEGIN
+    IF table_name IS NULL THEN
+        RAISE EXCEPTION 'no table name specified';
+    END IF;
+
+    /* Always serialize operations on our catalogs */
+    PERFORM sql_saga._serialize(table_name);
+
+    SELECT n.nspname, c.relname, c.relowner::regrole, e.start_column_name, e.end_column_name,
+           format_type(a.atttypid, a.atttypmod)
+    INTO schema_name, bare_table_name, table_owner, start_column, end_column, end_type
+    FROM sql_saga.era AS e
+    JOIN pg_catalog.pg_class AS c ON c.oid = e.table_name
+    JOIN pg_catalog.pg_namespace AS n ON n.oid = c.relnamespace
+    JOIN pg_catalog.pg_attribute AS a ON (a.attrelid, a.attname) = (e.table_name, e.end_column_name)
+    WHERE (e.table_name, e.era_name) = (table_name, era_name);
+
+    IF NOT FOUND THEN
+        RAISE EXCEPTION 'era "%" does not exist on table "%"', era_name, table_name;
+    END IF;
+
+    IF EXISTS (
+        SELECT FROM sql_saga.current_view AS cv
+        WHERE (cv.table_name, cv.era_name) = (table_name, era_name))
+    THEN
+        RETURN false;
+    END IF;
+
+    /* Only types with an infinity can tell us which rows are current */
+    BEGIN
+        EXECUTE format('SELECT %L::%s', 'infinity', end_type);
+    EXCEPTION WHEN data_exception THEN
+        RAISE EXCEPTION 'era "%" on table "%" can not have a current view because type % has no infinity',
+            era_name, table_name, end_type;
+    END;
+
+    SELECT uk.column_names
+    INTO key_columns
+    FROM sql_saga.unique_keys AS uk
+    WHERE (uk.table_name, uk.era_name) = (table_name, era_name)
+    ORDER BY uk.key_name
+    LIMIT 1;
+
+    IF NOT FOUND THEN
+        SELECT array_agg(a.attname ORDER BY k.ordinality)
+        INTO key_columns
+        FROM pg_catalog.pg_constraint AS c
+        CROSS JOIN LATERAL unnest(c.conkey) WITH ORDINALITY AS k (attnum, ordinality)
+        JOIN pg_catalog.pg_attribute AS a ON (a.attrelid, a.attnum) = (c.conrelid, k.attnum)
+        WHERE (c.conrelid, c.contype) = (table_name, 'p')
+          AND a.attname NOT IN (start_column, end_column);
+    END IF;
+
+    IF key_columns IS NULL THEN
+        RAISE EXCEPTION 'table "%" needs a unique key or a primary key for a current view', table_name;
+    END IF;
+
+    view_name := sql_saga._make_name(ARRAY[bare_table_name], 'current_' || era_name, '__');
+    index_name := sql_saga._make_name(ARRAY[bare_table_name, era_name], 'current_idx');
+
+    EXECUTE format('CREATE INDEX %I ON %s (%s) WHERE %I = %L',
+        index_name, table_name,
+        (SELECT string_agg(quote_ident(u.column_name), ', ' ORDER BY u.ordinality)
+         FROM unnest(key_columns) WITH ORDINALITY AS u (column_name, ordinality)),
+        end_column, 'infinity');
+    EXECUTE format('CREATE VIEW %1$I.%2$I AS SELECT * FROM %3$s WHERE %4$I = %5$L',
+        schema_name, view_name, table_name, end_column, 'infinity');
+    EXECUTE format('ALTER VIEW %1$I.%2$I OWNER TO %3$s', schema_name, view_name, table_owner);
+
+    INSERT INTO sql_saga.current_view (table_name, era_name, view_name, index_name)
+        VALUES (table_name, era_name, format('%I.%I', schema_name, view_name), format('%I.%I', schema_name, index_name));
+
+    RETURN true;
+END;
+$function$;
+
+CREATE FUNCTION sql_saga.drop_current_view(table_name regclass, era_name name DEFAULT 'valid', drop_behavior sql_saga.drop_behavior DEFAULT 'RESTRICT')
+ RETURNS boolean
  LANGUAGE plpgsql
+ SECURITY DEFINER
 AS
 $function$
 #variable_conflict use_variable
 DECLARE
-    info record;
-    test boolean;
-    generated_columns_sql text;
-    generated_columns text[];
+    view_name regclass;
+    index_name regclass;
+BEGIN
+    IF table_name IS NULL THEN
+        RAISE EXCEPTION 'no table name specified';
+    END IF;
+
+    /* Always serialize operations on our catalogs */
+    PERFORM sql_saga._serialize(table_name);
+
+    DELETE FROM sql_saga.current_view AS cv
+    WHERE (cv.table_name, cv.era_name) = (table_name, era_name)
+    RETURNING cv.view_name, cv.index_name
+    INTO view_name, index_name;
+
+    IF NOT FOUND THEN
+        RETURN false;
+    END IF;
 
-    jnew jsonb;
-    fromval jsonb;
-    toval jsonb;
+    EXECUTE format('DROP VIEW %s %s', view_name, drop_behavior);
+    EXECUTE format('DROP INDEX %s', index_name);
 
-    jold jsonb;
-    bstartval jsonb;
-    bendval jsonb;
+    RETURN true;
+END;
+$function$;
 
-    pre_row jsonb;
-    new_row jsonb;
-    post_row jsonb;
-    pre_assigned boolean;
-    post_assigned boolean;
+/*
+ * update_portion_of() is the INSTEAD OF UPDATE trigger on the views made by
+ * add_api().  The start and end of the new row say which portion of the old
+ * row gets the update, and the parts of the old row outside of that portion
+ * are inserted as new rows.  Generated columns, primary key columns and
+ * SYSTEM_TIME columns are left out of those.
+ */
+CREATE FUNCTION sql_saga.update_portion_of()
+RETURNS trigger
+AS 'sql_saga', 'update_portion_of'
+LANGUAGE c;
 
+/*
+ * The columns that new pieces of a row can not copy from the old one, for
+ * apply_portion_of(), coalesce_era() and the FOR PORTION OF views alike.
+ * SQL:2016 15.13 GR 10)b)i) removes the generated columns.  Columns that own
+ * a sequence are a form of generated column, but columns that default to
+ * nextval() without owning the sequence are not.  Columns belonging to a
+ * SYSTEM_TIME period are also removed, and beyond what the standard calls
+ * for, so are the columns of the primary key.
+ */
+CREATE FUNCTION sql_saga._portion_of_excluded_columns(table_name regclass)
+ RETURNS name[]
+ LANGUAGE plpgsql
+ STABLE
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
     SERVER_VERSION CONSTANT integer := current_setting('server_version_num')::integer;
 
-    TEST_SQL CONSTANT text :=
-        'VALUES (CAST(%2$L AS %1$s) < CAST(%3$L AS %1$s) AND '
-        '        CAST(%3$L AS %1$s) < CAST(%4$L AS %1$s))';
-
-    GENERATED_COLUMNS_SQL_PRE_10 CONSTANT text :=
-        'SELECT array_agg(a.attname) '
-        'FROM pg_catalog.pg_attribute AS a '
-        'WHERE a.attrelid = $1 '
-        '  AND a.attnum > 0 '
-        '  AND NOT a.attisdropped '
-        '  AND (pg_catalog.pg_get_serial_sequence(a.attrelid::regclass::text, a.attname) IS NOT NULL '
-        '    OR EXISTS (SELECT FROM pg_catalog.pg_constraint AS _c '
-        '               WHERE _c.conrelid = a.attrelid '
-        '                 AND _c.contype = ''p'' '
-        '                 AND _c.conkey @> ARRAY[a.attnum]) '
-        '    OR EXISTS (SELECT FROM sql_saga.era AS _p '
-        '               WHERE (_p.table_name, _p.era_name) = (a.attrelid, ''system_time'') '
-        '                 AND a.attname IN (_p.start_column_name, _p.end_column_name)))';
-
-    GENERATED_COLUMNS_SQL_PRE_12 CONSTANT text :=
-        'SELECT array_agg(a.attname) '
-        'FROM pg_catalog.pg_attribute AS a '
-        'WHERE a.attrelid = $1 '
-        '  AND a.attnum > 0 '
-        '  AND NOT a.attisdropped '
-        '  AND (pg_catalog.pg_get_serial_sequence(a.attrelid::regclass::text, a.attname) IS NOT NULL '
-        '    OR a.attidentity <> '''' '
-        '    OR EXISTS (SELECT FROM pg_catalog.pg_constraint AS _c '
-        '               WHERE _c.conrelid = a.attrelid '
-        '                 AND _c.contype = ''p'' '
-        '                 AND _c.conkey @> ARRAY[a.attnum]) '
-        '    OR EXISTS (SELECT FROM sql_saga.era AS _p '
-        '               WHERE (_p.table_name, _p.era_name) = (a.attrelid, ''system_time'') '
-        '                 AND a.attname IN (_p.start_column_name, _p.end_column_name)))';
-
-    GENERATED_COLUMNS_SQL_CURRENT CONSTANT text :=
-        'SELECT array_agg(a.attname) '
-        'FROM pg_catalog.pg_attribute AS a '
-        'WHERE a.attrelid = $1 '
-        '  AND a.attnum > 0 '
-        '  AND NOT a.attisdropped '
-        '  AND (pg_catalog.pg_get_serial_sequence(a.attrelid::regclass::text, a.attname) IS NOT NULL '
-        '    OR a.attidentity <> '''' '
-        '    OR a.attgenerated <> '''' '
-        '    OR EXISTS (SELECT FROM pg_catalog.pg_constraint AS _c '
-        '               WHERE _c.conrelid = a.attrelid '
-        '                 AND _c.contype = ''p'' '
-        '                 AND _c.conkey @> ARRAY[a.attnum]) '
-        '    OR EXISTS (SELECT FROM sql_saga.era AS _p '
-        '               WHERE (_p.table_name, _p.era_name) = (a.attrelid, ''system_time'') '
-        '                 AND a.attname IN (_p.start_column_name, _p.end_column_name)))';
+    excluded_sql text;
+    excluded_columns name[];
+BEGIN
+    excluded_sql := 'SELECT array_agg(a.attname) '
+                    'FROM pg_catalog.pg_attribute AS a '
+                    'WHERE a.attrelid = $1 '
+                    '  AND a.attnum > 0 '
+                    '  AND NOT a.attisdropped '
+                    '  AND (pg_catalog.pg_get_serial_sequence(a.attrelid::regclass::text, a.attname) IS NOT NULL ';
+    IF SERVER_VERSION >= 100000 THEN
+        excluded_sql := excluded_sql || '    OR a.attidentity <> '''' ';
+    END IF;
+    IF SERVER_VERSION >= 120000 THEN
+        excluded_sql := excluded_sql || '    OR a.attgenerated <> '''' ';
+    END IF;
+    excluded_sql := excluded_sql ||
+                    '    OR EXISTS (SELECT FROM pg_catalog.pg_constraint AS _c '
+                    '               WHERE _c.conrelid = a.attrelid '
+                    '                 AND _c.contype = ''p'' '
+                    '                 AND _c.conkey @> ARRAY[a.attnum]) '
+                    '    OR EXISTS (SELECT FROM sql_saga.era AS _p '
+                    '               WHERE (_p.table_name, _p.era_name) = (a.attrelid, ''system_time'') '
+                    '                 AND a.attname IN (_p.start_column_name, _p.end_column_name)))';
+    EXECUTE excluded_sql INTO excluded_columns USING table_name;
+
+    RETURN excluded_columns;
+END;
+$function$;
+
+/*
+ * The sql_saga constraints that writing to the table can fire, as a list for
+ * SET CONSTRAINTS: its unique keys, the foreign keys from it, and the
+ * foreign keys to its unique keys.  Constraints that are already initially
+ * deferred are left alone.
+ */
+CREATE FUNCTION sql_saga._portion_of_constraints(table_name regclass)
+ RETURNS text
+ LANGUAGE sql
+ STABLE
+AS
+$function$
+    SELECT string_agg(format('%I.%I', n.nspname, c.conname), ', ')
+    FROM pg_catalog.pg_constraint AS c
+    JOIN pg_catalog.pg_namespace AS n ON n.oid = c.connamespace
+    WHERE c.conrelid = _portion_of_constraints.table_name
+      AND c.condeferrable
+      AND NOT c.condeferred
+      AND c.conname IN (
+            SELECT unnest(ARRAY[uk.unique_constraint, uk.exclude_constraint])
+            FROM sql_saga.unique_keys AS uk
+            WHERE uk.table_name = _portion_of_constraints.table_name
+            UNION ALL
+            SELECT unnest(ARRAY[fk.fk_insert_trigger, fk.fk_update_trigger])
+            FROM sql_saga.foreign_keys AS fk
+            WHERE fk.table_name = _portion_of_constraints.table_name
+            UNION ALL
+            SELECT unnest(ARRAY[fk.uk_update_trigger, fk.uk_delete_trigger])
+            FROM sql_saga.foreign_keys AS fk
+            JOIN sql_saga.unique_keys AS uk ON uk.key_name = fk.unique_key
+            WHERE uk.table_name = _portion_of_constraints.table_name);
+$function$;
+
+/*
+ * apply_portion_of() applies a whole table of changes the way update_portion_of()
+ * applies one.  Each source row holds a key, a portion of the era and values for
+ * the other columns it has; the overlapping target rows are split with one
+ * INSERT ... SELECT and one UPDATE ... FROM.  The unique keys and foreign keys
+ * of the target are deferred meanwhile, so they are only validated once, when
+ * it is done.  With
+ * coalesce_versions, the rows of the changed keys are then merged with their
+ * equal neighbours like coalesce_era() does.
+ */
+CREATE FUNCTION sql_saga.apply_portion_of(target_table regclass, source_table regclass, era_name name DEFAULT 'valid', key_columns name[] DEFAULT NULL, coalesce_versions boolean DEFAULT false)
+ RETURNS bigint
+ LANGUAGE plpgsql
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    SERVER_VERSION CONSTANT integer := current_setting('server_version_num')::integer;
 
+    start_column name;
+    end_column name;
+    missing_column name;
+    payload_columns name[];
+    excluded_columns name[];
+    deferred_constraints text;
+    key_list text;
+    key_match text;
+    insert_list text;
+    select_list text;
+    set_list text;
+    overlapping boolean;
+    rows_written bigint;
+    total bigint := 0;
 BEGIN
+    IF target_table IS NULL OR source_table IS NULL THEN
+        RAISE EXCEPTION 'no table name specified';
+    END IF;
+
+    SELECT e.start_column_name, e.end_column_name
+    INTO start_column, end_column
+    FROM sql_saga.era AS e
+    WHERE (e.table_name, e.era_name) = (target_table, era_name);
+
+    IF NOT FOUND THEN
+        RAISE EXCEPTION 'era "%" does not exist on table "%"', era_name, target_table;
+    END IF;
+
+    /* Default to the columns of the first unique key on this era */
+    IF key_columns IS NULL THEN
+        SELECT uk.column_names
+        INTO key_columns
+        FROM sql_saga.unique_keys AS uk
+        WHERE (uk.table_name, uk.era_name) = (target_table, era_name)
+        ORDER BY uk.key_name
+        LIMIT 1;
+
+        IF NOT FOUND THEN
+            RAISE EXCEPTION 'table "%" has no unique key on era "%"', target_table, era_name;
+        END IF;
+    END IF;
+
+    /* The source needs the key and the era columns */
+    SELECT u.column_name
+    INTO missing_column
+    FROM unnest(key_columns || ARRAY[start_column, end_column]) AS u (column_name)
+    WHERE NOT EXISTS (
+        SELECT FROM pg_catalog.pg_attribute AS a
+        WHERE (a.attrelid, a.attname) = (source_table, u.column_name)
+          AND a.attnum > 0
+          AND NOT a.attisdropped)
+    LIMIT 1;
+
+    IF FOUND THEN
+        RAISE EXCEPTION 'column "%" not found in table "%"', missing_column, source_table;
+    END IF;
+
+    /* Everything else in the source is payload, which the target must have */
+    SELECT a.attname
+    INTO missing_column
+    FROM pg_catalog.pg_attribute AS a
+    WHERE a.attrelid = source_table
+      AND a.attnum > 0
+      AND NOT a.attisdropped
+      AND NOT EXISTS (
+        SELECT FROM pg_catalog.pg_attribute AS ta
+        WHERE (ta.attrelid, ta.attname) = (target_table, a.attname)
+          AND ta.attnum > 0
+          AND NOT ta.attisdropped)
+    ORDER BY a.attnum
+    LIMIT 1;
+
+    IF FOUND THEN
+        RAISE EXCEPTION 'column "%" not found in table "%"', missing_column, target_table;
+    END IF;
+
+    SELECT array_agg(a.attname ORDER BY a.attnum)
+    INTO payload_columns
+    FROM pg_catalog.pg_attribute AS a
+    WHERE a.attrelid = source_table
+      AND a.attnum > 0
+      AND NOT a.attisdropped
+      AND a.attname <> ALL (key_columns || ARRAY[start_column, end_column]);
+
+    IF payload_columns IS NULL THEN
+        RAISE EXCEPTION 'table "%" has no columns to apply', source_table;
+    END IF;
+
+    SELECT string_agg(quote_ident(u.column_name), ', ' ORDER BY u.ordinality),
+           string_agg(format('t.%1$I = s.%1$I', u.column_name), ' AND ' ORDER BY u.ordinality)
+    INTO key_list, key_match
+    FROM unnest(key_columns) WITH ORDINALITY AS u (column_name, ordinality);
+
+    /* Two changes to the same portion of the same key would be ambiguous */
+    EXECUTE format(
+        'SELECT EXISTS ( '
+        '  SELECT FROM ( '
+        '    SELECT %3$I AS portion_start, lag(%4$I) OVER (PARTITION BY %2$s ORDER BY %3$I) AS previous_end '
+        '    FROM %1$s) AS s '
+        '  WHERE s.previous_end > s.portion_start)',
+        source_table, key_list, start_column, end_column)
+    INTO overlapping;
+
+    IF overlapping THEN
+        RAISE EXCEPTION 'table "%" has overlapping changes for the same key', source_table;
+    END IF;
+
     /*
-     * REFERENCES:
-     *     SQL:2016 15.13 GR 10
+     * Like update_portion_of(), leave generated columns, primary key columns
+     * and SYSTEM_TIME columns out of the rows we insert, except that the key
+     * and the era columns are always copied so the pieces stay the same entity.
      */
+    excluded_columns := sql_saga._portion_of_excluded_columns(target_table);
+
+    SELECT string_agg(quote_ident(a.attname), ', ' ORDER BY a.attnum),
+           string_agg(CASE a.attname
+                        WHEN start_column THEN 'p.portion_start'
+                        WHEN end_column THEN 'p.portion_end'
+                        ELSE CASE WHEN a.attname = ANY (payload_columns)
+                                  THEN format('CASE WHEN p.source_tid IS NULL THEN t.%1$I ELSE s.%1$I END', a.attname)
+                                  ELSE format('t.%I', a.attname)
+                             END
+                      END, ', ' ORDER BY a.attnum)
+    INTO insert_list, select_list
+    FROM pg_catalog.pg_attribute AS a
+    WHERE a.attrelid = target_table
+      AND a.attnum > 0
+      AND NOT a.attisdropped
+      AND (a.attname <> ALL (coalesce(excluded_columns, '{}'))
+           OR a.attname = ANY (key_columns || ARRAY[start_column, end_column]));
 
-    /* Get the table information from this view */
-    SELECT p.table_name, p.era_name,
-           p.start_column_name, p.end_column_name,
-           format_type(a.atttypid, a.atttypmod) AS datatype
-    INTO info
-    FROM sql_saga.api_view AS fpv
-    JOIN sql_saga.era AS p ON (p.table_name, p.era_name) = (fpv.table_name, fpv.era_name)
-    JOIN pg_catalog.pg_attribute AS a ON (a.attrelid, a.attname) = (p.table_name, p.start_column_name)
-    WHERE fpv.view_name = TG_RELID;
+    SELECT string_agg(format('%1$I = s.%1$I', u.column_name), ', ')
+    INTO set_list
+    FROM unnest(payload_columns) AS u (column_name);
 
-    IF NOT FOUND THEN
-        RAISE EXCEPTION 'table and era information not found for view "%"', TG_RELID::regclass;
+    /*
+     * Check our constraints once, after everything has been written.  Only
+     * the ones on the target are deferred, and only until we are done, so
+     * the rest of the caller's transaction is checked as usual.
+     */
+    deferred_constraints := sql_saga._portion_of_constraints(target_table);
+    IF deferred_constraints IS NOT NULL THEN
+        EXECUTE format('SET CONSTRAINTS %s DEFERRED', deferred_constraints);
+    END IF;
+
+    /*
+     * Cut every target row overlapped by the source at all the bounds of the
+     * changes that touch it.  The first changed portion of each target row
+     * keeps that row, and the other portions become new rows.  Rows are found
+     * again by tableoid and ctid, since a ctid is only unique within one
+     * partition.
+     */
+    EXECUTE format(
+        'CREATE TEMPORARY TABLE sql_saga_apply_portion_of ON COMMIT DROP AS '
+        'WITH pairs AS ( '
+        '    SELECT t.tableoid AS target_relid, t.ctid AS target_tid, '
+        '           s.tableoid AS source_relid, s.ctid AS source_tid, '
+        '           t.%3$I AS target_start, t.%4$I AS target_end, '
+        '           greatest(t.%3$I, s.%3$I) AS portion_start, '
+        '           least(t.%4$I, s.%4$I) AS portion_end '
+        '    FROM %1$s AS t '
+        '    JOIN %2$s AS s ON %5$s AND t.%3$I < s.%4$I AND s.%3$I < t.%4$I '
+        '), bounds AS ( '
+        '    SELECT target_relid, target_tid, target_start AS bound FROM pairs '
+        '    UNION SELECT target_relid, target_tid, target_end FROM pairs '
+        '    UNION SELECT target_relid, target_tid, portion_start FROM pairs '
+        '    UNION SELECT target_relid, target_tid, portion_end FROM pairs '
+        '), portions AS ( '
+        '    SELECT target_relid, target_tid, bound AS portion_start, '
+        '           lead(bound) OVER (PARTITION BY target_relid, target_tid ORDER BY bound) AS portion_end '
+        '    FROM bounds '
+        ') '
+        'SELECT p.target_relid, p.target_tid, pr.source_relid, pr.source_tid, p.portion_start, p.portion_end, '
+        '       row_number() OVER (PARTITION BY p.target_relid, p.target_tid ORDER BY pr.source_tid IS NULL, p.portion_start) = 1 AS kept '
+        'FROM portions AS p '
+        'LEFT JOIN pairs AS pr ON (pr.target_relid, pr.target_tid, pr.portion_start) = (p.target_relid, p.target_tid, p.portion_start) '
+        'WHERE p.portion_end IS NOT NULL',
+        target_table, source_table, start_column, end_column, key_match);
+
+    /* The new rows read the old ones, so they go in before the update */
+    EXECUTE format(
+        'INSERT INTO %1$s (%3$s) %5$s'
+        'SELECT %4$s '
+        'FROM pg_temp.sql_saga_apply_portion_of AS p '
+        'JOIN %1$s AS t ON (t.tableoid, t.ctid) = (p.target_relid, p.target_tid) '
+        'LEFT JOIN %2$s AS s ON (s.tableoid, s.ctid) = (p.source_relid, p.source_tid) '
+        'WHERE NOT p.kept',
+        target_table, source_table, insert_list, select_list,
+        CASE WHEN SERVER_VERSION >= 100000 THEN 'OVERRIDING SYSTEM VALUE ' ELSE '' END);
+    GET DIAGNOSTICS rows_written = ROW_COUNT;
+    total := total + rows_written;
+
+    EXECUTE format(
+        'UPDATE %1$s AS t '
+        'SET %3$I = p.portion_start, %4$I = p.portion_end, %5$s '
+        'FROM pg_temp.sql_saga_apply_portion_of AS p '
+        'JOIN %2$s AS s ON (s.tableoid, s.ctid) = (p.source_relid, p.source_tid) '
+        'WHERE (t.tableoid, t.ctid) = (p.target_relid, p.target_tid) '
+        '  AND p.kept',
+        target_table, source_table, start_column, end_column, set_list);
+    GET DIAGNOSTICS rows_written = ROW_COUNT;
+    total := total + rows_written;
+
+    DROP TABLE pg_temp.sql_saga_apply_portion_of;
+
+    IF deferred_constraints IS NOT NULL THEN
+        EXECUTE format('SET CONSTRAINTS %s IMMEDIATE', deferred_constraints);
+    END IF;
+
+    IF coalesce_versions THEN
+        PERFORM sql_saga._coalesce_era(target_table, era_name, key_columns, 10000, source_table);
     END IF;
 
-    jnew := to_jsonb(NEW);
-    fromval := jnew->info.start_column_name;
-    toval := jnew->info.end_column_name;
+    RETURN total;
+END;
+$function$;
 
-    jold := to_jsonb(OLD);
-    bstartval := jold->info.start_column_name;
-    bendval := jold->info.end_column_name;
+CREATE FUNCTION sql_saga._coalesce_era(table_name regclass, era_name name, key_columns name[], batch_size integer, key_source regclass)
+ RETURNS bigint
+ LANGUAGE plpgsql
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    start_column name;
+    end_column name;
+    excluded_columns name[];
+    deferred_constraints text;
+    key_list text;
+    key_not_null text;
+    key_filter text := '';
+    payload text;
+    run_count bigint;
+    batch_start bigint := 0;
+    rows_deleted bigint;
+    total bigint := 0;
+BEGIN
+    IF table_name IS NULL THEN
+        RAISE EXCEPTION 'no table name specified';
+    END IF;
 
-    pre_row := jold;
-    new_row := jnew;
-    post_row := jold;
+    IF batch_size IS NULL OR batch_size < 1 THEN
+        RAISE EXCEPTION 'batch size must be positive';
+    END IF;
 
-    /* Reset the period columns */
-    new_row := jsonb_set(new_row, ARRAY[info.start_column_name], bstartval);
-    new_row := jsonb_set(new_row, ARRAY[info.end_column_name], bendval);
+    SELECT e.start_column_name, e.end_column_name
+    INTO start_column, end_column
+    FROM sql_saga.era AS e
+    WHERE (e.table_name, e.era_name) = (table_name, era_name);
 
-    /* If the period is the only thing changed, do nothing */
-    IF new_row = jold THEN
-        RETURN NULL;
+    IF NOT FOUND THEN
+        RAISE EXCEPTION 'era "%" does not exist on table "%"', era_name, table_name;
     END IF;
 
-    pre_assigned := false;
-    EXECUTE format(TEST_SQL, info.datatype, bstartval, fromval, bendval) INTO test;
-    IF test THEN
-        pre_assigned := true;
-        pre_row := jsonb_set(pre_row, ARRAY[info.end_column_name], fromval);
-        new_row := jsonb_set(new_row, ARRAY[info.start_column_name], fromval);
+    /* Default to the columns of the first unique key on this era */
+    IF key_columns IS NULL THEN
+        SELECT uk.column_names
+        INTO key_columns
+        FROM sql_saga.unique_keys AS uk
+        WHERE (uk.table_name, uk.era_name) = (table_name, era_name)
+        ORDER BY uk.key_name
+        LIMIT 1;
+
+        IF NOT FOUND THEN
+            RAISE EXCEPTION 'table "%" has no unique key on era "%"', table_name, era_name;
+        END IF;
     END IF;
 
-    post_assigned := false;
-    EXECUTE format(TEST_SQL, info.datatype, bstartval, toval, bendval) INTO test;
-    IF test THEN
-        post_assigned := true;
-        new_row := jsonb_set(new_row, ARRAY[info.end_column_name], toval::jsonb);
-        post_row := jsonb_set(post_row, ARRAY[info.start_column_name], toval::jsonb);
+    SELECT string_agg(format('t.%I', u.column_name), ', ' ORDER BY u.ordinality),
+           string_agg(format('t.%I IS NOT NULL', u.column_name), ' AND ' ORDER BY u.ordinality)
+    INTO key_list, key_not_null
+    FROM unnest(key_columns) WITH ORDINALITY AS u (column_name, ordinality);
+
+    IF key_source IS NOT NULL THEN
+        SELECT format(' AND EXISTS (SELECT FROM %s AS s WHERE %s)', key_source,
+                      string_agg(format('s.%1$I = t.%1$I', u.column_name), ' AND '))
+        INTO key_filter
+        FROM unnest(key_columns) AS u (column_name);
     END IF;
 
-    IF pre_assigned OR post_assigned THEN
-        /* Don't validate foreign keys until all this is done */
-        SET CONSTRAINTS ALL DEFERRED;
+    /*
+     * Rows only merge when everything but the era matches.  Generated, primary
+     * key and SYSTEM_TIME columns are different for every row, so they are not
+     * compared and the first row of the run keeps its values.
+     */
+    excluded_columns := sql_saga._portion_of_excluded_columns(table_name);
+
+    SELECT coalesce('ROW(' || string_agg(format('t.%I', a.attname), ', ' ORDER BY a.attnum) || ')', 'NULL::boolean')
+    INTO payload
+    FROM pg_catalog.pg_attribute AS a
+    WHERE a.attrelid = table_name
+      AND a.attnum > 0
+      AND NOT a.attisdropped
+      AND a.attname <> ALL (key_columns || ARRAY[start_column, end_column])
+      AND a.attname <> ALL (coalesce(excluded_columns, '{}'));
+
+    /* Our unique keys and foreign keys only need to hold once we are done */
+    deferred_constraints := sql_saga._portion_of_constraints(table_name);
+    IF deferred_constraints IS NOT NULL THEN
+        EXECUTE format('SET CONSTRAINTS %s DEFERRED', deferred_constraints);
+    END IF;
 
+    /*
+     * Number the runs of adjacent equal rows in key order, keeping only the
+     * runs that have something to merge.
+     */
+    EXECUTE format(
+        'CREATE TEMPORARY TABLE sql_saga_coalesce_era ON COMMIT DROP AS '
+        'WITH marked AS ( '
+        '    SELECT t.tableoid AS relid, t.ctid AS tid, %2$s, t.%3$I AS run_start, t.%4$I AS run_end, '
+        '           CASE WHEN lag(t.%4$I) OVER w = t.%3$I AND lag(%5$s) OVER w IS NOT DISTINCT FROM %5$s '
+        '                THEN 0 ELSE 1 END AS starts_run '
+        '    FROM %1$s AS t '
+        '    WHERE %6$s%7$s '
+        '    WINDOW w AS (PARTITION BY %2$s ORDER BY t.%3$I) '
+        '), numbered AS ( '
+        '    SELECT m.*, sum(m.starts_run) OVER (PARTITION BY %8$s ORDER BY m.run_start) AS run '
+        '    FROM marked AS m '
+        '), runs AS ( '
+        '    SELECT n.*, '
+        '           count(*) OVER r AS run_rows, '
+        '           max(n.run_end) OVER r AS new_end, '
+        '           n.run_start = min(n.run_start) OVER r AS kept '
+        '    FROM numbered AS n '
+        '    WINDOW r AS (PARTITION BY %8$s, n.run) '
+        ') '
+        'SELECT dense_rank() OVER (ORDER BY %8$s, run) AS run_number, relid, tid, kept, new_end '
+        'FROM runs '
+        'WHERE run_rows > 1',
+        table_name, key_list, start_column, end_column, payload, key_not_null, key_filter,
+        (SELECT string_agg(quote_ident(u.column_name), ', ' ORDER BY u.ordinality)
+         FROM unnest(key_columns) WITH ORDINALITY AS u (column_name, ordinality)));
+
+    SELECT max(c.run_number) INTO run_count FROM pg_temp.sql_saga_coalesce_era AS c;
+
+    WHILE batch_start < coalesce(run_count, 0) LOOP
         /*
-         * Find and remove all generated columns from pre_row and post_row.
-         * SQL:2016 15.13 GR 10)b)i)
-         *
-         * We also remove columns that own a sequence as those are a form of
-         * generated column.  We do not, however, remove columns that default
-         * to nextval() without owning the underlying sequence.
-         *
-         * Columns belonging to a SYSTEM_TIME period are also removed.
-         *
-         * In addition to what the standard calls for, we also remove any
-         * columns belonging to primary keys.
+         * Extend the kept rows before deleting the others, so that the
+         * referenced periods stay covered at the end of every statement for
+         * the batch foreign keys, which are not deferred.
          */
-        IF SERVER_VERSION < 100000 THEN
-            generated_columns_sql := GENERATED_COLUMNS_SQL_PRE_10;
-        ELSIF SERVER_VERSION < 120000 THEN
-            generated_columns_sql := GENERATED_COLUMNS_SQL_PRE_12;
-        ELSE
-            generated_columns_sql := GENERATED_COLUMNS_SQL_CURRENT;
-        END IF;
+        EXECUTE format(
+            'UPDATE %1$s AS t '
+            'SET %2$I = c.new_end '
+            'FROM pg_temp.sql_saga_coalesce_era AS c '
+            'WHERE (t.tableoid, t.ctid) = (c.relid, c.tid) '
+            '  AND c.kept '
+            '  AND c.run_number > $1 AND c.run_number <= $2',
+            table_name, end_column)
+        USING batch_start, batch_start + batch_size;
+
+        EXECUTE format(
+            'DELETE FROM %1$s AS t '
+            'USING pg_temp.sql_saga_coalesce_era AS c '
+            'WHERE (t.tableoid, t.ctid) = (c.relid, c.tid) '
+            '  AND NOT c.kept '
+            '  AND c.run_number > $1 AND c.run_number <= $2',
+            table_name)
+        USING batch_start, batch_start + batch_size;
+        GET DIAGNOSTICS rows_deleted = ROW_COUNT;
+        total := total + rows_deleted;
+
+        batch_start := batch_start + batch_size;
+    END LOOP;
 
-        EXECUTE generated_columns_sql
-        INTO generated_columns
-        USING info.table_name;
-
-        /* There may not be any generated columns. */
-        IF generated_columns IS NOT NULL THEN
-            IF SERVER_VERSION < 100000 THEN
-                SELECT jsonb_object_agg(e.key, e.value)
-                INTO pre_row
-                FROM jsonb_each(pre_row) AS e (key, value)
-                WHERE e.key <> ALL (generated_columns);
-
-                SELECT jsonb_object_agg(e.key, e.value)
-                INTO post_row
-                FROM jsonb_each(post_row) AS e (key, value)
-                WHERE e.key <> ALL (generated_columns);
-            ELSE
-                pre_row := pre_row - generated_columns;
-                post_row := post_row - generated_columns;
-            END IF;
+    DROP TABLE pg_temp.sql_saga_coalesce_era;
+
+    IF deferred_constraints IS NOT NULL THEN
+        EXECUTE format('SET CONSTRAINTS %s IMMEDIATE', deferred_constraints);
+    END IF;
+
+    RETURN total;
+END;
+$function$;
+
+/*
+ * coalesce_era() merges the adjacent rows of a key that have the same values
+ * in all of their other columns, the way repeated portion updates leave them.
+ * The first row of each run is extended to its end and the others are
+ * deleted, in the order of the key and in batches of batch_size runs.
+ */
+CREATE FUNCTION sql_saga.coalesce_era(table_name regclass, era_name name DEFAULT 'valid', key_columns name[] DEFAULT NULL, batch_size integer DEFAULT 10000)
+ RETURNS bigint
+ LANGUAGE sql
+AS
+$function$
+    SELECT sql_saga._coalesce_era(table_name, era_name, key_columns, batch_size, NULL);
+$function$;
+
+/*
+ * covered_multirange() returns, for every value of a unique key, the key
+ * columns and the multirange that its rows cover.  Kept in a materialized
+ * view it answers coverage questions with a single @> on one row per key.
+ * The key is the first unique key of the table by name unless one is given.
+ * Multiranges need PostgreSQL 14 or later.
+ */
+CREATE FUNCTION sql_saga.covered_multirange(table_name regclass, key_name name DEFAULT NULL)
+ RETURNS SETOF record
+ LANGUAGE plpgsql
+ STABLE
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    SERVER_VERSION CONSTANT integer := current_setting('server_version_num')::integer;
+
+    unique_key_row sql_saga.unique_keys;
+    era_row sql_saga.era;
+    key_list text;
+    key_not_null text;
+BEGIN
+    IF SERVER_VERSION < 140000 THEN
+        RAISE EXCEPTION 'covered_multirange() needs PostgreSQL 14 or later';
+    END IF;
+
+    SELECT uk.*
+    INTO unique_key_row
+    FROM sql_saga.unique_keys AS uk
+    WHERE uk.table_name = table_name
+      AND (key_name IS NULL OR uk.key_name = key_name)
+    ORDER BY uk.key_name
+    LIMIT 1;
+
+    IF NOT FOUND THEN
+        IF key_name IS NULL THEN
+            RAISE EXCEPTION 'table "%" has no unique key', table_name;
         END IF;
+        RAISE EXCEPTION 'unique key "%" does not exist on table "%"', key_name, table_name;
     END IF;
 
-    IF pre_assigned THEN
-        EXECUTE format('INSERT INTO %s (%s) VALUES (%s)',
-            info.table_name,
-            (SELECT string_agg(quote_ident(key), ', ' ORDER BY key) FROM jsonb_each_text(pre_row)),
-            (SELECT string_agg(quote_nullable(value), ', ' ORDER BY key) FROM jsonb_each_text(pre_row)));
-    END IF;
-
-    EXECUTE format('UPDATE %s SET %s WHERE %s AND %I > %L AND %I < %L',
-                   info.table_name,
-                   (SELECT string_agg(format('%I = %L', j.key, j.value), ', ')
-                    FROM (SELECT key, value FROM jsonb_each_text(new_row)
-                          EXCEPT ALL
-                          SELECT key, value FROM jsonb_each_text(jold)
-                         ) AS j
-                   ),
-                   (SELECT string_agg(format('%I = %L', key, value), ' AND ')
-                    FROM pg_catalog.jsonb_each_text(jold) AS j
-                    JOIN pg_catalog.pg_attribute AS a ON a.attname = j.key
-                    JOIN pg_catalog.pg_constraint AS c ON c.conkey @> ARRAY[a.attnum]
-                    WHERE a.attrelid = info.table_name
-                      AND c.conrelid = info.table_name
-                   ),
-                   info.end_column_name,
-                   fromval,
-                   info.start_column_name,
-                   toval
-                  );
-
-    IF post_assigned THEN
-        EXECUTE format('INSERT INTO %s (%s) VALUES (%s)',
-            info.table_name,
-            (SELECT string_agg(quote_ident(key), ', ' ORDER BY key) FROM jsonb_each_text(post_row)),
-            (SELECT string_agg(quote_nullable(value), ', ' ORDER BY key) FROM jsonb_each_text(post_row)));
-    END IF;
-
-    RETURN NEW;
+    SELECT e.*
+    INTO era_row
+    FROM sql_saga.era AS e
+    WHERE (e.table_name, e.era_name) = (unique_key_row.table_name, unique_key_row.era_name);
+
+    SELECT string_agg(format('t.%I', u.column_name), ', ' ORDER BY u.ordinality),
+           string_agg(format('t.%I IS NOT NULL', u.column_name), ' AND ' ORDER BY u.ordinality)
+    INTO key_list, key_not_null
+    FROM unnest(unique_key_row.column_names) WITH ORDINALITY AS u (column_name, ordinality);
+
+    RETURN QUERY EXECUTE format(
+        'SELECT %1$s, range_agg(%2$s(t.%3$I, t.%4$I)) '
+        'FROM %5$s AS t '
+        'WHERE %6$s '
+        'GROUP BY %1$s',
+        key_list,
+        era_row.range_type,
+        era_row.start_column_name,
+        era_row.end_column_name,
+        table_name,
+        key_not_null);
 END;
 $function$;
 
@@ -1089,7 +1725,8 @@ CREATE FUNCTION sql_saga.add_unique_key(
         era_name name DEFAULT 'valid',
         key_name name DEFAULT NULL,
         unique_constraint name DEFAULT NULL,
-        exclude_constraint name DEFAULT NULL)
+        exclude_constraint name DEFAULT NULL,
+        btree boolean DEFAULT false)
  RETURNS name
  LANGUAGE plpgsql
  SECURITY DEFINER
@@ -1109,6 +1746,8 @@ DECLARE
     exclude_index regclass;
     unique_sql text;
     exclude_sql text;
+    partitioned boolean;
+    overlapping boolean;
 BEGIN
     IF table_name IS NULL THEN
         RAISE EXCEPTION 'no table name specified';
@@ -1126,6 +1765,25 @@ BEGIN
         RAISE EXCEPTION 'era "%" does not exist', era_name;
     END IF;
 
+    /*
+     * Exclusion constraints can't span the partitions of a table, so on
+     * partitioned tables a constraint trigger checks for overlaps instead.
+     * The same trigger can be asked for to avoid the cost of maintaining a
+     * GiST index.
+     */
+    partitioned := EXISTS (
+        SELECT FROM pg_catalog.pg_class AS c
+        WHERE (c.oid, c.relkind) = (table_name, 'p'));
+
+    IF partitioned AND exclude_constraint IS NOT NULL THEN
+        RAISE EXCEPTION 'partitioned table "%" can not use EXCLUDE constraint "%"', table_name, exclude_constraint;
+    END IF;
+
+    IF btree AND exclude_constraint IS NOT NULL THEN
+        RAISE EXCEPTION 'btree unique keys can not use EXCLUDE constraint "%"', exclude_constraint;
+    END IF;
+    btree := btree OR partitioned;
+
     /* For convenience, put the period's attnums in an array */
     era_attnums := ARRAY[
         (SELECT a.attnum FROM pg_catalog.pg_attribute AS a WHERE (a.attrelid, a.attname) = (era_row.table_name, era_row.start_column_name)),
@@ -1291,7 +1949,7 @@ BEGIN
         alter_cmds := alter_cmds || ('ADD ' || unique_sql);
     END IF;
 
-    IF exclude_constraint IS NULL THEN
+    IF exclude_constraint IS NULL AND NOT btree THEN
         alter_cmds := alter_cmds || ('ADD ' || exclude_sql);
     END IF;
 
@@ -1315,6 +1973,31 @@ BEGIN
         LIMIT 1;
     END IF;
 
+    IF btree THEN
+        /* Existing rows are checked once here, and new ones by the trigger */
+        EXECUTE format(
+            'SELECT EXISTS ( '
+            '  SELECT FROM %1$s AS a JOIN %1$s AS b ON %2$s '
+            '  WHERE a.%3$I < b.%4$I AND b.%3$I < a.%4$I '
+            '    AND (a.%3$I, a.%4$I) <> (b.%3$I, b.%4$I))',
+            table_name,
+            (SELECT string_agg(format('a.%1$I = b.%1$I', u.column_name), ' AND ')
+             FROM unnest(column_names) AS u (column_name)),
+            era_row.start_column_name, era_row.end_column_name)
+        INTO overlapping;
+
+        IF overlapping THEN
+            RAISE EXCEPTION 'table "%" has overlapping rows for key (%)', table_name, array_to_string(column_names, ', ');
+        END IF;
+
+        exclude_constraint := sql_saga._make_name(ARRAY[key_name], 'overlap');
+        EXECUTE format('CREATE CONSTRAINT TRIGGER %I AFTER INSERT OR UPDATE OF %s ON %s DEFERRABLE FOR EACH ROW EXECUTE PROCEDURE sql_saga.uk_overlap_check(%L)',
+            exclude_constraint,
+            (SELECT string_agg(quote_ident(u.column_name), ', ')
+             FROM unnest(column_names || era_row.start_column_name || era_row.end_column_name) AS u (column_name)),
+            table_name, key_name);
+    END IF;
+
     /* If we don't already have an exclude_constraint, it must be the one with the highest oid */
     IF exclude_constraint IS NULL THEN
         SELECT c.conname, c.conindid
@@ -1383,76 +2066,83 @@ BEGIN
             SELECT FROM pg_catalog.pg_class AS c
             WHERE c.oid = unique_key_row.table_name)
         THEN
-            EXECUTE format('ALTER TABLE %s DROP CONSTRAINT %I, DROP CONSTRAINT %I',
-                unique_key_row.table_name, unique_key_row.unique_constraint, unique_key_row.exclude_constraint);
+            /* Without an exclusion constraint the overlap check is a constraint trigger */
+            IF EXISTS (
+                SELECT FROM pg_catalog.pg_constraint AS c
+                WHERE (c.conrelid, c.conname, c.contype) = (unique_key_row.table_name, unique_key_row.exclude_constraint, 't'))
+            THEN
+                EXECUTE format('DROP TRIGGER %I ON %s', unique_key_row.exclude_constraint, unique_key_row.table_name);
+                EXECUTE format('ALTER TABLE %s DROP CONSTRAINT %I',
+                    unique_key_row.table_name, unique_key_row.unique_constraint);
+            ELSE
+                EXECUTE format('ALTER TABLE %s DROP CONSTRAINT %I, DROP CONSTRAINT %I',
+                    unique_key_row.table_name, unique_key_row.unique_constraint, unique_key_row.exclude_constraint);
+            END IF;
         END IF;
     END LOOP;
 
 END;
 $function$;
 
-CREATE FUNCTION sql_saga.uk_update_check()
- RETURNS trigger
- LANGUAGE plpgsql
-AS $function$
-#variable_conflict use_variable
-DECLARE
-    jold jsonb;
-BEGIN
-    /*
-     * This function is called when a table referenced by foreign keys with
-     * periods is updated.  It checks to verify that the referenced table still
-     * contains the proper data to satisfy the foreign key constraint.
-     *
-     * The first argument is the name of the foreign key in our custom
-     * catalogs.
-     *
-     * If this is a NO ACTION constraint, we need to check if there is a new
-     * row that still satisfies the constraint, in which case there is no
-     * error.
-     */
-
-    /* Use jsonb to look up values by parameterized names */
-    jold := to_jsonb(OLD);
-
-    /* Check the constraint */
-    PERFORM sql_saga.validate_foreign_key_old_row(TG_ARGV[0], jold, true);
+/*
+ * uk_overlap_check() is the constraint trigger that stands in for the EXCLUDE
+ * constraint of a unique key on a partitioned table, or of one added with
+ * btree => true.  It only probes the btree index of the unique constraint for
+ * the rows just before and after the new one.
+ *
+ * The first argument is the name of the unique key in our custom catalogs.
+ */
+CREATE FUNCTION sql_saga.uk_overlap_check()
+RETURNS trigger
+AS 'sql_saga', 'uk_overlap_check'
+LANGUAGE c;
 
-    RETURN NULL;
-END;
-$function$;
+/*
+ * uk_update_check() and uk_delete_check() are called when a table referenced
+ * by foreign keys with periods is updated or deleted from.  They check that
+ * the referenced table still contains the proper data to satisfy the foreign
+ * key constraint.
+ *
+ * The first argument is the name of the foreign key in our custom catalogs.
+ *
+ * The only difference between NO ACTION and RESTRICT is when the check is
+ * done, so these are used for both.  validate_foreign_key_old_row() below is
+ * the same check for any row given as jsonb.
+ */
+CREATE FUNCTION sql_saga.uk_update_check()
+RETURNS trigger
+AS 'sql_saga', 'uk_update_check'
+LANGUAGE c;
 
 CREATE FUNCTION sql_saga.uk_delete_check()
- RETURNS trigger
- LANGUAGE plpgsql
-AS $function$
-#variable_conflict use_variable
-DECLARE
-    jold jsonb;
-BEGIN
-    /*
-     * This function is called when a table referenced by foreign keys with
-     * periods is deleted from.  It checks to verify that the referenced table
-     * still contains the proper data to satisfy the foreign key constraint.
-     *
-     * The first argument is the name of the foreign key in our custom
-     * catalogs.
-     *
-     * The only difference between NO ACTION and RESTRICT is when the check is
-     * done, so this function is used for both.
-     */
-
-    /* Use jsonb to look up values by parameterized names */
-    jold := to_jsonb(OLD);
+RETURNS trigger
+AS 'sql_saga', 'uk_delete_check'
+LANGUAGE c;
 
-    /* Check the constraint */
-    PERFORM sql_saga.validate_foreign_key_old_row(TG_ARGV[0], jold, false);
 
-    RETURN NULL;
-END;
+/*
+ * _has_supporting_index() tells whether the table has an index whose leading
+ * columns are the given ones, in any order, so that looking up rows by those
+ * columns doesn't need a sequential scan.
+ */
+CREATE FUNCTION sql_saga._has_supporting_index(table_name regclass, column_names name[])
+ RETURNS boolean
+ LANGUAGE sql
+ STABLE
+AS
+$function$
+    SELECT EXISTS (
+        SELECT FROM pg_catalog.pg_index AS i
+        WHERE i.indrelid = table_name
+          AND i.indisvalid
+          AND i.indpred IS NULL
+          AND column_names <@ ARRAY(
+                SELECT a.attname
+                FROM unnest(i.indkey::smallint[]) WITH ORDINALITY AS k (attnum, ordinality)
+                JOIN pg_catalog.pg_attribute AS a ON (a.attrelid, a.attnum) = (i.indrelid, k.attnum)
+                WHERE k.ordinality <= cardinality(column_names)));
 $function$;
 
-
 CREATE FUNCTION sql_saga.add_foreign_key(
         table_name regclass,
         column_names name[],
@@ -1468,7 +2158,10 @@ CREATE FUNCTION sql_saga.add_foreign_key(
         fk_insert_trigger name DEFAULT NULL,
         fk_update_trigger name DEFAULT NULL,
         uk_update_trigger name DEFAULT NULL,
-        uk_delete_trigger name DEFAULT NULL)
+        uk_delete_trigger name DEFAULT NULL,
+        batch boolean DEFAULT false,
+        create_index boolean DEFAULT false,
+        not_valid boolean DEFAULT false)
  RETURNS name
  LANGUAGE plpgsql
  SECURITY DEFINER
@@ -1490,11 +2183,16 @@ DECLARE
     del_action text DEFAULT '';
     foreign_columns text;
     unique_columns text;
+    violation text;
 BEGIN
     IF table_name IS NULL THEN
         RAISE EXCEPTION 'no table name specified';
     END IF;
 
+    IF batch AND match_type = 'PARTIAL' THEN
+        RAISE EXCEPTION 'MATCH PARTIAL is not supported in batch mode';
+    END IF;
+
     /* Always serialize operations on our catalogs */
     PERFORM sql_saga._serialize(table_name);
 
@@ -1619,28 +2317,135 @@ BEGIN
 
     /* Time to make the underlying triggers */
     fk_insert_trigger := coalesce(fk_insert_trigger, sql_saga._make_name(ARRAY[key_name], 'fk_insert'));
-    EXECUTE format('CREATE CONSTRAINT TRIGGER %I AFTER INSERT ON %I.%I FROM %I.%I DEFERRABLE FOR EACH ROW EXECUTE PROCEDURE sql_saga.fk_insert_check(%L)',
-        fk_insert_trigger, schema_name_str, table_name_str, unique_row_schema_name_str ,unique_row_table_name_str, key_name);
     fk_update_trigger := coalesce(fk_update_trigger, sql_saga._make_name(ARRAY[key_name], 'fk_update'));
-    EXECUTE format('CREATE CONSTRAINT TRIGGER %I AFTER UPDATE OF ' || foreign_columns || ' ON %I.%I FROM %I.%I DEFERRABLE FOR EACH ROW EXECUTE PROCEDURE sql_saga.fk_update_check(%L)',
-        fk_update_trigger, schema_name_str, table_name_str, unique_row_schema_name_str ,unique_row_table_name_str, key_name);
+    IF batch THEN
+        /*
+         * Transition tables are not available to constraint triggers, nor to
+         * triggers with a column list, so batch mode uses plain statement
+         * triggers that check every affected row at the end of the statement.
+         */
+        EXECUTE format('CREATE TRIGGER %I AFTER INSERT ON %I.%I REFERENCING NEW TABLE AS sql_saga_new_rows FOR EACH STATEMENT EXECUTE PROCEDURE sql_saga.fk_batch_check(%L)',
+            fk_insert_trigger, schema_name_str, table_name_str, key_name);
+        EXECUTE format('CREATE TRIGGER %I AFTER UPDATE ON %I.%I REFERENCING OLD TABLE AS sql_saga_old_rows NEW TABLE AS sql_saga_new_rows FOR EACH STATEMENT EXECUTE PROCEDURE sql_saga.fk_batch_check(%L)',
+            fk_update_trigger, schema_name_str, table_name_str, key_name);
+    ELSE
+        EXECUTE format('CREATE CONSTRAINT TRIGGER %I AFTER INSERT ON %I.%I FROM %I.%I DEFERRABLE FOR EACH ROW EXECUTE PROCEDURE sql_saga.fk_insert_check(%L)',
+            fk_insert_trigger, schema_name_str, table_name_str, unique_row_schema_name_str ,unique_row_table_name_str, key_name);
+        EXECUTE format('CREATE CONSTRAINT TRIGGER %I AFTER UPDATE OF ' || foreign_columns || ' ON %I.%I FROM %I.%I DEFERRABLE FOR EACH ROW EXECUTE PROCEDURE sql_saga.fk_update_check(%L)',
+            fk_update_trigger, schema_name_str, table_name_str, unique_row_schema_name_str ,unique_row_table_name_str, key_name);
+    END IF;
     uk_update_trigger := coalesce(uk_update_trigger, sql_saga._make_name(ARRAY[key_name], 'uk_update'));
-    EXECUTE format('CREATE CONSTRAINT TRIGGER %I AFTER UPDATE OF ' || unique_columns || ' ON %I.%I FROM %I.%I DEFERRABLE FOR EACH ROW EXECUTE PROCEDURE sql_saga.uk_update_check(%L)',
-        uk_update_trigger, unique_row_schema_name_str ,unique_row_table_name_str, schema_name_str, table_name_str, key_name);
     uk_delete_trigger := coalesce(uk_delete_trigger, sql_saga._make_name(ARRAY[key_name], 'uk_delete'));
-    EXECUTE format('CREATE CONSTRAINT TRIGGER %I AFTER DELETE ON %I.%I FROM %I.%I DEFERRABLE FOR EACH ROW EXECUTE PROCEDURE sql_saga.uk_delete_check(%L)',
-        uk_delete_trigger, unique_row_schema_name_str ,unique_row_table_name_str, schema_name_str, table_name_str, key_name);
+    IF batch THEN
+        /* The referenced side is checked once per key for each statement, too */
+        EXECUTE format('CREATE TRIGGER %I AFTER UPDATE ON %I.%I REFERENCING OLD TABLE AS sql_saga_old_rows NEW TABLE AS sql_saga_new_rows FOR EACH STATEMENT EXECUTE PROCEDURE sql_saga.uk_batch_check(%L)',
+            uk_update_trigger, unique_row_schema_name_str, unique_row_table_name_str, key_name);
+        EXECUTE format('CREATE TRIGGER %I AFTER DELETE ON %I.%I REFERENCING OLD TABLE AS sql_saga_old_rows FOR EACH STATEMENT EXECUTE PROCEDURE sql_saga.uk_batch_check(%L)',
+            uk_delete_trigger, unique_row_schema_name_str, unique_row_table_name_str, key_name);
+    ELSE
+        EXECUTE format('CREATE CONSTRAINT TRIGGER %I AFTER UPDATE OF ' || unique_columns || ' ON %I.%I FROM %I.%I DEFERRABLE FOR EACH ROW EXECUTE PROCEDURE sql_saga.uk_update_check(%L)',
+            uk_update_trigger, unique_row_schema_name_str ,unique_row_table_name_str, schema_name_str, table_name_str, key_name);
+        EXECUTE format('CREATE CONSTRAINT TRIGGER %I AFTER DELETE ON %I.%I FROM %I.%I DEFERRABLE FOR EACH ROW EXECUTE PROCEDURE sql_saga.uk_delete_check(%L)',
+            uk_delete_trigger, unique_row_schema_name_str ,unique_row_table_name_str, schema_name_str, table_name_str, key_name);
+    END IF;
+
+    INSERT INTO sql_saga.foreign_keys (key_name, table_name, column_names, era_name, unique_key, match_type, update_action, delete_action,
+                                      fk_insert_trigger, fk_update_trigger, uk_update_trigger, uk_delete_trigger, validated)
+    VALUES (key_name, table_name, column_names, era_name, unique_row.key_name, match_type, update_action, delete_action,
+            fk_insert_trigger, fk_update_trigger, uk_update_trigger, uk_delete_trigger, NOT not_valid);
+
+    /*
+     * Checking the referenced side looks up the referencing rows by key, and
+     * without an index every such check reads the whole table.
+     */
+    IF create_index AND NOT sql_saga._has_supporting_index(table_name, column_names) THEN
+        EXECUTE format('CREATE INDEX ON %I.%I USING btree (%s)',
+            schema_name_str, table_name_str, foreign_columns);
+    END IF;
+
+    IF not_valid THEN
+        /* The triggers check new changes, validate_foreign_key() the existing data. */
+        NULL;
+    ELSIF batch THEN
+        /* Validate the constraint on existing data with a single query. */
+        EXECUTE sql_saga._foreign_key_batch_query(key_name, format('%I.%I', schema_name_str, table_name_str))
+        INTO violation;
+
+        IF violation IS NOT NULL THEN
+            RAISE EXCEPTION '%', violation USING ERRCODE = 'foreign_key_violation';
+        END IF;
+    ELSE
+        /* Validate the constraint on existing data, iterating over each row. */
+        EXECUTE format('SELECT sql_saga.validate_foreign_key_new_row(%1$L, to_jsonb(%3$I.*)) FROM %2$I.%3$I;',
+            key_name, schema_name_str, table_name_str);
+    END IF;
+
+    RETURN key_name;
+END;
+$function$;
+
+/*
+ * validate_foreign_key(key_name name) -
+ * Checks the existing rows of a foreign key added with not_valid => true,
+ * like ALTER TABLE ... VALIDATE CONSTRAINT.  The triggers already check
+ * every change, so both tables stay writable: the rows are read with one
+ * query over the whole table, without locking the referenced rows.
+ */
+CREATE FUNCTION sql_saga.validate_foreign_key(key_name name)
+ RETURNS boolean
+ LANGUAGE plpgsql
+ SECURITY DEFINER
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    foreign_key_row sql_saga.foreign_keys;
+    unique_table_name regclass;
+    violation text;
+BEGIN
+    SELECT fk.*
+    INTO foreign_key_row
+    FROM sql_saga.foreign_keys AS fk
+    WHERE fk.key_name = key_name;
+
+    IF NOT FOUND THEN
+        RAISE EXCEPTION 'foreign key "%" does not exist', key_name;
+    END IF;
+
+    /* Always serialize operations on our catalogs */
+    PERFORM sql_saga._serialize(foreign_key_row.table_name);
+
+    IF foreign_key_row.validated THEN
+        RETURN true;
+    END IF;
+
+    SELECT uk.table_name
+    INTO unique_table_name
+    FROM sql_saga.unique_keys AS uk
+    WHERE uk.key_name = foreign_key_row.unique_key;
+
+    /* The same locks as VALIDATE CONSTRAINT, which let writes go on */
+    EXECUTE format('LOCK TABLE %s IN SHARE UPDATE EXCLUSIVE MODE', foreign_key_row.table_name);
+    EXECUTE format('LOCK TABLE %s IN ROW SHARE MODE', unique_table_name);
 
-    INSERT INTO sql_saga.foreign_keys (key_name, table_name, column_names, era_name, unique_key, match_type, update_action, delete_action,
-                                      fk_insert_trigger, fk_update_trigger, uk_update_trigger, uk_delete_trigger)
-    VALUES (key_name, table_name, column_names, era_name, unique_row.key_name, match_type, update_action, delete_action,
-            fk_insert_trigger, fk_update_trigger, uk_update_trigger, uk_delete_trigger);
+    IF foreign_key_row.match_type = 'PARTIAL' THEN
+        /* MATCH PARTIAL has no set-based check, see add_foreign_key() */
+        EXECUTE format('SELECT sql_saga.validate_foreign_key_new_row(%L, to_jsonb(fk.*)) FROM %s AS fk',
+            key_name, foreign_key_row.table_name);
+    ELSE
+        EXECUTE sql_saga._foreign_key_batch_query(key_name, foreign_key_row.table_name::text, lock_rows => false)
+        INTO violation;
 
-    /* Validate the constraint on existing data, iterating over each row. */
-    EXECUTE format('SELECT sql_saga.validate_foreign_key_new_row(%1$L, to_jsonb(%3$I.*)) FROM %2$I.%3$I;',
-        key_name, schema_name_str, table_name_str);
+        IF violation IS NOT NULL THEN
+            RAISE EXCEPTION '%', violation USING ERRCODE = 'foreign_key_violation';
+        END IF;
+    END IF;
 
-    RETURN key_name;
+    UPDATE sql_saga.foreign_keys AS fk
+    SET validated = true
+    WHERE fk.key_name = key_name;
+
+    RETURN true;
 END;
 $function$;
 
@@ -1718,56 +2523,459 @@ BEGIN
 END;
 $function$;
 
+/*
+ * index_advice() lists the unique and foreign keys whose table has no index
+ * to look up its rows by key, together with the index that would do.  The
+ * unique side always has the index of its unique constraint unless that was
+ * dropped behind our back, but the referencing side of a foreign key has
+ * none unless the user made one.
+ *
+ * If create_indexes is true, the missing indexes are also created.  That
+ * needs the same privileges as running CREATE INDEX by hand.
+ */
+CREATE FUNCTION sql_saga.index_advice(create_indexes boolean DEFAULT false)
+ RETURNS TABLE (table_name regclass, key_name name, index_definition text)
+ LANGUAGE plpgsql
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    r record;
+BEGIN
+    FOR r IN
+        SELECT k.table_name, k.key_name, k.column_names,
+               format('CREATE INDEX ON %s USING btree (%s)', k.table_name,
+                      (SELECT string_agg(quote_ident(u.column_name), ', ' ORDER BY u.ordinality)
+                       FROM unnest(k.column_names || e.start_column_name || e.end_column_name) WITH ORDINALITY AS u (column_name, ordinality))) AS index_definition
+        FROM (
+            SELECT uk.table_name, uk.key_name, uk.column_names, uk.era_name
+            FROM sql_saga.unique_keys AS uk
+            UNION ALL
+            SELECT fk.table_name, fk.key_name, fk.column_names, fk.era_name
+            FROM sql_saga.foreign_keys AS fk
+        ) AS k
+        JOIN sql_saga.era AS e ON (e.table_name, e.era_name) = (k.table_name, k.era_name)
+        WHERE NOT sql_saga._has_supporting_index(k.table_name, k.column_names)
+        ORDER BY k.table_name::text, k.key_name
+    LOOP
+        /* Keys on the same columns can share the index */
+        IF create_indexes AND NOT sql_saga._has_supporting_index(r.table_name, r.column_names) THEN
+            EXECUTE r.index_definition;
+        END IF;
+
+        table_name := r.table_name;
+        key_name := r.key_name;
+        index_definition := r.index_definition;
+        RETURN NEXT;
+    END LOOP;
+END;
+$function$;
+
+/*
+ * The checks of the keys count how often they run for every key, how many
+ * rows they checked against the other table, how many rows of it they read
+ * where that is known, how long they took in milliseconds, and how many
+ * failed.  The counters cover the whole server when sql_saga is in
+ * shared_preload_libraries, and only the current session otherwise.
+ */
+CREATE FUNCTION sql_saga._check_stats(
+        OUT kind "char",
+        OUT key_name name,
+        OUT calls bigint,
+        OUT rows_checked bigint,
+        OUT rows_scanned bigint,
+        OUT violations bigint,
+        OUT total_time double precision,
+        OUT max_time double precision)
+ RETURNS SETOF record
+AS 'sql_saga', 'check_stats'
+LANGUAGE c VOLATILE;
+
+/*
+ * _count_batch_check() counts a run of fk_batch_check() or uk_batch_check()
+ * for the given foreign key, with the checks done in C.  Runs on the
+ * referenced side are counted under the unique key.
+ */
+CREATE FUNCTION sql_saga._count_batch_check(foreign_key_name name, referenced boolean, started timestamp with time zone, rows_checked bigint, violation boolean)
+ RETURNS void
+AS 'sql_saga', 'count_batch_check'
+LANGUAGE c VOLATILE STRICT;
+
+/*
+ * stat_foreign_keys counts the checks of the referencing rows, when they are
+ * inserted or updated.
+ */
+CREATE VIEW sql_saga.stat_foreign_keys AS
+    SELECT fk.key_name,
+           fk.table_name,
+           fk.unique_key,
+           coalesce(s.calls, 0) AS calls,
+           coalesce(s.rows_checked, 0) AS rows_checked,
+           coalesce(s.rows_scanned, 0) AS rows_scanned,
+           coalesce(s.violations, 0) AS violations,
+           coalesce(s.total_time, 0) AS total_time,
+           coalesce(s.max_time, 0) AS max_time
+    FROM sql_saga.foreign_keys AS fk
+    LEFT JOIN sql_saga._check_stats() AS s ON (s.kind, s.key_name) = ('f', fk.key_name);
+GRANT SELECT ON TABLE sql_saga.stat_foreign_keys TO PUBLIC;
+
+/*
+ * stat_unique_keys counts the checks done when the rows of a unique key are
+ * written: that they don't overlap, and that the rows of the foreign keys
+ * referencing them are still covered.  The overlaps are only counted for the
+ * keys checked by a trigger, those made with btree => true and those on
+ * partitioned tables.  The EXCLUDE constraint of the other keys is checked
+ * by PostgreSQL itself, and is not counted.
+ */
+CREATE VIEW sql_saga.stat_unique_keys AS
+    SELECT uk.key_name,
+           uk.table_name,
+           coalesce(s.calls, 0) AS calls,
+           coalesce(s.rows_checked, 0) AS rows_checked,
+           coalesce(s.rows_scanned, 0) AS rows_scanned,
+           coalesce(s.violations, 0) AS violations,
+           coalesce(s.total_time, 0) AS total_time,
+           coalesce(s.max_time, 0) AS max_time
+    FROM sql_saga.unique_keys AS uk
+    LEFT JOIN sql_saga._check_stats() AS s ON (s.kind, s.key_name) = ('u', uk.key_name);
+GRANT SELECT ON TABLE sql_saga.stat_unique_keys TO PUBLIC;
+
+/* stat_reset() throws away the counters of the current database */
+CREATE FUNCTION sql_saga.stat_reset()
+ RETURNS void
+AS 'sql_saga', 'stat_reset'
+LANGUAGE c VOLATILE;
+REVOKE ALL ON FUNCTION sql_saga.stat_reset() FROM PUBLIC;
+
+/*
+ * fk_insert_check() and fk_update_check() are called when a row is inserted
+ * into or updated in a table containing foreign keys with sql_saga.  They
+ * check that the referenced table contains the proper data to satisfy the
+ * foreign key constraint.
+ *
+ * The first argument is the name of the foreign key in our custom catalogs.
+ *
+ * They are written in C so that the check works directly on the new row with
+ * a cached plan per foreign key.  validate_foreign_key_new_row() below is the
+ * same check for any row given as jsonb.
+ */
 CREATE FUNCTION sql_saga.fk_insert_check()
+RETURNS trigger
+AS 'sql_saga', 'fk_insert_check'
+LANGUAGE c;
+
+CREATE FUNCTION sql_saga.fk_update_check()
+RETURNS trigger
+AS 'sql_saga', 'fk_update_check'
+LANGUAGE c;
+
+/*
+ * _coverage_sql() returns an aggregate expression that is true when the
+ * `ranges` cover `target` without a gap.  From PostgreSQL 14 on that is
+ * range_agg() into a multirange, which the server merges in its own code;
+ * before that it is no_gaps(), fed the ranges in order if sort_ranges.
+ */
+CREATE FUNCTION sql_saga._coverage_sql(ranges text, target text, sort_ranges boolean DEFAULT false)
+ RETURNS text
+ LANGUAGE plpgsql
+ STABLE
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    SERVER_VERSION CONSTANT integer := current_setting('server_version_num')::integer;
+BEGIN
+    IF SERVER_VERSION >= 140000 THEN
+        RETURN format('range_agg(%s) @> %s', ranges, target);
+    END IF;
+
+    RETURN format('sql_saga.no_gaps(%s, %s%s)', ranges, target,
+        CASE WHEN sort_ranges THEN ' ORDER BY ' || ranges ELSE '' END);
+END;
+$function$;
+
+/*
+ * _foreign_key_batch_query() builds a query that checks a whole set of
+ * referencing rows at once.  new_rows is the (already quoted) name of a
+ * relation with the same columns as the referencing table, and old_rows, if
+ * given, one whose rows need not be checked again.
+ *
+ * The query joins the distinct keys and periods of the new rows with the
+ * unique key's table in one go and checks the coverage of each group with
+ * _coverage_sql().
+ * It returns NULL when all is well and the error message to raise otherwise.
+ * The referenced rows are locked FOR KEY SHARE unless lock_rows is false.
+ */
+CREATE FUNCTION sql_saga._foreign_key_batch_query(foreign_key_name name, new_rows text, old_rows text DEFAULT NULL, lock_rows boolean DEFAULT true)
+ RETURNS text
+ LANGUAGE plpgsql
+ STABLE
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    foreign_key_info record;
+    key_count integer;
+    fk_columns text;
+    fk_keys text;
+    key_aliases text;
+    key_matches text;
+    rows_sql text;
+    nulls_sql text DEFAULT 'false';
+BEGIN
+    SELECT *
+    INTO foreign_key_info
+    FROM sql_saga._foreign_key_info(foreign_key_name);
+
+    IF NOT FOUND THEN
+        RAISE EXCEPTION 'foreign key "%" not found', foreign_key_name;
+    END IF;
+
+    SELECT count(*),
+           string_agg(format('fk.%I AS k%s', u.fkc, u.n), ', ' ORDER BY u.n),
+           string_agg(format('fk.%I', u.fkc), ', ' ORDER BY u.n),
+           string_agg(format('k%s', u.n), ', ' ORDER BY u.n),
+           string_agg(format('uk.%I = fk.k%s', u.ukc, u.n), ' AND ' ORDER BY u.n)
+    INTO key_count, fk_columns, fk_keys, key_aliases, key_matches
+    FROM unnest(foreign_key_info.fk_column_names,
+                foreign_key_info.uk_column_names) WITH ORDINALITY AS u (fkc, ukc, n);
+
+    /* Rows with nulls in the key are not checked, see validate_foreign_key_new_row() */
+    rows_sql := format('SELECT %s%s, fk.%I AS fk_start, fk.%I AS fk_end FROM %s AS fk WHERE num_nulls(%s) = 0',
+        CASE WHEN old_rows IS NULL THEN 'DISTINCT ' ELSE '' END,
+        fk_columns,
+        foreign_key_info.fk_start_column_name,
+        foreign_key_info.fk_end_column_name,
+        new_rows,
+        fk_keys);
+
+    IF old_rows IS NOT NULL THEN
+        rows_sql := rows_sql || format(' EXCEPT SELECT %s, fk.%I, fk.%I FROM %s AS fk',
+            fk_columns,
+            foreign_key_info.fk_start_column_name,
+            foreign_key_info.fk_end_column_name,
+            old_rows);
+    END IF;
+
+    IF foreign_key_info.match_type = 'FULL' THEN
+        nulls_sql := format('EXISTS (SELECT FROM %s AS fk WHERE num_nulls(%s) BETWEEN 1 AND %s)',
+            new_rows, fk_keys, key_count - 1);
+    END IF;
+
+    RETURN format(
+        'WITH fk AS (%1$s), '
+        '     covering AS ( '
+        '         SELECT fk.*, %11$s(uk.%4$I, uk.%5$I) AS r '
+        '         FROM fk '
+        '         JOIN %2$I.%3$I AS uk '
+        '           ON %6$s '
+        '          AND uk.%4$I < fk.fk_end '
+        '          AND uk.%5$I > fk.fk_start '
+        '         %12$s '
+        '     ) '
+        'SELECT CASE '
+        '    WHEN %8$s THEN %9$L '
+        '    WHEN EXISTS ( '
+        '        SELECT FROM fk '
+        '        LEFT JOIN (SELECT %7$s, fk_start, fk_end, '
+        '                          ' || sql_saga._coverage_sql('c.r', '%11$s(fk_start, fk_end)', true) || ' AS covered '
+        '                   FROM covering AS c '
+        '                   GROUP BY %7$s, fk_start, fk_end '
+        '                  ) AS uk USING (%7$s, fk_start, fk_end) '
+        '        WHERE NOT coalesce(uk.covered, false) '
+        '    ) THEN %10$L '
+        'END',
+        rows_sql,
+        foreign_key_info.uk_schema_name,
+        foreign_key_info.uk_table_name,
+        foreign_key_info.uk_start_column_name,
+        foreign_key_info.uk_end_column_name,
+        key_matches,
+        key_aliases,
+        nulls_sql,
+        'foreign key violated (nulls in FULL)',
+        format('insert or update on table "%s" violates foreign key constraint "%s"',
+            foreign_key_info.fk_table_oid::regclass,
+            foreign_key_name),
+        foreign_key_info.range_type,
+        CASE WHEN lock_rows THEN 'FOR KEY SHARE OF uk' ELSE '' END);
+END;
+$function$;
+
+/*
+ * fk_batch_check() replaces fk_insert_check() and fk_update_check() for
+ * foreign keys added with batch => true.  It is an AFTER STATEMENT trigger
+ * that checks all the inserted or updated rows with one set-based query
+ * instead of one query per row.
+ */
+CREATE FUNCTION sql_saga.fk_batch_check()
  RETURNS trigger
  LANGUAGE plpgsql
-AS $function$
+AS
+$function$
 #variable_conflict use_variable
 DECLARE
-    jnew jsonb;
+    violation text;
+    started timestamp with time zone := clock_timestamp();
 BEGIN
-    /*
-     * This function is called when a new row is inserted into a table
-     * containing foreign keys with sql_saga.  It checks to verify that the
-     * referenced table contains the proper data to satisfy the foreign key
-     * constraint.
-     *
-     * The first argument is the name of the foreign key in our custom
-     * catalogs.
-     */
+    IF TG_OP = 'UPDATE' THEN
+        EXECUTE sql_saga._foreign_key_batch_query(TG_ARGV[0], 'sql_saga_new_rows', 'sql_saga_old_rows')
+        INTO violation;
+    ELSE
+        EXECUTE sql_saga._foreign_key_batch_query(TG_ARGV[0], 'sql_saga_new_rows')
+        INTO violation;
+    END IF;
 
-    /* Use jsonb to look up values by parameterized names */
-    jnew := to_jsonb(NEW);
+    IF coalesce(current_setting('sql_saga.track_checks', true), 'on')::boolean THEN
+        PERFORM sql_saga._count_batch_check(TG_ARGV[0], false, started,
+            (SELECT count(*) FROM sql_saga_new_rows), violation IS NOT NULL);
+    END IF;
 
-    /* Check the constraint */
-    PERFORM sql_saga.validate_foreign_key_new_row(TG_ARGV[0], jnew);
+    IF violation IS NOT NULL THEN
+        RAISE EXCEPTION '%', violation USING ERRCODE = 'foreign_key_violation';
+    END IF;
 
     RETURN NULL;
 END;
 $function$;
 
-CREATE FUNCTION sql_saga.fk_update_check()
+/*
+ * _unique_key_batch_query() builds a query that checks, for a whole set of
+ * referenced rows that were updated or deleted, that the rows referencing
+ * them are still covered.  old_rows is the (already quoted) name of a
+ * relation with the same columns as the referenced table, and new_rows, if
+ * given, one whose rows did not really go away.
+ *
+ * The removed rows are grouped by key first, so every referencing row that
+ * overlaps the removed periods of its key is checked once however many
+ * versions of the key went.  It returns NULL when all is well and the error
+ * message to raise otherwise.
+ */
+CREATE FUNCTION sql_saga._unique_key_batch_query(foreign_key_name name, old_rows text, new_rows text DEFAULT NULL)
+ RETURNS text
+ LANGUAGE plpgsql
+ STABLE
+AS
+$function$
+#variable_conflict use_variable
+DECLARE
+    foreign_key_info record;
+    uk_columns text;
+    uk_keys text;
+    key_aliases text;
+    fk_matches text;
+    uk_matches text;
+    rows_sql text;
+BEGIN
+    SELECT *
+    INTO foreign_key_info
+    FROM sql_saga._foreign_key_info(foreign_key_name);
+
+    IF NOT FOUND THEN
+        RAISE EXCEPTION 'foreign key "%" not found', foreign_key_name;
+    END IF;
+
+    SELECT string_agg(format('uk.%I AS k%s', u.ukc, u.n), ', ' ORDER BY u.n),
+           string_agg(format('uk.%I', u.ukc), ', ' ORDER BY u.n),
+           string_agg(format('k%s', u.n), ', ' ORDER BY u.n),
+           string_agg(format('fk.%I = r.k%s', u.fkc, u.n), ' AND ' ORDER BY u.n),
+           string_agg(format('uk.%I = fk.%I', u.ukc, u.fkc), ' AND ' ORDER BY u.n)
+    INTO uk_columns, uk_keys, key_aliases, fk_matches, uk_matches
+    FROM unnest(foreign_key_info.fk_column_names,
+                foreign_key_info.uk_column_names) WITH ORDINALITY AS u (fkc, ukc, n);
+
+    /* Rows with nulls in the key can't be referenced, see validate_foreign_key_old_row() */
+    rows_sql := format('SELECT %s, uk.%I AS uk_start, uk.%I AS uk_end FROM %s AS uk WHERE num_nulls(%s) = 0',
+        uk_columns,
+        foreign_key_info.uk_start_column_name,
+        foreign_key_info.uk_end_column_name,
+        old_rows,
+        uk_keys);
+
+    IF new_rows IS NOT NULL THEN
+        rows_sql := rows_sql || format(' EXCEPT SELECT %s, uk.%I, uk.%I FROM %s AS uk',
+            uk_keys,
+            foreign_key_info.uk_start_column_name,
+            foreign_key_info.uk_end_column_name,
+            new_rows);
+    END IF;
+
+    RETURN format(
+        'WITH removed AS (%1$s), '
+        '     removed_keys AS ( '
+        '         SELECT %2$s, min(uk_start) AS uk_start, max(uk_end) AS uk_end '
+        '         FROM removed '
+        '         GROUP BY %2$s '
+        '     ) '
+        'SELECT CASE WHEN EXISTS ( '
+        '    SELECT FROM removed_keys AS r '
+        '    JOIN %3$I.%4$I AS fk '
+        '      ON %5$s '
+        '     AND fk.%6$I < r.uk_end '
+        '     AND fk.%7$I > r.uk_start '
+        '    WHERE NOT coalesce(( '
+        '        SELECT ' || sql_saga._coverage_sql('uk.r', '%8$s(fk.%6$I, fk.%7$I)') || ' '
+        '        FROM (SELECT %8$s(uk.%11$I, uk.%12$I) AS r '
+        '              FROM %9$I.%10$I AS uk '
+        '              WHERE %13$s '
+        '                AND uk.%11$I < fk.%7$I '
+        '                AND uk.%12$I > fk.%6$I '
+        '              ORDER BY uk.%11$I '
+        '             ) AS uk '
+        '    ), false) '
+        ') THEN %14$L END',
+        rows_sql,
+        key_aliases,
+        foreign_key_info.fk_schema_name,
+        foreign_key_info.fk_table_name,
+        fk_matches,
+        foreign_key_info.fk_start_column_name,
+        foreign_key_info.fk_end_column_name,
+        foreign_key_info.range_type,
+        foreign_key_info.uk_schema_name,
+        foreign_key_info.uk_table_name,
+        foreign_key_info.uk_start_column_name,
+        foreign_key_info.uk_end_column_name,
+        uk_matches,
+        format('update or delete on table "%s" violates foreign key constraint "%s" on table "%s"',
+            foreign_key_info.uk_table_oid::regclass,
+            foreign_key_name,
+            foreign_key_info.fk_table_oid::regclass));
+END;
+$function$;
+
+/*
+ * uk_batch_check() replaces uk_update_check() and uk_delete_check() for
+ * foreign keys added with batch => true.  It is an AFTER STATEMENT trigger
+ * on the referenced table that checks the referencing rows of all the
+ * updated or deleted keys with one set-based query.
+ */
+CREATE FUNCTION sql_saga.uk_batch_check()
  RETURNS trigger
  LANGUAGE plpgsql
-AS $function$
+AS
+$function$
 #variable_conflict use_variable
 DECLARE
-    jnew jsonb;
+    violation text;
+    started timestamp with time zone := clock_timestamp();
 BEGIN
-    /*
-     * This function is called when a table containing foreign keys with
-     * periods is updated.  It checks to verify that the referenced table
-     * contains the proper data to satisfy the foreign key constraint.
-     *
-     * The first argument is the name of the foreign key in our custom
-     * catalogs.
-     */
+    IF TG_OP = 'UPDATE' THEN
+        EXECUTE sql_saga._unique_key_batch_query(TG_ARGV[0], 'sql_saga_old_rows', 'sql_saga_new_rows')
+        INTO violation;
+    ELSE
+        EXECUTE sql_saga._unique_key_batch_query(TG_ARGV[0], 'sql_saga_old_rows')
+        INTO violation;
+    END IF;
 
-    /* Use jsonb to look up values by parameterized names */
-    jnew := to_jsonb(NEW);
+    IF coalesce(current_setting('sql_saga.track_checks', true), 'on')::boolean THEN
+        PERFORM sql_saga._count_batch_check(TG_ARGV[0], true, started,
+            (SELECT count(*) FROM sql_saga_old_rows), violation IS NOT NULL);
+    END IF;
 
-    /* Check the constraint */
-    PERFORM sql_saga.validate_foreign_key_new_row(TG_ARGV[0], jnew);
+    IF violation IS NOT NULL THEN
+        RAISE EXCEPTION '%', violation USING ERRCODE = 'foreign_key_violation';
+    END IF;
 
     RETURN NULL;
 END;
@@ -1784,86 +2992,50 @@ $function$
 #variable_conflict use_variable
 DECLARE
     foreign_key_info record;
-    column_name name;
-    uk_column_names_arr text[];
-    uk_column_values_arr text[];
-    uk_column_names text;
-    uk_column_values text;
-    fk_column_names text;
-    min_uk_start_value text;
-    max_uk_end_value text;
+    fk_column_name name;
+    uk_column_name name;
+    fk_columns text[] DEFAULT '{}';
+    uk_values text[] DEFAULT '{}';
+    key_matches text[] DEFAULT '{}';
     violation boolean;
 
-    QSQL_UK_MINMAX CONSTANT text :=
-        'SELECT MIN(%5$I), MAX(%6$I) '
-        '  FROM %1$I.%2$I as t '
-        ' WHERE ROW(%3$s) = ROW(%4$s)';
-
-    QSQL_FK_EXISTS CONSTANT text :=
-        'SELECT EXISTS( '
-        '  SELECT FROM %1$I.%2$I as t '
-        '  WHERE ROW(%3$s) = ROW(%4$s)'
-        ')';
-
-    QSQL_FK_OUT_OF_UK_MINMAX_RANGE CONSTANT text :=
-        'SELECT EXISTS( '
-        '   SELECT '
-        '     FROM %1$I.%2$I as t '
+    /*
+     * Only the referencing rows that overlap the old row can have lost their
+     * coverage, and each of them must be covered by what is left.
+     */
+    QSQL CONSTANT text :=
+        'SELECT EXISTS ( '
+        '    SELECT FROM %1$I.%2$I AS fk '
         '    WHERE ROW(%3$s) = ROW(%4$s) '
-        '      AND NOT sql_saga.contains(%5$L, %6$L, %7$I, %8$I) '
-        ')';
-
-    QSQL_FK_CONTAINS_UK_HOLES CONSTANT text :=
-        'SELECT EXISTS( '
-        '    WITH holes AS ( '
-        '        SELECT %6$I AS "s", next_s AS "e" '
-        '          FROM (SELECT %6$I, LEAD(%5$I, 1) OVER (ORDER BY %5$I) "next_s" '
-        '                  FROM %1$I.%2$I '
-        '                 WHERE ROW(%3$s) = ROW(%4$s)) t '
-        '         WHERE (t.next_s IS NOT NULL AND t.next_s <> %6$I) '
-        '    ) '
-        '    SELECT FROM %7$I.%8$I t'
-        '     WHERE ROW(%9$s) = ROW(%4$s)'
-        '       AND EXISTS(SELECT '
-        '                    FROM holes h '
-        '                   WHERE sql_saga.contains(%10$I, %11$I, h.s, h.e)) '
+        '      AND fk.%5$I < %8$L '
+        '      AND fk.%6$I > %7$L '
+        '      AND NOT coalesce(( '
+        '          SELECT ' || sql_saga._coverage_sql('uk.r', '%9$s(fk.%5$I, fk.%6$I)') || ' '
+        '          FROM (SELECT %9$s(uk.%12$I, uk.%13$I) AS r '
+        '                FROM %10$I.%11$I AS uk '
+        '                WHERE %14$s '
+        '                  AND uk.%12$I < fk.%6$I '
+        '                  AND uk.%13$I > fk.%5$I '
+        '                ORDER BY uk.%12$I '
+        '               ) AS uk '
+        '      ), false) '
         ')';
 BEGIN
     -- gets metadata about the periods, foreign-keys and unique-keys
-    SELECT fc.oid AS fk_table_oid,
-           fn.nspname AS fk_schema_name,
-           fc.relname AS fk_table_name,
-           fk.column_names AS fk_column_names,
-           fp.era_name AS fk_era_name,
-           fp.start_column_name AS fk_start_column_name,
-           fp.end_column_name AS fk_end_column_name,
-           uc.oid AS uk_table_oid,
-           un.nspname AS uk_schema_name,
-           uc.relname AS uk_table_name,
-           uk.column_names AS uk_column_names,
-           up.era_name AS uk_era_name,
-           up.start_column_name AS uk_start_column_name,
-           up.end_column_name AS uk_end_column_name,
-           fk.match_type,
-           fk.update_action,
-           fk.delete_action
+    SELECT *
     INTO foreign_key_info
-    FROM sql_saga.foreign_keys AS fk
-    JOIN sql_saga.era AS fp ON (fp.table_name, fp.era_name) = (fk.table_name, fk.era_name)
-    JOIN pg_catalog.pg_class AS fc ON fc.oid = fk.table_name
-    JOIN pg_catalog.pg_namespace AS fn ON fn.oid = fc.relnamespace
-    JOIN sql_saga.unique_keys AS uk ON uk.key_name = fk.unique_key
-    JOIN sql_saga.era AS up ON (up.table_name, up.era_name) = (uk.table_name, uk.era_name)
-    JOIN pg_catalog.pg_class AS uc ON uc.oid = uk.table_name
-    JOIN pg_catalog.pg_namespace AS un ON un.oid = uc.relnamespace
-    WHERE fk.key_name = foreign_key_name;
+    FROM sql_saga._foreign_key_info(foreign_key_name);
 
     IF NOT FOUND THEN
         RAISE EXCEPTION 'foreign key "%" not found', foreign_key_name;
     END IF;
 
-    FOREACH column_name IN ARRAY foreign_key_info.uk_column_names LOOP
-        IF row_data->>column_name IS NULL THEN
+    FOR fk_column_name, uk_column_name IN
+        SELECT u.fkc, u.ukc
+        FROM unnest(foreign_key_info.fk_column_names, foreign_key_info.uk_column_names) WITH ORDINALITY AS u (fkc, ukc, ordinality)
+        ORDER BY u.ordinality
+    LOOP
+        IF row_data->>uk_column_name IS NULL THEN
             /*
              * If the deleted row had nulls in the referenced columns then
              * there was no possible referencing row (until we implement
@@ -1871,87 +3043,25 @@ BEGIN
              */
             RETURN true;
         END IF;
-        uk_column_names_arr := uk_column_names_arr || ('t.' || quote_ident(column_name));
-        uk_column_values_arr := uk_column_values_arr || quote_literal(row_data->>column_name);
+        fk_columns := fk_columns || ('fk.' || quote_ident(fk_column_name));
+        uk_values := uk_values || quote_literal(row_data->>uk_column_name);
+        key_matches := key_matches || format('uk.%I = fk.%I', uk_column_name, fk_column_name);
     END LOOP;
 
-    uk_column_names := array_to_string(uk_column_names_arr, ', ');
-    uk_column_values := array_to_string(uk_column_values_arr, ', ');
-
-    -- query the range that the uk currently spans:
-    -- time: 1 2 3 4 5 6 | in ranges
-    --   uk: *** ******* | [1,2), [3,6)
-    -- in this case would return [1,6).
-    EXECUTE format(QSQL_UK_MINMAX,
-        foreign_key_info.uk_schema_name,
-        foreign_key_info.uk_table_name,
-        uk_column_names,
-        uk_column_values,
-        foreign_key_info.uk_start_column_name,
-        foreign_key_info.uk_end_column_name)
-    INTO min_uk_start_value, max_uk_end_value;
-
-    SELECT string_agg('t.' || quote_ident(u.c), ', ' ORDER BY u.ordinality)
-    INTO fk_column_names
-    FROM unnest(foreign_key_info.fk_column_names) WITH ORDINALITY AS u (c, ordinality);
-
-    -- min|max can be null if `uk` has no record for the specified filter,
-    -- which means that should not exists any `fk` record for the same filter.
-    IF min_uk_start_value IS NULL OR max_uk_end_value IS NULL THEN
-        EXECUTE format(QSQL_FK_EXISTS, foreign_key_info.fk_schema_name,
-                                       foreign_key_info.fk_table_name,
-                                       fk_column_names,
-                                       uk_column_values)
-        INTO violation;
-
-        IF violation THEN
-            RAISE EXCEPTION 'update or delete on table "%" violates foreign key constraint "%" on table "%"',
-                foreign_key_info.uk_table_oid::regclass,
-                foreign_key_name,
-                foreign_key_info.fk_table_oid::regclass;
-        END IF;
-    END IF;
-
-    -- check if any fk record is not contained in the range `[min(uk.start), max(uk.end)).`
-    -- time: 1 2 3 4 5 6
-    --   uk:   *******
-    --   fk:   ^-----^
-    -- any fk record with start or end outside the ^ markers are considered a violation.
-    EXECUTE format(QSQL_FK_OUT_OF_UK_MINMAX_RANGE, foreign_key_info.fk_schema_name,
-                                                   foreign_key_info.fk_table_name,
-                                                   fk_column_names,
-                                                   uk_column_values,
-                                                   min_uk_start_value,
-                                                   max_uk_end_value,
-                                                   foreign_key_info.uk_start_column_name,
-                                                   foreign_key_info.uk_end_column_name)
-    INTO violation;
-
-    IF violation THEN
-        RAISE EXCEPTION 'update or delete on table "%" violates foreign key constraint "%" on table "%"',
-            foreign_key_info.uk_table_oid::regclass,
-            foreign_key_name,
-            foreign_key_info.fk_table_oid::regclass;
-    END IF;
-
-    -- check if any fk record contains any hole periods from uk
-    -- time: 1 2 3 4 5 6    | in ranges
-    --   uk: *** *** ***    | [1,2), [3,4), [5,6)
-    --   fk: ^-----^        | [1,4)
-    -- in this case, we have the following holes in `uk`: [2,3), [4,5)
-    -- if we have any `fk` record that contains such holes (such as [1,4)),
-    -- this mean that this record is referencing the `uk` for a period that it not existed.
-    EXECUTE format(QSQL_FK_CONTAINS_UK_HOLES, foreign_key_info.uk_schema_name,
-                                              foreign_key_info.uk_table_name,
-                                              replace(uk_column_names, 't.', ''),
-                                              uk_column_values,
-                                              foreign_key_info.uk_start_column_name,
-                                              foreign_key_info.uk_end_column_name,
-                                              foreign_key_info.fk_schema_name,
-                                              foreign_key_info.fk_table_name,
-                                              fk_column_names,
-                                              foreign_key_info.fk_start_column_name,
-                                              foreign_key_info.fk_end_column_name)
+    EXECUTE format(QSQL, foreign_key_info.fk_schema_name,
+                         foreign_key_info.fk_table_name,
+                         array_to_string(fk_columns, ', '),
+                         array_to_string(uk_values, ', '),
+                         foreign_key_info.fk_start_column_name,
+                         foreign_key_info.fk_end_column_name,
+                         row_data->>foreign_key_info.uk_start_column_name,
+                         row_data->>foreign_key_info.uk_end_column_name,
+                         foreign_key_info.range_type,
+                         foreign_key_info.uk_schema_name,
+                         foreign_key_info.uk_table_name,
+                         foreign_key_info.uk_start_column_name,
+                         foreign_key_info.uk_end_column_name,
+                         array_to_string(key_matches, ' AND '))
     INTO violation;
 
     IF violation THEN
@@ -1982,56 +3092,23 @@ DECLARE
 	QSQL CONSTANT text :=
         'SELECT EXISTS ( '
         '    SELECT FROM %5$I.%6$I AS fk '
-        '    WHERE NOT EXISTS ( '
-        '        SELECT FROM (SELECT uk.uk_start_value, '
-        '                            uk.uk_end_value, '
-        '                            nullif(lag(uk.uk_end_value) OVER (ORDER BY uk.uk_start_value), uk.uk_start_value) AS x '
-        '                     FROM (SELECT uk.%3$I AS uk_start_value, '
-        '                                  uk.%4$I AS uk_end_value '
-        '                           FROM %1$I.%2$I AS uk '
-        '                           WHERE %9$s '
-        '                             AND uk.%3$I <= fk.%8$I '
-        '                             AND uk.%4$I >= fk.%7$I '
-        '                           FOR KEY SHARE '
-        '                          ) AS uk '
-        '                    ) AS uk '
-        '        WHERE uk.uk_start_value < fk.%8$I '
-        '          AND uk.uk_end_value >= fk.%7$I '
-        '        HAVING min(uk.uk_start_value) <= fk.%7$I '
-        '           AND max(uk.uk_end_value) >= fk.%8$I '
-        '           AND array_agg(uk.x) FILTER (WHERE uk.x IS NOT NULL) IS NULL '
-        '    ) AND %10$s '
+        '    WHERE NOT coalesce(( '
+        '        SELECT ' || sql_saga._coverage_sql('uk.r', '%11$s(fk.%7$I, fk.%8$I)') || ' '
+        '        FROM (SELECT %11$s(uk.%3$I, uk.%4$I) AS r '
+        '              FROM %1$I.%2$I AS uk '
+        '              WHERE %9$s '
+        '                AND uk.%3$I < fk.%8$I '
+        '                AND uk.%4$I > fk.%7$I '
+        '              ORDER BY uk.%3$I '
+        '              FOR KEY SHARE '
+        '             ) AS uk '
+        '    ), false) AND %10$s '
         ')';
 
 BEGIN
-    SELECT fc.oid AS fk_table_oid,
-           fn.nspname AS fk_schema_name,
-           fc.relname AS fk_table_name,
-           fk.column_names AS fk_column_names,
-           fp.era_name AS fk_era_name,
-           fp.start_column_name AS fk_start_column_name,
-           fp.end_column_name AS fk_end_column_name,
-
-           un.nspname AS uk_schema_name,
-           uc.relname AS uk_table_name,
-           uk.column_names AS uk_column_names,
-           up.era_name AS uk_era_name,
-           up.start_column_name AS uk_start_column_name,
-           up.end_column_name AS uk_end_column_name,
-
-           fk.match_type,
-           fk.update_action,
-           fk.delete_action
+    SELECT *
     INTO foreign_key_info
-    FROM sql_saga.foreign_keys AS fk
-    JOIN sql_saga.era AS fp ON (fp.table_name, fp.era_name) = (fk.table_name, fk.era_name)
-    JOIN pg_catalog.pg_class AS fc ON fc.oid = fk.table_name
-    JOIN pg_catalog.pg_namespace AS fn ON fn.oid = fc.relnamespace
-    JOIN sql_saga.unique_keys AS uk ON uk.key_name = fk.unique_key
-    JOIN sql_saga.era AS up ON (up.table_name, up.era_name) = (uk.table_name, uk.era_name)
-    JOIN pg_catalog.pg_class AS uc ON uc.oid = uk.table_name
-    JOIN pg_catalog.pg_namespace AS un ON un.oid = uc.relnamespace
-    WHERE fk.key_name = foreign_key_name;
+    FROM sql_saga._foreign_key_info(foreign_key_name);
 
     IF NOT FOUND THEN
         RAISE EXCEPTION 'foreign key "%" not found', foreign_key_name;
@@ -2093,11 +3170,12 @@ BEGIN
                              foreign_key_info.fk_table_name,
                              foreign_key_info.fk_start_column_name,
                              foreign_key_info.fk_end_column_name,
-                             (SELECT string_agg(format('%I IS NOT DISTINCT FROM %I', ukc, fkc), ' AND ')
+                             (SELECT string_agg(format('uk.%I = fk.%I', ukc, fkc), ' AND ')
                               FROM unnest(foreign_key_info.uk_column_names,
                                           foreign_key_info.fk_column_names) AS u (ukc, fkc)
                              ),
-                             row_clause)
+                             row_clause,
+                             foreign_key_info.range_type)
         INTO violation;
 
         IF violation THEN
@@ -2647,6 +3725,23 @@ BEGIN
             r.object_identity;
     END LOOP;
 
+    ---
+    --- current_view
+    ---
+
+    /* Reject dropping the current view or its index. */
+    FOR r IN
+        SELECT dobj.object_identity, dobj.object_type
+        FROM sql_saga.current_view AS cv
+        JOIN pg_catalog.pg_event_trigger_dropped_objects() WITH ORDINALITY AS dobj
+                ON dobj.objid IN (cv.view_name, cv.index_name)
+        WHERE dobj.object_type IN ('view', 'index')
+        ORDER BY dobj.ordinality
+    LOOP
+        RAISE EXCEPTION 'cannot drop % "%", call "sql_saga.drop_current_view()" instead',
+            r.object_type, r.object_identity;
+    END LOOP;
+
     /* Complain if the FOR PORTION OF trigger is missing. */
     FOR r IN
         SELECT fpv.table_name, fpv.era_name, fpv.view_name, fpv.trigger_name
@@ -2796,7 +3891,28 @@ BEGIN
 END;
 $function$;
 
-CREATE EVENT TRIGGER sql_saga_drop_protection ON sql_drop EXECUTE PROCEDURE sql_saga.drop_protection();
+/*
+ * Event triggers fire for every DDL command in the database, so they go
+ * through a filter in C that only calls drop_protection() when the command touched
+ * one of our tables, views or range types.
+ */
+CREATE FUNCTION sql_saga._drop_protection_filter()
+ RETURNS event_trigger
+AS 'sql_saga', 'drop_protection_filter'
+LANGUAGE c;
+
+CREATE EVENT TRIGGER sql_saga_drop_protection ON sql_drop EXECUTE PROCEDURE sql_saga._drop_protection_filter();
+
+/*
+ * Loads our module before each DDL command runs, so that its object access
+ * hook sees everything the command renames or drops.
+ */
+CREATE FUNCTION sql_saga._track_ddl()
+ RETURNS event_trigger
+AS 'sql_saga', 'track_ddl'
+LANGUAGE c;
+
+CREATE EVENT TRIGGER sql_saga_track_ddl ON ddl_command_start EXECUTE PROCEDURE sql_saga._track_ddl();
 
 CREATE FUNCTION sql_saga.rename_following()
  RETURNS event_trigger
@@ -3053,7 +4169,114 @@ BEGIN
 END;
 $function$;
 
-CREATE EVENT TRIGGER sql_saga_rename_following ON ddl_command_end EXECUTE PROCEDURE sql_saga.rename_following();
+/*
+ * Update our catalogs for one rename seen by the object access hook.  Anyone
+ * can call this, so it only follows renames that really happened.
+ */
+CREATE FUNCTION sql_saga._follow_rename(object_type text, table_name regclass, old_name name, new_name name)
+ RETURNS void
+ LANGUAGE plpgsql
+ SECURITY DEFINER
+AS
+$function$
+#variable_conflict use_variable
+BEGIN
+    IF object_type = 'column' THEN
+        IF NOT EXISTS (
+                SELECT FROM pg_catalog.pg_attribute AS a
+                WHERE (a.attrelid, a.attname) = (table_name, new_name) AND NOT a.attisdropped)
+           OR EXISTS (
+                SELECT FROM pg_catalog.pg_attribute AS a
+                WHERE (a.attrelid, a.attname) = (table_name, old_name))
+        THEN
+            RETURN;
+        END IF;
+
+        UPDATE sql_saga.era AS e
+        SET start_column_name = CASE WHEN e.start_column_name = old_name THEN new_name ELSE e.start_column_name END,
+            end_column_name = CASE WHEN e.end_column_name = old_name THEN new_name ELSE e.end_column_name END
+        WHERE e.table_name = table_name
+          AND old_name IN (e.start_column_name, e.end_column_name);
+
+        UPDATE sql_saga.unique_keys AS uk
+        SET column_names = pg_catalog.array_replace(uk.column_names, old_name, new_name)
+        WHERE uk.table_name = table_name
+          AND old_name = ANY (uk.column_names);
+
+        UPDATE sql_saga.foreign_keys AS fk
+        SET column_names = pg_catalog.array_replace(fk.column_names, old_name, new_name)
+        WHERE fk.table_name = table_name
+          AND old_name = ANY (fk.column_names);
+
+    ELSIF object_type = 'constraint' THEN
+        IF NOT EXISTS (
+                SELECT FROM pg_catalog.pg_constraint AS c
+                WHERE (c.conrelid, c.conname) = (table_name, new_name))
+           OR EXISTS (
+                SELECT FROM pg_catalog.pg_constraint AS c
+                WHERE (c.conrelid, c.conname) = (table_name, old_name))
+        THEN
+            RETURN;
+        END IF;
+
+        UPDATE sql_saga.era AS e
+        SET bounds_check_constraint = new_name
+        WHERE (e.table_name, e.bounds_check_constraint) = (table_name, old_name);
+
+        UPDATE sql_saga.unique_keys AS uk
+        SET unique_constraint = CASE WHEN uk.unique_constraint = old_name THEN new_name ELSE uk.unique_constraint END,
+            exclude_constraint = CASE WHEN uk.exclude_constraint = old_name THEN new_name ELSE uk.exclude_constraint END
+        WHERE uk.table_name = table_name
+          AND old_name IN (uk.unique_constraint, uk.exclude_constraint);
+
+    ELSIF object_type = 'trigger' THEN
+        IF NOT EXISTS (
+                SELECT FROM pg_catalog.pg_trigger AS t
+                WHERE (t.tgrelid, t.tgname) = (table_name, new_name))
+           OR EXISTS (
+                SELECT FROM pg_catalog.pg_trigger AS t
+                WHERE (t.tgrelid, t.tgname) = (table_name, old_name))
+        THEN
+            RETURN;
+        END IF;
+
+        UPDATE sql_saga.api_view AS v
+        SET trigger_name = new_name
+        WHERE (v.view_name, v.trigger_name) = (table_name, old_name);
+
+        /* The overlap trigger of a btree unique key */
+        UPDATE sql_saga.unique_keys AS uk
+        SET exclude_constraint = new_name
+        WHERE (uk.table_name, uk.exclude_constraint) = (table_name, old_name);
+
+        UPDATE sql_saga.foreign_keys AS fk
+        SET fk_insert_trigger = CASE WHEN fk.fk_insert_trigger = old_name THEN new_name ELSE fk.fk_insert_trigger END,
+            fk_update_trigger = CASE WHEN fk.fk_update_trigger = old_name THEN new_name ELSE fk.fk_update_trigger END
+        WHERE fk.table_name = table_name
+          AND old_name IN (fk.fk_insert_trigger, fk.fk_update_trigger);
+
+        UPDATE sql_saga.foreign_keys AS fk
+        SET uk_update_trigger = CASE WHEN fk.uk_update_trigger = old_name THEN new_name ELSE fk.uk_update_trigger END,
+            uk_delete_trigger = CASE WHEN fk.uk_delete_trigger = old_name THEN new_name ELSE fk.uk_delete_trigger END
+        FROM sql_saga.unique_keys AS uk
+        WHERE uk.key_name = fk.unique_key
+          AND uk.table_name = table_name
+          AND old_name IN (fk.uk_update_trigger, fk.uk_delete_trigger);
+    END IF;
+END;
+$function$;
+
+/*
+ * Renames are followed in C from what the object access hook saw, and
+ * rename_following() is only called, filtered like drop_protection(), for a
+ * command that started before our module was loaded.
+ */
+CREATE FUNCTION sql_saga._rename_following_filter()
+ RETURNS event_trigger
+AS 'sql_saga', 'rename_following_filter'
+LANGUAGE c;
+
+CREATE EVENT TRIGGER sql_saga_rename_following ON ddl_command_end EXECUTE PROCEDURE sql_saga._rename_following_filter();
 
 CREATE OR REPLACE FUNCTION sql_saga.health_checks()
  RETURNS event_trigger
@@ -3128,6 +4351,14 @@ BEGIN
         JOIN pg_class AS fpt ON fpt.oid = fpv.view_name
         WHERE t.relowner <> fpt.relowner
 
+        UNION ALL
+
+        SELECT format('ALTER VIEW %s OWNER TO %I', cvt.oid::regclass, t.relowner::regrole)
+        FROM sql_saga.current_view AS cv
+        JOIN pg_class AS t ON t.oid = cv.table_name
+        JOIN pg_class AS cvt ON cvt.oid = cv.view_name
+        WHERE t.relowner <> cvt.relowner
+
         --        UNION ALL
         --
         --        SELECT format('ALTER FUNCTION %s OWNER TO %I', p.oid::regprocedure, t.relowner::regrole)
@@ -3369,7 +4600,13 @@ BEGIN
 END;
 $function$;
 
-CREATE EVENT TRIGGER sql_saga_health_checks ON ddl_command_end EXECUTE PROCEDURE sql_saga.health_checks();
+/* Filtered like drop_protection() */
+CREATE FUNCTION sql_saga._health_checks_filter()
+ RETURNS event_trigger
+AS 'sql_saga', 'health_checks_filter'
+LANGUAGE c;
+
+CREATE EVENT TRIGGER sql_saga_health_checks ON ddl_command_end EXECUTE PROCEDURE sql_saga._health_checks_filter();
 
 /* Predicates */
 
@@ -3444,3 +4681,23 @@ AS
 $function$
     SELECT sv1 = ev2;
 $function$;
+
+/*
+ * On PostgreSQL 12 and later, contains() and overlaps() of the columns of an
+ * era with a range index, like the exclusion constraint of a unique key, are
+ * planned as the range operator on that index instead of being inlined.
+ */
+CREATE FUNCTION sql_saga._predicate_support(internal)
+ RETURNS internal
+AS 'sql_saga', 'predicate_support'
+LANGUAGE c;
+
+DO $$
+BEGIN
+    IF pg_catalog.current_setting('server_version_num')::integer >= 120000 THEN
+        ALTER FUNCTION sql_saga.contains(anyelement, anyelement, anyelement) SUPPORT sql_saga._predicate_support;
+        ALTER FUNCTION sql_saga.contains(anyelement, anyelement, anyelement, anyelement) SUPPORT sql_saga._predicate_support;
+        ALTER FUNCTION sql_saga.overlaps(anyelement, anyelement, anyelement, anyelement) SUPPORT sql_saga._predicate_support;
+    END IF;
+END;
+$$;
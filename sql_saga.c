@@ -1,27 +1,66 @@
 /**
  * sql_saga.c -
- * TODO:
- * Install a hook so we can get called with a table/column is dropped/renamed,
- * so that we can drop/update our constraints as necessary.
+ * Module initialization, the backend-local cache of our catalogs, and the
+ * object access hook that follows renames and drops of the objects named in
+ * them.
  */
 
 #include <postgres.h>
 #include <fmgr.h>
+#include <access/genam.h>
+#include <access/htup_details.h>
+#include <access/heapam.h>
+#if (PG_VERSION_NUM < 120000)
+#define table_open(r, l)	heap_open(r, l)
+#define table_close(r, l)	heap_close(r, l)
+#else
+#include <access/table.h>
+#endif
+#include <access/xact.h>
 #include <catalog/dependency.h>
+#include <catalog/indexing.h>
+#include <catalog/namespace.h>
 #include <catalog/objectaccess.h>
+#include <catalog/pg_attrdef.h>
 #include <catalog/pg_class.h>
+#include <catalog/pg_constraint.h>
+#include <catalog/pg_trigger.h>
+#include <catalog/pg_type.h>
+#include <commands/event_trigger.h>
+#include <commands/trigger.h>
+#include <executor/spi.h>
+#include <funcapi.h>
+#include <nodes/parsenodes.h>
+#include <nodes/value.h>
+#include <parser/parse_func.h>
+#include <pgstat.h>
+#include <utils/array.h>
+#include <utils/builtins.h>
+#include <utils/fmgroids.h>
+#include <utils/hsearch.h>
+#include <utils/inval.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/rel.h>
+#include <utils/syscache.h>
+
+#include "sql_saga.h"
+
+#if (PG_VERSION_NUM < 110000)
+#define get_attname(relid, attnum, missing_ok)	get_attname(relid, attnum)
+#endif
+#if (PG_VERSION_NUM < 120000)
+#define Anum_pg_trigger_oid		ObjectIdAttributeNumber
+#define Anum_pg_attrdef_oid		ObjectIdAttributeNumber
+#endif
 
 /*
 #include <pg_config.h>
 #include <miscadmin.h>
-#include <utils/array.h>
 #include <utils/guc.h>
 #include <utils/acl.h>
-#include <utils/lsyscache.h>
-#include <utils/builtins.h>
 #include <utils/rangetypes.h>
 #include <utils/timestamp.h>
-#include <catalog/pg_type.h>
 #include <catalog/catalog.h>
 #include <catalog/pg_tablespace.h>
 #include <commands/tablespace.h>
@@ -33,9 +72,1431 @@ PG_MODULE_MAGIC;
 void _PG_init(void);
 void _PG_fini(void);
 
+PGDLLEXPORT Datum invalidate_cache(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum foreign_key_info(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum drop_protection_filter(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum rename_following_filter(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum health_checks_filter(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum track_ddl(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(invalidate_cache);
+PG_FUNCTION_INFO_V1(foreign_key_info);
+PG_FUNCTION_INFO_V1(drop_protection_filter);
+PG_FUNCTION_INFO_V1(rename_following_filter);
+PG_FUNCTION_INFO_V1(health_checks_filter);
+PG_FUNCTION_INFO_V1(track_ddl);
+
+/*
+ * The lookups done by our triggers always go through the same joins over our
+ * catalogs, so we keep the results in backend-local hash tables.
+ *
+ * Entries are never removed, only marked invalid, so that a pointer obtained
+ * by a caller doesn't dangle if an invalidation arrives while it is running a
+ * query.  The next lookup reloads the entry in place.
+ *
+ * Our catalogs are ordinary tables and changing them doesn't send any
+ * invalidation messages, so they have a statement trigger that sends a
+ * relcache invalidation for the catalog itself.  That reaches every backend
+ * once the transaction commits, and our own backend at the next command.
+ */
+static HTAB *ForeignKeyCache = NULL;
+static HTAB *UniqueKeyCache = NULL;
+static HTAB *EraCache = NULL;
+static HTAB *ApiViewCache = NULL;
+
+typedef struct SagaApiView
+{
+	Oid			view_relid;		/* the hash key; must be first */
+	bool		valid;
+	SagaEraKey	era;
+} SagaApiView;
+
+static uint32 cache_generation = 0;
+
+/*
+ * The oids of every relation and range type named in our catalogs, for the
+ * event trigger filters.
+ */
+static HTAB *ManagedObjects = NULL;
+static bool managed_objects_valid = false;
+static uint32 managed_objects_invalidations = 0;
+
+/*
+ * What the object access hook saw the current transaction rename and drop.
+ * Renames keep the old name, because by the time our event triggers run the
+ * catalogs only have the new one.  Drops keep the relation the object
+ * belonged to.  Both lists live in TopTransactionContext.
+ */
+typedef struct SagaRename
+{
+	const char *object_type;	/* "column", "constraint" or "trigger" */
+	Oid			relid;
+	Oid			objectid;		/* the constraint or trigger */
+	AttrNumber	attnum;			/* the column */
+	NameData	old_name;
+} SagaRename;
+
+static List *pending_renames = NIL;
+static List *pending_drops = NIL;
+
+/*
+ * Whether the hook has been installed since before the current command
+ * started, so that the lists above are complete.
+ */
+static bool tracking_ddl = false;
+
+static object_access_hook_type prev_object_access_hook = NULL;
+
+/* The oids of our catalog tables, once we know them */
+#define SAGA_CATALOG_COUNT 5
+static Oid	catalog_relids[SAGA_CATALOG_COUNT];
+static bool catalog_relids_known = false;
+
+static void
+InvalidateCaches(void)
+{
+	HASH_SEQ_STATUS status;
+
+	if (ForeignKeyCache != NULL)
+	{
+		SagaForeignKey *fk;
+
+		hash_seq_init(&status, ForeignKeyCache);
+		while ((fk = (SagaForeignKey *) hash_seq_search(&status)) != NULL)
+			fk->valid = false;
+	}
+
+	if (UniqueKeyCache != NULL)
+	{
+		SagaUniqueKey *uk;
+
+		hash_seq_init(&status, UniqueKeyCache);
+		while ((uk = (SagaUniqueKey *) hash_seq_search(&status)) != NULL)
+			uk->valid = false;
+	}
+
+	if (EraCache != NULL)
+	{
+		SagaEra *era;
+
+		hash_seq_init(&status, EraCache);
+		while ((era = (SagaEra *) hash_seq_search(&status)) != NULL)
+			era->valid = false;
+	}
+
+	if (ApiViewCache != NULL)
+	{
+		SagaApiView *view;
+
+		hash_seq_init(&status, ApiViewCache);
+		while ((view = (SagaApiView *) hash_seq_search(&status)) != NULL)
+			view->valid = false;
+	}
+
+	managed_objects_valid = false;
+	managed_objects_invalidations++;
+	catalog_relids_known = false;
+}
+
+/*
+ * Relcache callback.  We can't look anything up in here, so just mark
+ * whatever might be affected as invalid.
+ */
+static void
+sql_saga_relcache_callback(Datum arg, Oid relid)
+{
+	HASH_SEQ_STATUS status;
+	int			i;
+
+	if (!OidIsValid(relid))
+	{
+		InvalidateCaches();
+		return;
+	}
+
+	if (catalog_relids_known)
+	{
+		for (i = 0; i < SAGA_CATALOG_COUNT; i++)
+		{
+			if (catalog_relids[i] == relid)
+			{
+				InvalidateCaches();
+				return;
+			}
+		}
+	}
+
+	if (managed_objects_valid &&
+		hash_search(ManagedObjects, &relid, HASH_FIND, NULL) != NULL)
+	{
+		managed_objects_valid = false;
+		managed_objects_invalidations++;
+	}
+
+	if (ForeignKeyCache != NULL)
+	{
+		SagaForeignKey *fk;
+
+		hash_seq_init(&status, ForeignKeyCache);
+		while ((fk = (SagaForeignKey *) hash_seq_search(&status)) != NULL)
+		{
+			if (fk->fk_relid == relid || fk->uk_relid == relid)
+				fk->valid = false;
+		}
+	}
+
+	if (UniqueKeyCache != NULL)
+	{
+		SagaUniqueKey *uk;
+
+		hash_seq_init(&status, UniqueKeyCache);
+		while ((uk = (SagaUniqueKey *) hash_seq_search(&status)) != NULL)
+		{
+			if (uk->relid == relid)
+				uk->valid = false;
+		}
+	}
+
+	if (EraCache != NULL)
+	{
+		SagaEra *era;
+
+		hash_seq_init(&status, EraCache);
+		while ((era = (SagaEra *) hash_seq_search(&status)) != NULL)
+		{
+			if (era->key.relid == relid)
+				era->valid = false;
+		}
+	}
+
+	if (ApiViewCache != NULL)
+	{
+		SagaApiView *view;
+
+		hash_seq_init(&status, ApiViewCache);
+		while ((view = (SagaApiView *) hash_seq_search(&status)) != NULL)
+		{
+			if (view->view_relid == relid || view->era.relid == relid)
+				view->valid = false;
+		}
+	}
+}
+
+/*
+ * Syscache callback for pg_namespace.  Renaming a schema doesn't touch the
+ * relcache, but we cache schema names.
+ */
+static void
+sql_saga_syscache_callback(Datum arg, int cacheid, uint32 hashvalue)
+{
+	InvalidateCaches();
+}
+
+static HTAB *
+CreateCache(const char *name, Size keysize, Size entrysize)
+{
+	HASHCTL	ctl;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = keysize;
+	ctl.entrysize = entrysize;
+
+	return hash_create(name, 16, &ctl, HASH_ELEM | HASH_BLOBS);
+}
+
+static void
+RememberCatalogRelids(void)
+{
+	Oid		nspid;
+
+	if (catalog_relids_known)
+		return;
+
+	nspid = get_namespace_oid("sql_saga", false);
+	catalog_relids[0] = get_relname_relid("era", nspid);
+	catalog_relids[1] = get_relname_relid("unique_keys", nspid);
+	catalog_relids[2] = get_relname_relid("foreign_keys", nspid);
+	catalog_relids[3] = get_relname_relid("api_view", nspid);
+	catalog_relids[4] = get_relname_relid("current_view", nspid);
+	catalog_relids_known = true;
+}
+
+static AttrNumber
+GetAttnumOrError(Oid relid, const char *attname)
+{
+	AttrNumber	attnum = get_attnum(relid, attname);
+
+	if (attnum == InvalidAttrNumber)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("column \"%s\" of relation \"%s\" does not exist",
+						attname, get_rel_name(relid))));
+
+	return attnum;
+}
+
+static void
+CopyNameArray(Datum array, NameData *names, int *count)
+{
+	Datum  *elems;
+	int		nelems;
+	int		i;
+
+	deconstruct_array(DatumGetArrayTypeP(array),
+					  NAMEOID, NAMEDATALEN, false, 'c',
+					  &elems, NULL, &nelems);
+
+	if (nelems > INDEX_MAX_KEYS)
+		elog(ERROR, "too many key columns: %d", nelems);
+
+	for (i = 0; i < nelems; i++)
+		namestrcpy(&names[i], NameStr(*DatumGetName(elems[i])));
+
+	*count = nelems;
+}
+
+static void
+LoadForeignKey(SagaForeignKey *fk)
+{
+	int				ret;
+	int				i;
+	int				nuk;
+	Datum			values[1];
+	HeapTuple		tuple;
+	TupleDesc		tupdesc;
+	bool			isnull;
+	char		   *match_type;
+
+	const char *sql =
+		"SELECT fk.table_name, fk.era_name, fk.column_names, "
+		"       fp.start_column_name, fp.end_column_name, "
+		"       uk.key_name, uk.table_name, uk.era_name, uk.column_names, "
+		"       up.start_column_name, up.end_column_name, up.range_type, "
+		"       fk.match_type::text, fk.update_action::text, fk.delete_action::text "
+		"FROM sql_saga.foreign_keys AS fk "
+		"JOIN sql_saga.era AS fp ON (fp.table_name, fp.era_name) = (fk.table_name, fk.era_name) "
+		"JOIN sql_saga.unique_keys AS uk ON uk.key_name = fk.unique_key "
+		"JOIN sql_saga.era AS up ON (up.table_name, up.era_name) = (uk.table_name, uk.era_name) "
+		"WHERE fk.key_name = $1";
+	static SPIPlanPtr qplan = NULL;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	if (qplan == NULL)
+	{
+		Oid	types[1] = {NAMEOID};
+
+		qplan = SPI_prepare(sql, 1, types);
+		if (qplan == NULL)
+			elog(ERROR, "SPI_prepare returned %s for %s",
+				 SPI_result_code_string(SPI_result), sql);
+
+		ret = SPI_keepplan(qplan);
+		if (ret != 0)
+			elog(ERROR, "SPI_keepplan returned %s", SPI_result_code_string(ret));
+	}
+
+	values[0] = NameGetDatum(&fk->key_name);
+	ret = SPI_execute_plan(qplan, values, NULL, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	if (SPI_processed == 0)
+	{
+		if (SPI_finish() != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish failed");
+		return;
+	}
+
+	/* key_name is the primary key so there shouldn't be more than 1 row */
+	Assert(SPI_processed == 1);
+
+	tuple = SPI_tuptable->vals[0];
+	tupdesc = SPI_tuptable->tupdesc;
+
+	fk->fk_relid = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+	namestrcpy(&fk->fk_era_name, NameStr(*DatumGetName(SPI_getbinval(tuple, tupdesc, 2, &isnull))));
+	CopyNameArray(SPI_getbinval(tuple, tupdesc, 3, &isnull), fk->fk_column_names, &fk->nkeys);
+	namestrcpy(&fk->fk_start_column_name, NameStr(*DatumGetName(SPI_getbinval(tuple, tupdesc, 4, &isnull))));
+	namestrcpy(&fk->fk_end_column_name, NameStr(*DatumGetName(SPI_getbinval(tuple, tupdesc, 5, &isnull))));
+
+	namestrcpy(&fk->unique_key_name, NameStr(*DatumGetName(SPI_getbinval(tuple, tupdesc, 6, &isnull))));
+	fk->uk_relid = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 7, &isnull));
+	namestrcpy(&fk->uk_era_name, NameStr(*DatumGetName(SPI_getbinval(tuple, tupdesc, 8, &isnull))));
+	CopyNameArray(SPI_getbinval(tuple, tupdesc, 9, &isnull), fk->uk_column_names, &nuk);
+	namestrcpy(&fk->uk_start_column_name, NameStr(*DatumGetName(SPI_getbinval(tuple, tupdesc, 10, &isnull))));
+	namestrcpy(&fk->uk_end_column_name, NameStr(*DatumGetName(SPI_getbinval(tuple, tupdesc, 11, &isnull))));
+	fk->range_type = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 12, &isnull));
+
+	match_type = TextDatumGetCString(SPI_getbinval(tuple, tupdesc, 13, &isnull));
+	if (strcmp(match_type, "FULL") == 0)
+		fk->match_type = FKCONSTR_MATCH_FULL;
+	else if (strcmp(match_type, "PARTIAL") == 0)
+		fk->match_type = FKCONSTR_MATCH_PARTIAL;
+	else
+		fk->match_type = FKCONSTR_MATCH_SIMPLE;
+	namestrcpy(&fk->update_action, TextDatumGetCString(SPI_getbinval(tuple, tupdesc, 14, &isnull)));
+	namestrcpy(&fk->delete_action, TextDatumGetCString(SPI_getbinval(tuple, tupdesc, 15, &isnull)));
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+
+	if (nuk != fk->nkeys)
+		elog(ERROR, "foreign key \"%s\" and unique key \"%s\" have different numbers of columns",
+			 NameStr(fk->key_name), NameStr(fk->unique_key_name));
+
+	/* Resolve everything else */
+	namestrcpy(&fk->fk_schema_name, get_namespace_name(get_rel_namespace(fk->fk_relid)));
+	namestrcpy(&fk->fk_table_name, get_rel_name(fk->fk_relid));
+	namestrcpy(&fk->uk_schema_name, get_namespace_name(get_rel_namespace(fk->uk_relid)));
+	namestrcpy(&fk->uk_table_name, get_rel_name(fk->uk_relid));
+
+	for (i = 0; i < fk->nkeys; i++)
+	{
+		fk->fk_attnums[i] = GetAttnumOrError(fk->fk_relid, NameStr(fk->fk_column_names[i]));
+		fk->fk_types[i] = get_atttype(fk->fk_relid, fk->fk_attnums[i]);
+		fk->uk_attnums[i] = GetAttnumOrError(fk->uk_relid, NameStr(fk->uk_column_names[i]));
+	}
+
+	fk->fk_start_attnum = GetAttnumOrError(fk->fk_relid, NameStr(fk->fk_start_column_name));
+	fk->fk_end_attnum = GetAttnumOrError(fk->fk_relid, NameStr(fk->fk_end_column_name));
+	fk->uk_start_attnum = GetAttnumOrError(fk->uk_relid, NameStr(fk->uk_start_column_name));
+	fk->uk_end_attnum = GetAttnumOrError(fk->uk_relid, NameStr(fk->uk_end_column_name));
+	fk->element_type = get_atttype(fk->fk_relid, fk->fk_start_attnum);
+
+	fk->generation = ++cache_generation;
+	fk->valid = true;
+}
+
+const SagaForeignKey *
+SagaLookupForeignKey(const char *key_name, bool missing_ok)
+{
+	SagaForeignKey *fk;
+	NameData		key;
+	bool			found;
+
+	if (ForeignKeyCache == NULL)
+		ForeignKeyCache = CreateCache("sql_saga foreign keys", sizeof(NameData), sizeof(SagaForeignKey));
+
+	memset(&key, 0, sizeof(key));
+	namestrcpy(&key, key_name);
+
+	fk = (SagaForeignKey *) hash_search(ForeignKeyCache, &key, HASH_ENTER, &found);
+	if (!found)
+		fk->valid = false;
+
+	if (!fk->valid)
+	{
+		RememberCatalogRelids();
+		LoadForeignKey(fk);
+	}
+
+	if (fk->valid)
+		return fk;
+
+	if (!missing_ok)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("foreign key \"%s\" not found", key_name)));
+
+	return NULL;
+}
+
+static void
+LoadUniqueKey(SagaUniqueKey *uk)
+{
+	int				ret;
+	int				i;
+	Datum			values[1];
+	HeapTuple		tuple;
+	TupleDesc		tupdesc;
+	bool			isnull;
+
+	const char *sql =
+		"SELECT uk.table_name, uk.era_name, uk.column_names, "
+		"       e.start_column_name, e.end_column_name, uk.exclude_constraint "
+		"FROM sql_saga.unique_keys AS uk "
+		"JOIN sql_saga.era AS e ON (e.table_name, e.era_name) = (uk.table_name, uk.era_name) "
+		"WHERE uk.key_name = $1";
+	static SPIPlanPtr qplan = NULL;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	if (qplan == NULL)
+	{
+		Oid	types[1] = {NAMEOID};
+
+		qplan = SPI_prepare(sql, 1, types);
+		if (qplan == NULL)
+			elog(ERROR, "SPI_prepare returned %s for %s",
+				 SPI_result_code_string(SPI_result), sql);
+
+		ret = SPI_keepplan(qplan);
+		if (ret != 0)
+			elog(ERROR, "SPI_keepplan returned %s", SPI_result_code_string(ret));
+	}
+
+	values[0] = NameGetDatum(&uk->key_name);
+	ret = SPI_execute_plan(qplan, values, NULL, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	if (SPI_processed == 0)
+	{
+		if (SPI_finish() != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish failed");
+		return;
+	}
+
+	/* key_name is the primary key so there shouldn't be more than 1 row */
+	Assert(SPI_processed == 1);
+
+	tuple = SPI_tuptable->vals[0];
+	tupdesc = SPI_tuptable->tupdesc;
+
+	uk->relid = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+	namestrcpy(&uk->era_name, NameStr(*DatumGetName(SPI_getbinval(tuple, tupdesc, 2, &isnull))));
+	CopyNameArray(SPI_getbinval(tuple, tupdesc, 3, &isnull), uk->column_names, &uk->nkeys);
+	namestrcpy(&uk->start_column_name, NameStr(*DatumGetName(SPI_getbinval(tuple, tupdesc, 4, &isnull))));
+	namestrcpy(&uk->end_column_name, NameStr(*DatumGetName(SPI_getbinval(tuple, tupdesc, 5, &isnull))));
+	namestrcpy(&uk->exclude_constraint, NameStr(*DatumGetName(SPI_getbinval(tuple, tupdesc, 6, &isnull))));
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+
+	/* Resolve everything else */
+	namestrcpy(&uk->schema_name, get_namespace_name(get_rel_namespace(uk->relid)));
+	namestrcpy(&uk->table_name, get_rel_name(uk->relid));
+
+	for (i = 0; i < uk->nkeys; i++)
+	{
+		uk->attnums[i] = GetAttnumOrError(uk->relid, NameStr(uk->column_names[i]));
+		uk->types[i] = get_atttype(uk->relid, uk->attnums[i]);
+	}
+
+	uk->start_attnum = GetAttnumOrError(uk->relid, NameStr(uk->start_column_name));
+	uk->end_attnum = GetAttnumOrError(uk->relid, NameStr(uk->end_column_name));
+	uk->element_type = get_atttype(uk->relid, uk->start_attnum);
+
+	uk->generation = ++cache_generation;
+	uk->valid = true;
+}
+
+const SagaUniqueKey *
+SagaLookupUniqueKey(const char *key_name, bool missing_ok)
+{
+	SagaUniqueKey  *uk;
+	NameData		key;
+	bool			found;
+
+	if (UniqueKeyCache == NULL)
+		UniqueKeyCache = CreateCache("sql_saga unique keys", sizeof(NameData), sizeof(SagaUniqueKey));
+
+	memset(&key, 0, sizeof(key));
+	namestrcpy(&key, key_name);
+
+	uk = (SagaUniqueKey *) hash_search(UniqueKeyCache, &key, HASH_ENTER, &found);
+	if (!found)
+		uk->valid = false;
+
+	if (!uk->valid)
+	{
+		RememberCatalogRelids();
+		LoadUniqueKey(uk);
+	}
+
+	if (uk->valid)
+		return uk;
+
+	if (!missing_ok)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("unique key \"%s\" not found", key_name)));
+
+	return NULL;
+}
+
+static void
+LoadEra(SagaEra *era)
+{
+	int				ret;
+	Datum			values[2];
+	HeapTuple		tuple;
+	TupleDesc		tupdesc;
+	bool			isnull;
+	Oid				collation;
+
+	const char *sql =
+		"SELECT e.start_column_name, e.end_column_name, e.range_type "
+		"FROM sql_saga.era AS e "
+		"WHERE (e.table_name, e.era_name) = ($1, $2)";
+	static SPIPlanPtr qplan = NULL;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	if (qplan == NULL)
+	{
+		Oid	types[2] = {OIDOID, NAMEOID};
+
+		qplan = SPI_prepare(sql, 2, types);
+		if (qplan == NULL)
+			elog(ERROR, "SPI_prepare returned %s for %s",
+				 SPI_result_code_string(SPI_result), sql);
+
+		ret = SPI_keepplan(qplan);
+		if (ret != 0)
+			elog(ERROR, "SPI_keepplan returned %s", SPI_result_code_string(ret));
+	}
+
+	values[0] = ObjectIdGetDatum(era->key.relid);
+	values[1] = NameGetDatum(&era->key.era_name);
+	ret = SPI_execute_plan(qplan, values, NULL, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	if (SPI_processed == 0)
+	{
+		if (SPI_finish() != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish failed");
+		return;
+	}
+
+	/* There is a primary key so there shouldn't be more than 1 row */
+	Assert(SPI_processed == 1);
+
+	tuple = SPI_tuptable->vals[0];
+	tupdesc = SPI_tuptable->tupdesc;
+
+	namestrcpy(&era->start_column_name, NameStr(*DatumGetName(SPI_getbinval(tuple, tupdesc, 1, &isnull))));
+	namestrcpy(&era->end_column_name, NameStr(*DatumGetName(SPI_getbinval(tuple, tupdesc, 2, &isnull))));
+	era->range_type = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 3, &isnull));
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+
+	era->start_attnum = GetAttnumOrError(era->key.relid, NameStr(era->start_column_name));
+	era->end_attnum = GetAttnumOrError(era->key.relid, NameStr(era->end_column_name));
+	get_atttypetypmodcoll(era->key.relid, era->start_attnum,
+						  &era->element_type, &era->element_typmod, &collation);
+
+	era->generation = ++cache_generation;
+	era->valid = true;
+}
+
+const SagaEra *
+SagaLookupEra(Oid relid, const char *era_name, bool missing_ok)
+{
+	SagaEra	   *era;
+	SagaEraKey	key;
+	bool		found;
+
+	if (EraCache == NULL)
+		EraCache = CreateCache("sql_saga eras", sizeof(SagaEraKey), sizeof(SagaEra));
+
+	memset(&key, 0, sizeof(key));
+	key.relid = relid;
+	namestrcpy(&key.era_name, era_name);
+
+	era = (SagaEra *) hash_search(EraCache, &key, HASH_ENTER, &found);
+	if (!found)
+		era->valid = false;
+
+	if (!era->valid)
+	{
+		RememberCatalogRelids();
+		LoadEra(era);
+	}
+
+	if (era->valid)
+		return era;
+
+	if (!missing_ok)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("era \"%s\" not found for table \"%s\"",
+						era_name, get_rel_name(relid))));
+
+	return NULL;
+}
+
+static void
+LoadApiView(SagaApiView *view)
+{
+	int				ret;
+	Datum			values[1];
+	HeapTuple		tuple;
+	TupleDesc		tupdesc;
+	bool			isnull;
+
+	const char *sql =
+		"SELECT v.table_name, v.era_name "
+		"FROM sql_saga.api_view AS v "
+		"WHERE v.view_name = $1";
+	static SPIPlanPtr qplan = NULL;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	if (qplan == NULL)
+	{
+		Oid	types[1] = {OIDOID};
+
+		qplan = SPI_prepare(sql, 1, types);
+		if (qplan == NULL)
+			elog(ERROR, "SPI_prepare returned %s for %s",
+				 SPI_result_code_string(SPI_result), sql);
+
+		ret = SPI_keepplan(qplan);
+		if (ret != 0)
+			elog(ERROR, "SPI_keepplan returned %s", SPI_result_code_string(ret));
+	}
+
+	values[0] = ObjectIdGetDatum(view->view_relid);
+	ret = SPI_execute_plan(qplan, values, NULL, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	if (SPI_processed > 0)
+	{
+		tuple = SPI_tuptable->vals[0];
+		tupdesc = SPI_tuptable->tupdesc;
+
+		memset(&view->era, 0, sizeof(view->era));
+		view->era.relid = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+		namestrcpy(&view->era.era_name, NameStr(*DatumGetName(SPI_getbinval(tuple, tupdesc, 2, &isnull))));
+		view->valid = true;
+	}
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+}
+
+const SagaEra *
+SagaLookupApiView(Oid view_relid, bool missing_ok)
+{
+	SagaApiView *view;
+	bool		found;
+
+	if (ApiViewCache == NULL)
+		ApiViewCache = CreateCache("sql_saga api views", sizeof(Oid), sizeof(SagaApiView));
+
+	view = (SagaApiView *) hash_search(ApiViewCache, &view_relid, HASH_ENTER, &found);
+	if (!found)
+		view->valid = false;
+
+	if (!view->valid)
+	{
+		RememberCatalogRelids();
+		LoadApiView(view);
+	}
+
+	if (view->valid)
+		return SagaLookupEra(view->era.relid, NameStr(view->era.era_name), missing_ok);
+
+	if (!missing_ok)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("table and era information not found for view \"%s\"",
+						get_rel_name(view_relid))));
+
+	return NULL;
+}
+
+/*
+ * invalidate_cache -
+ * Statement trigger on our catalogs telling every backend to forget what it
+ * has cached.
+ */
+Datum
+invalidate_cache(PG_FUNCTION_ARGS)
+{
+	TriggerData	   *trigdata = (TriggerData *) fcinfo->context;
+
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" was not called by trigger manager",
+						"invalidate_cache")));
+
+	CacheInvalidateRelcacheByRelid(RelationGetRelid(trigdata->tg_relation));
+
+	return PointerGetDatum(NULL);
+}
+
+static Datum
+NameArrayGetDatum(const NameData *names, int count)
+{
+	Datum	elems[INDEX_MAX_KEYS];
+	int		i;
+
+	for (i = 0; i < count; i++)
+		elems[i] = NameGetDatum(&names[i]);
+
+	return PointerGetDatum(construct_array(elems, count, NAMEOID, NAMEDATALEN, false, 'c'));
+}
+
+/*
+ * foreign_key_info -
+ * Returns the cached information about a foreign key, or no rows if it
+ * doesn't exist.  This is used by the plpgsql functions that don't have a C
+ * implementation yet.
+ */
+Datum
+foreign_key_info(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext	oldcontext;
+		TupleDesc		tupdesc;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+
+	if (funcctx->call_cntr == 0)
+	{
+		const SagaForeignKey *fk = SagaLookupForeignKey(NameStr(*PG_GETARG_NAME(0)), true);
+
+		if (fk != NULL)
+		{
+			Datum		values[19];
+			bool		nulls[19];
+			HeapTuple	tuple;
+
+			memset(nulls, 0, sizeof(nulls));
+
+			values[0] = ObjectIdGetDatum(fk->fk_relid);
+			values[1] = NameGetDatum(&fk->fk_schema_name);
+			values[2] = NameGetDatum(&fk->fk_table_name);
+			values[3] = NameArrayGetDatum(fk->fk_column_names, fk->nkeys);
+			values[4] = NameGetDatum(&fk->fk_era_name);
+			values[5] = NameGetDatum(&fk->fk_start_column_name);
+			values[6] = NameGetDatum(&fk->fk_end_column_name);
+			values[7] = ObjectIdGetDatum(fk->uk_relid);
+			values[8] = NameGetDatum(&fk->uk_schema_name);
+			values[9] = NameGetDatum(&fk->uk_table_name);
+			values[10] = NameArrayGetDatum(fk->uk_column_names, fk->nkeys);
+			values[11] = NameGetDatum(&fk->uk_era_name);
+			values[12] = NameGetDatum(&fk->uk_start_column_name);
+			values[13] = NameGetDatum(&fk->uk_end_column_name);
+			values[14] = CStringGetTextDatum(fk->match_type == FKCONSTR_MATCH_FULL ? "FULL" :
+											 fk->match_type == FKCONSTR_MATCH_PARTIAL ? "PARTIAL" :
+											 "SIMPLE");
+			values[15] = CStringGetTextDatum(NameStr(fk->update_action));
+			values[16] = CStringGetTextDatum(NameStr(fk->delete_action));
+			values[17] = NameGetDatum(&fk->unique_key_name);
+			values[18] = ObjectIdGetDatum(fk->range_type);
+
+			tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+			SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+		}
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
+
+/*
+ * Load the oids of everything named in our catalogs.  A relcache invalidation
+ * for any of these relations throws the set away, because it may have gained
+ * an index or a trigger that our checks care about.
+ */
+static void
+LoadManagedObjects(void)
+{
+	int				ret;
+	uint64			i;
+	bool			isnull;
+	uint32			invalidations = managed_objects_invalidations;
+
+	const char *sql =
+		"SELECT e.table_name::oid FROM sql_saga.era AS e "
+		"UNION SELECT e.range_type::oid FROM sql_saga.era AS e "
+		"UNION SELECT e.audit_table_name::oid FROM sql_saga.era AS e WHERE e.audit_table_name IS NOT NULL "
+		"UNION SELECT v.view_name::oid FROM sql_saga.api_view AS v "
+		"UNION SELECT v.view_name::oid FROM sql_saga.current_view AS v "
+		"UNION SELECT v.index_name::oid FROM sql_saga.current_view AS v";
+	static SPIPlanPtr qplan = NULL;
+
+	if (ManagedObjects == NULL)
+		ManagedObjects = CreateCache("sql_saga managed objects", sizeof(Oid), sizeof(Oid));
+	else
+	{
+		HASH_SEQ_STATUS status;
+		Oid		   *entry;
+
+		hash_seq_init(&status, ManagedObjects);
+		while ((entry = (Oid *) hash_seq_search(&status)) != NULL)
+			hash_search(ManagedObjects, entry, HASH_REMOVE, NULL);
+	}
+
+	RememberCatalogRelids();
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	if (qplan == NULL)
+	{
+		qplan = SPI_prepare(sql, 0, NULL);
+		if (qplan == NULL)
+			elog(ERROR, "SPI_prepare returned %s for %s",
+				 SPI_result_code_string(SPI_result), sql);
+
+		ret = SPI_keepplan(qplan);
+		if (ret != 0)
+			elog(ERROR, "SPI_keepplan returned %s", SPI_result_code_string(ret));
+	}
+
+	ret = SPI_execute_plan(qplan, NULL, NULL, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	for (i = 0; i < SPI_processed; i++)
+	{
+		Oid		oid = DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[i],
+													 SPI_tuptable->tupdesc, 1, &isnull));
+
+		hash_search(ManagedObjects, &oid, HASH_ENTER, NULL);
+	}
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+
+	/* If something was invalidated while we were loading, load again next time */
+	managed_objects_valid = (invalidations == managed_objects_invalidations);
+}
+
+/*
+ * Run a query returning one oid per object touched by the current command and
+ * tell whether any of them is ours.  A null oid means the query couldn't tell
+ * what was touched, which we take as a yes.
+ */
+static bool
+AnyManagedObject(const char *sql)
+{
+	int		ret;
+	uint64	i;
+	bool	found = false;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	ret = SPI_execute(sql, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+
+	for (i = 0; i < SPI_processed && !found; i++)
+	{
+		bool	isnull;
+		Oid		oid = DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[i],
+													 SPI_tuptable->tupdesc, 1, &isnull));
+
+		if (isnull || hash_search(ManagedObjects, &oid, HASH_FIND, NULL) != NULL)
+			found = true;
+	}
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+
+	return found;
+}
+
+/*
+ * Did the GRANT or REVOKE name one of our relations?  Grants on other kinds
+ * of objects are of no interest to us, and we don't try to work out the
+ * relations of a whole schema.
+ */
+static bool
+GrantMayAffectSaga(GrantStmt *stmt)
+{
+	ListCell   *lc;
+
+	if (stmt->targtype != ACL_TARGET_OBJECT)
+		return true;
+
+#if (PG_VERSION_NUM < 100000)
+	if (stmt->objtype != ACL_OBJECT_RELATION)
+		return false;
+#else
+	if (stmt->objtype != OBJECT_TABLE)
+		return false;
+#endif
+
+	foreach(lc, stmt->objects)
+	{
+		Oid		relid = RangeVarGetRelid((RangeVar *) lfirst(lc), NoLock, true);
+
+		if (OidIsValid(relid) &&
+			hash_search(ManagedObjects, &relid, HASH_FIND, NULL) != NULL)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Fetch a copy of the row of a catalog without a syscache by its oid, or NULL
+ * if there isn't one.
+ */
+static HeapTuple
+GetCatalogTupleByOid(Oid catalogid, Oid indexid, AttrNumber oidattnum, Oid objectid)
+{
+	Relation	rel;
+	ScanKeyData key;
+	SysScanDesc scan;
+	HeapTuple	tuple;
+
+	rel = table_open(catalogid, AccessShareLock);
+	ScanKeyInit(&key, oidattnum, BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(objectid));
+	scan = systable_beginscan(rel, indexid, true, NULL, 1, &key);
+
+	tuple = systable_getnext(scan);
+	if (HeapTupleIsValid(tuple))
+		tuple = heap_copytuple(tuple);
+
+	systable_endscan(scan);
+	table_close(rel, AccessShareLock);
+
+	return tuple;
+}
+
+/*
+ * The current name of the object of a rename, or NULL if it is gone.
+ */
+static char *
+GetCurrentName(const SagaRename *rename)
+{
+	HeapTuple	tuple;
+	char	   *name = NULL;
+
+	if (strcmp(rename->object_type, "column") == 0)
+		return get_attname(rename->relid, rename->attnum, true);
+
+	if (strcmp(rename->object_type, "constraint") == 0)
+	{
+		tuple = SearchSysCache1(CONSTROID, ObjectIdGetDatum(rename->objectid));
+		if (HeapTupleIsValid(tuple))
+		{
+			name = pstrdup(NameStr(((Form_pg_constraint) GETSTRUCT(tuple))->conname));
+			ReleaseSysCache(tuple);
+		}
+		return name;
+	}
+
+	tuple = GetCatalogTupleByOid(TriggerRelationId, TriggerOidIndexId,
+								 Anum_pg_trigger_oid, rename->objectid);
+	if (HeapTupleIsValid(tuple))
+		name = pstrdup(NameStr(((Form_pg_trigger) GETSTRUCT(tuple))->tgname));
+	return name;
+}
+
+/*
+ * Only what belongs to one of our relations is of interest, but when the set
+ * of those isn't loaded we keep everything rather than load it in here.
+ */
+static bool
+MaybeManaged(Oid relid)
+{
+	return !managed_objects_valid ||
+		hash_search(ManagedObjects, &relid, HASH_FIND, NULL) != NULL;
+}
+
+/*
+ * Called after a column, constraint or trigger was altered, before the
+ * command counter is incremented, so the caches still have the old row.
+ */
+static void
+RememberRename(Oid classId, Oid objectId, int subId)
+{
+	SagaRename	rename;
+	SagaRename *entry;
+	HeapTuple	tuple;
+	MemoryContext oldcontext;
+
+	memset(&rename, 0, sizeof(rename));
+
+	if (classId == RelationRelationId && subId > 0)
+	{
+		char	   *attname = get_attname(objectId, subId, true);
+
+		if (attname == NULL)
+			return;
+		rename.object_type = "column";
+		rename.relid = objectId;
+		rename.attnum = subId;
+		namestrcpy(&rename.old_name, attname);
+	}
+	else if (classId == ConstraintRelationId)
+	{
+		Form_pg_constraint con;
+
+		tuple = SearchSysCache1(CONSTROID, ObjectIdGetDatum(objectId));
+		if (!HeapTupleIsValid(tuple))
+			return;
+		con = (Form_pg_constraint) GETSTRUCT(tuple);
+		rename.object_type = "constraint";
+		rename.relid = con->conrelid;
+		rename.objectid = objectId;
+		namestrcpy(&rename.old_name, NameStr(con->conname));
+		ReleaseSysCache(tuple);
+	}
+	else if (classId == TriggerRelationId)
+	{
+		Form_pg_trigger trig;
+
+		tuple = GetCatalogTupleByOid(TriggerRelationId, TriggerOidIndexId,
+									 Anum_pg_trigger_oid, objectId);
+		if (!HeapTupleIsValid(tuple))
+			return;
+		trig = (Form_pg_trigger) GETSTRUCT(tuple);
+		rename.object_type = "trigger";
+		rename.relid = trig->tgrelid;
+		rename.objectid = objectId;
+		namestrcpy(&rename.old_name, NameStr(trig->tgname));
+		heap_freetuple(tuple);
+	}
+	else
+		return;
+
+	if (!OidIsValid(rename.relid) || !MaybeManaged(rename.relid))
+		return;
+
+	oldcontext = MemoryContextSwitchTo(TopTransactionContext);
+	entry = (SagaRename *) palloc(sizeof(SagaRename));
+	memcpy(entry, &rename, sizeof(SagaRename));
+	pending_renames = lappend(pending_renames, entry);
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * Called before an object is dropped, while it can still be looked up.
+ * Triggers, constraints and defaults are ours when their relation is, and of
+ * the other objects only relations and range types matter to us.
+ */
+static void
+RememberDrop(Oid classId, Oid objectId, int subId)
+{
+	Oid			relid = InvalidOid;
+	HeapTuple	tuple;
+	MemoryContext oldcontext;
+
+	if (classId == RelationRelationId || classId == TypeRelationId)
+		relid = objectId;
+	else if (classId == ConstraintRelationId)
+	{
+		tuple = SearchSysCache1(CONSTROID, ObjectIdGetDatum(objectId));
+		if (HeapTupleIsValid(tuple))
+		{
+			relid = ((Form_pg_constraint) GETSTRUCT(tuple))->conrelid;
+			ReleaseSysCache(tuple);
+		}
+	}
+	else if (classId == TriggerRelationId)
+	{
+		tuple = GetCatalogTupleByOid(TriggerRelationId, TriggerOidIndexId,
+									 Anum_pg_trigger_oid, objectId);
+		if (HeapTupleIsValid(tuple))
+			relid = ((Form_pg_trigger) GETSTRUCT(tuple))->tgrelid;
+	}
+	else if (classId == AttrDefaultRelationId)
+	{
+		tuple = GetCatalogTupleByOid(AttrDefaultRelationId, AttrDefaultOidIndexId,
+									 Anum_pg_attrdef_oid, objectId);
+		if (HeapTupleIsValid(tuple))
+			relid = ((Form_pg_attrdef) GETSTRUCT(tuple))->adrelid;
+	}
+
+	if (!OidIsValid(relid) || !MaybeManaged(relid))
+		return;
+
+	oldcontext = MemoryContextSwitchTo(TopTransactionContext);
+	pending_drops = lappend_oid(pending_drops, relid);
+	MemoryContextSwitchTo(oldcontext);
+}
+
+static void
+sql_saga_object_access(ObjectAccessType access, Oid classId, Oid objectId,
+					   int subId, void *arg)
+{
+	if (prev_object_access_hook)
+		prev_object_access_hook(access, classId, objectId, subId, arg);
+
+	if (access == OAT_POST_ALTER)
+		RememberRename(classId, objectId, subId);
+	else if (access == OAT_DROP)
+		RememberDrop(classId, objectId, subId);
+}
+
+static void
+sql_saga_xact_callback(XactEvent event, void *arg)
+{
+	/* The lists went away with TopTransactionContext */
+	pending_renames = NIL;
+	pending_drops = NIL;
+}
+
+/*
+ * Did the hook see the command drop anything of ours?
+ */
+static bool
+AnyDroppedManagedObject(void)
+{
+	List	   *drops = pending_drops;
+	ListCell   *lc;
+
+	/* Nested commands run by drop_protection() start over */
+	pending_drops = NIL;
+
+	foreach(lc, drops)
+	{
+		Oid			relid = lfirst_oid(lc);
+
+		if (hash_search(ManagedObjects, &relid, HASH_FIND, NULL) != NULL)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Update our catalogs for the renames the hook saw.  The hook also fires for
+ * changes that don't rename anything, and a rename may have been rolled back
+ * since, so we compare with the current name before doing anything.
+ */
+static void
+FollowRenames(void)
+{
+	List	   *renames = pending_renames;
+	ListCell   *lc;
+	Oid			argtypes[4] = {TEXTOID, REGCLASSOID, NAMEOID, NAMEOID};
+	Datum		values[4];
+	const char *sql = "SELECT sql_saga._follow_rename($1, $2, $3, $4)";
+
+	pending_renames = NIL;
+
+	if (renames == NIL)
+		return;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	foreach(lc, renames)
+	{
+		SagaRename *rename = (SagaRename *) lfirst(lc);
+		char	   *current_name = GetCurrentName(rename);
+		NameData	new_name;
+		int			ret;
+
+		if (current_name == NULL || strcmp(current_name, NameStr(rename->old_name)) == 0)
+			continue;
+
+		namestrcpy(&new_name, current_name);
+		values[0] = CStringGetTextDatum(rename->object_type);
+		values[1] = ObjectIdGetDatum(rename->relid);
+		values[2] = NameGetDatum(&rename->old_name);
+		values[3] = NameGetDatum(&new_name);
+
+		ret = SPI_execute_with_args(sql, 4, argtypes, values, NULL, false, 0);
+		if (ret != SPI_OK_SELECT)
+			elog(ERROR, "SPI_execute returned %s", SPI_result_code_string(ret));
+	}
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+}
+
+/*
+ * Decide whether the command that fired an event trigger could have touched
+ * anything of ours.  Most DDL, like creating a staging table, doesn't, and
+ * then we can skip the checks altogether.  When in doubt we say yes.
+ */
+static bool
+EventMayAffectSaga(EventTriggerData *trigdata)
+{
+	/*
+	 * Indexes, triggers and constraints are ours when their relation is, and
+	 * of the other objects only range types matter to us.  A new partition or
+	 * child table is ours when its parent is.
+	 */
+	const char *ddl_commands_sql =
+		"SELECT CASE "
+		"       WHEN c.classid = 'pg_catalog.pg_class'::pg_catalog.regclass "
+		"       THEN coalesce((SELECT i.indrelid FROM pg_catalog.pg_index AS i WHERE i.indexrelid = c.objid), c.objid) "
+		"       WHEN c.classid = 'pg_catalog.pg_trigger'::pg_catalog.regclass "
+		"       THEN (SELECT t.tgrelid FROM pg_catalog.pg_trigger AS t WHERE t.oid = c.objid) "
+		"       WHEN c.classid = 'pg_catalog.pg_constraint'::pg_catalog.regclass "
+		"       THEN (SELECT k.conrelid FROM pg_catalog.pg_constraint AS k WHERE k.oid = c.objid) "
+		"       WHEN c.classid = 'pg_catalog.pg_rewrite'::pg_catalog.regclass "
+		"       THEN (SELECT r.ev_class FROM pg_catalog.pg_rewrite AS r WHERE r.oid = c.objid) "
+		"       WHEN c.classid = 'pg_catalog.pg_type'::pg_catalog.regclass "
+		"       THEN c.objid "
+		"       WHEN c.classid IS NOT NULL "
+		"       THEN 0::pg_catalog.oid "
+		"       END "
+		"FROM pg_catalog.pg_event_trigger_ddl_commands() AS c "
+		"UNION ALL "
+		"SELECT i.inhparent "
+		"FROM pg_catalog.pg_event_trigger_ddl_commands() AS c "
+		"JOIN pg_catalog.pg_inherits AS i ON i.inhrelid = c.objid "
+		"WHERE c.classid = 'pg_catalog.pg_class'::pg_catalog.regclass";
+
+	/*
+	 * The triggers and constraints are gone by now, but their relation is
+	 * named in their address.
+	 */
+	const char *dropped_objects_sql =
+		"SELECT coalesce(CASE "
+		"       WHEN d.object_type IN ('trigger', 'table constraint', 'default value') "
+		"       THEN (SELECT c.oid FROM pg_catalog.pg_class AS c "
+		"             JOIN pg_catalog.pg_namespace AS n ON n.oid = c.relnamespace "
+		"             WHERE (n.nspname, c.relname) = (d.address_names[1], d.address_names[2])) "
+		"       END, d.objid) "
+		"FROM pg_catalog.pg_event_trigger_dropped_objects() AS d";
+
+	if (!managed_objects_valid)
+		LoadManagedObjects();
+
+	/* Without any eras there is nothing to check */
+	if (hash_get_num_entries(ManagedObjects) == 0)
+		return false;
+
+	if (trigdata->parsetree != NULL && IsA(trigdata->parsetree, GrantStmt))
+		return GrantMayAffectSaga((GrantStmt *) trigdata->parsetree);
+
+	if (strcmp(trigdata->event, "sql_drop") == 0)
+	{
+		if (tracking_ddl)
+			return AnyDroppedManagedObject();
+		return AnyManagedObject(dropped_objects_sql);
+	}
+
+	return AnyManagedObject(ddl_commands_sql);
+}
+
+/*
+ * Call one of our PL/pgSQL event trigger functions with the event we got.
+ */
+static void
+CallEventTriggerFunction(FunctionCallInfo fcinfo, const char *funcname)
+{
+	Oid			funcoid;
+	FmgrInfo	flinfo;
+	PgStat_FunctionCallUsage fcusage;
+#if (PG_VERSION_NUM < 120000)
+	FunctionCallInfoData callinfo_data;
+	FunctionCallInfo callinfo = &callinfo_data;
+#else
+	LOCAL_FCINFO(callinfo, 0);
+#endif
+
+	funcoid = LookupFuncName(list_make2(makeString("sql_saga"), makeString(pstrdup(funcname))),
+							 0, NULL, false);
+	fmgr_info(funcoid, &flinfo);
+
+	InitFunctionCallInfoData(*callinfo, &flinfo, 0, InvalidOid, fcinfo->context, NULL);
+
+	/* Counted in pg_stat_user_functions like the event trigger itself */
+	pgstat_init_function_usage(callinfo, &fcusage);
+	(void) FunctionCallInvoke(callinfo);
+	pgstat_end_function_usage(&fcusage, true);
+}
+
+static Datum
+FilterEventTrigger(FunctionCallInfo fcinfo, const char *funcname)
+{
+	if (!CALLED_AS_EVENT_TRIGGER(fcinfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" was not called by event trigger manager",
+						funcname)));
+
+	if (EventMayAffectSaga((EventTriggerData *) fcinfo->context))
+		CallEventTriggerFunction(fcinfo, funcname);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * drop_protection_filter, rename_following_filter, health_checks_filter -
+ * The event triggers, which call the PL/pgSQL function of the same name only
+ * if the command could have touched something of ours.
+ */
+Datum
+drop_protection_filter(PG_FUNCTION_ARGS)
+{
+	return FilterEventTrigger(fcinfo, "drop_protection");
+}
+
+Datum
+rename_following_filter(PG_FUNCTION_ARGS)
+{
+	if (!tracking_ddl)
+		return FilterEventTrigger(fcinfo, "rename_following");
+
+	if (!CALLED_AS_EVENT_TRIGGER(fcinfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" was not called by event trigger manager",
+						"rename_following")));
+
+	FollowRenames();
+
+	/* Whatever sql_drop didn't look at is of no use any more */
+	pending_drops = NIL;
+
+	PG_RETURN_VOID();
+}
+
+Datum
+health_checks_filter(PG_FUNCTION_ARGS)
+{
+	return FilterEventTrigger(fcinfo, "health_checks");
+}
+
+/*
+ * track_ddl -
+ * The ddl_command_start event trigger.  Loading our module is all it takes
+ * to get the object access hook installed for the command, and from then on
+ * the hook sees every command of the session.
+ */
+Datum
+track_ddl(PG_FUNCTION_ARGS)
+{
+	if (!CALLED_AS_EVENT_TRIGGER(fcinfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"%s\" was not called by event trigger manager",
+						"track_ddl")));
+
+	tracking_ddl = true;
+
+	PG_RETURN_VOID();
+}
+
 void _PG_init(void) {
+	CacheRegisterRelcacheCallback(sql_saga_relcache_callback, (Datum) 0);
+	CacheRegisterSyscacheCallback(NAMESPACEOID, sql_saga_syscache_callback, (Datum) 0);
+	RegisterXactCallback(sql_saga_xact_callback, NULL);
+	SagaStatsInit();
+
+	prev_object_access_hook = object_access_hook;
+	object_access_hook = sql_saga_object_access;
 }
 
 void _PG_fini(void) {
+	object_access_hook = prev_object_access_hook;
+	UnregisterXactCallback(sql_saga_xact_callback, NULL);
 }
-
@@ -0,0 +1,127 @@
+/**
+ * sql_saga.h -
+ * Declarations shared between the C files of the sql_saga module.
+ */
+#ifndef SQL_SAGA_H
+#define SQL_SAGA_H
+
+#include "postgres.h"
+#include "access/attnum.h"
+#include "portability/instr_time.h"
+#include "utils/portal.h"
+
+/*
+ * Cached copy of a row of sql_saga.era, with the column names resolved to
+ * attribute numbers.
+ */
+typedef struct SagaEraKey
+{
+	Oid			relid;
+	NameData	era_name;
+} SagaEraKey;
+
+typedef struct SagaEra
+{
+	SagaEraKey	key;			/* the hash key; must be first */
+	bool		valid;
+	uint32		generation;		/* changes every time the entry is reloaded */
+	NameData	start_column_name;
+	NameData	end_column_name;
+	AttrNumber	start_attnum;
+	AttrNumber	end_attnum;
+	Oid			element_type;	/* type of the start and end columns */
+	int32		element_typmod;
+	Oid			range_type;
+} SagaEra;
+
+/*
+ * Cached copy of a row of sql_saga.unique_keys together with its era.
+ */
+typedef struct SagaUniqueKey
+{
+	NameData	key_name;		/* the hash key; must be first */
+	bool		valid;
+	uint32		generation;		/* changes every time the entry is reloaded */
+	int			nkeys;
+	Oid			relid;
+	NameData	schema_name;
+	NameData	table_name;
+	NameData	era_name;
+	NameData	column_names[INDEX_MAX_KEYS];
+	AttrNumber	attnums[INDEX_MAX_KEYS];
+	Oid			types[INDEX_MAX_KEYS];
+	NameData	start_column_name;
+	NameData	end_column_name;
+	AttrNumber	start_attnum;
+	AttrNumber	end_attnum;
+	Oid			element_type;	/* type of the start and end columns */
+	NameData	exclude_constraint;
+} SagaUniqueKey;
+
+/*
+ * Cached copy of a row of sql_saga.foreign_keys together with the
+ * sql_saga.unique_keys row it references and both eras.
+ */
+typedef struct SagaForeignKey
+{
+	NameData	key_name;		/* the hash key; must be first */
+	bool		valid;
+	uint32		generation;		/* changes every time the entry is reloaded */
+	int			nkeys;
+	char		match_type;		/* FKCONSTR_MATCH_xxx */
+	NameData	update_action;
+	NameData	delete_action;
+
+	/* The referencing side */
+	Oid			fk_relid;
+	NameData	fk_schema_name;
+	NameData	fk_table_name;
+	NameData	fk_era_name;
+	NameData	fk_column_names[INDEX_MAX_KEYS];
+	AttrNumber	fk_attnums[INDEX_MAX_KEYS];
+	Oid			fk_types[INDEX_MAX_KEYS];
+	NameData	fk_start_column_name;
+	NameData	fk_end_column_name;
+	AttrNumber	fk_start_attnum;
+	AttrNumber	fk_end_attnum;
+
+	/* The referenced side */
+	NameData	unique_key_name;
+	Oid			uk_relid;
+	NameData	uk_schema_name;
+	NameData	uk_table_name;
+	NameData	uk_era_name;
+	NameData	uk_column_names[INDEX_MAX_KEYS];
+	AttrNumber	uk_attnums[INDEX_MAX_KEYS];
+	NameData	uk_start_column_name;
+	NameData	uk_end_column_name;
+	AttrNumber	uk_start_attnum;
+	AttrNumber	uk_end_attnum;
+	Oid			element_type;	/* type of the start and end columns */
+	Oid			range_type;
+} SagaForeignKey;
+
+/*
+ * Catalog lookups.  The returned pointers stay valid until the next lookup
+ * after a cache invalidation, so callers should copy what they need before
+ * running queries.
+ */
+extern const SagaForeignKey *SagaLookupForeignKey(const char *key_name, bool missing_ok);
+extern const SagaUniqueKey *SagaLookupUniqueKey(const char *key_name, bool missing_ok);
+extern const SagaEra *SagaLookupEra(Oid relid, const char *era_name, bool missing_ok);
+extern const SagaEra *SagaLookupApiView(Oid view_relid, bool missing_ok);
+
+/* Coverage check over an open cursor of (start, end) rows, in no_gaps.c */
+extern bool SagaCoveredByCursor(Portal portal, Oid element_type,
+								Datum target_start, Datum target_end,
+								bool end_inclusive);
+
+/* Statistics of the key checks, in stats.c */
+#define SAGA_STATS_FOREIGN_KEY	'f'
+#define SAGA_STATS_UNIQUE_KEY	'u'
+
+extern void SagaStatsInit(void);
+extern void SagaStatsCount(char kind, const char *key_name, instr_time start,
+						   int64 rows_checked, int64 rows_scanned, bool violation);
+
+#endif							/* SQL_SAGA_H */
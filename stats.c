@@ -0,0 +1,397 @@
+/**
+ * stats.c -
+ * Counters for the checks of every foreign key and unique key, behind the
+ * sql_saga.stat_foreign_keys and sql_saga.stat_unique_keys views.
+ *
+ * When the module is in shared_preload_libraries the counters live in shared
+ * memory and cover the whole server.  Otherwise there is nowhere to share them
+ * and each backend only counts its own checks.
+ */
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <access/htup_details.h>
+#include <funcapi.h>
+#include <miscadmin.h>
+#include <portability/instr_time.h>
+#include <storage/ipc.h>
+#include <storage/lwlock.h>
+#include <storage/shmem.h>
+#include <storage/spin.h>
+#include <utils/builtins.h>
+#include <utils/guc.h>
+#include <utils/hsearch.h>
+#include <utils/memutils.h>
+#include <utils/timestamp.h>
+
+#include "sql_saga.h"
+
+PGDLLEXPORT Datum check_stats(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum count_batch_check(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum stat_reset(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(check_stats);
+PG_FUNCTION_INFO_V1(count_batch_check);
+PG_FUNCTION_INFO_V1(stat_reset);
+
+typedef struct SagaStatsKey
+{
+	Oid			dbid;
+	char		kind;			/* SAGA_STATS_xxx */
+	NameData	key_name;
+} SagaStatsKey;
+
+typedef struct SagaStatsEntry
+{
+	SagaStatsKey key;			/* the hash key; must be first */
+	slock_t		mutex;			/* protects the counters in shared memory */
+	int64		calls;
+	int64		rows_checked;
+	int64		rows_scanned;
+	int64		violations;
+	double		total_time;		/* in milliseconds */
+	double		max_time;
+} SagaStatsEntry;
+
+/* Settings */
+static bool sql_saga_track_checks = true;
+static int	sql_saga_stats_max_keys = 1000;
+
+/* The counters, and the lock on the hash table if it is shared */
+static HTAB *StatsHash = NULL;
+static LWLock *StatsLock = NULL;
+static bool stats_shared = false;
+
+#if (PG_VERSION_NUM >= 150000)
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static Size
+StatsShmemSize(void)
+{
+	return hash_estimate_size(sql_saga_stats_max_keys, sizeof(SagaStatsEntry));
+}
+
+static void
+StatsShmemRequest(void)
+{
+#if (PG_VERSION_NUM >= 150000)
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+
+	RequestAddinShmemSpace(StatsShmemSize());
+	RequestNamedLWLockTranche("sql_saga", 1);
+}
+
+static void
+StatsShmemStartup(void)
+{
+	HASHCTL		ctl;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(SagaStatsKey);
+	ctl.entrysize = sizeof(SagaStatsEntry);
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	StatsHash = ShmemInitHash("sql_saga check statistics",
+							  sql_saga_stats_max_keys, sql_saga_stats_max_keys,
+							  &ctl, HASH_ELEM | HASH_BLOBS);
+	StatsLock = &(GetNamedLWLockTranche("sql_saga"))->lock;
+	LWLockRelease(AddinShmemInitLock);
+
+	stats_shared = true;
+}
+
+/*
+ * Called from _PG_init.
+ */
+void
+SagaStatsInit(void)
+{
+	DefineCustomBoolVariable("sql_saga.track_checks",
+							 "Collects statistics on the checks of foreign keys and unique keys.",
+							 NULL,
+							 &sql_saga_track_checks,
+							 true,
+							 PGC_SUSET,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomIntVariable("sql_saga.stats_max_keys",
+							"Sets the number of keys tracked in shared memory.",
+							"Only used when sql_saga is in shared_preload_libraries.",
+							&sql_saga_stats_max_keys,
+							1000, 100, INT_MAX / 2,
+							PGC_POSTMASTER,
+							0,
+							NULL, NULL, NULL);
+
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if (PG_VERSION_NUM >= 150000)
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = StatsShmemRequest;
+#else
+	StatsShmemRequest();
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = StatsShmemStartup;
+}
+
+static void
+EnsureLocalStats(void)
+{
+	HASHCTL		ctl;
+
+	if (StatsHash != NULL)
+		return;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(SagaStatsKey);
+	ctl.entrysize = sizeof(SagaStatsEntry);
+	StatsHash = hash_create("sql_saga check statistics", 16, &ctl, HASH_ELEM | HASH_BLOBS);
+}
+
+/*
+ * Add one check of a key that took `elapsed` milliseconds to its counters.
+ */
+static void
+StatsAdd(char kind, const char *key_name, double elapsed,
+		 int64 rows_checked, int64 rows_scanned, bool violation)
+{
+	SagaStatsKey key;
+	SagaStatsEntry *entry;
+	bool		found;
+
+	memset(&key, 0, sizeof(key));
+	key.dbid = MyDatabaseId;
+	key.kind = kind;
+	namestrcpy(&key.key_name, key_name);
+
+	if (!stats_shared)
+	{
+		EnsureLocalStats();
+		entry = (SagaStatsEntry *) hash_search(StatsHash, &key, HASH_ENTER, &found);
+		if (!found)
+			memset(((char *) entry) + sizeof(SagaStatsKey), 0,
+				   sizeof(SagaStatsEntry) - sizeof(SagaStatsKey));
+
+		entry->calls++;
+		entry->rows_checked += rows_checked;
+		entry->rows_scanned += rows_scanned;
+		entry->violations += violation ? 1 : 0;
+		entry->total_time += elapsed;
+		if (elapsed > entry->max_time)
+			entry->max_time = elapsed;
+		return;
+	}
+
+	/* Most of the time the entry is there, and a shared lock will do */
+	LWLockAcquire(StatsLock, LW_SHARED);
+	entry = (SagaStatsEntry *) hash_search(StatsHash, &key, HASH_FIND, NULL);
+	if (entry == NULL)
+	{
+		LWLockRelease(StatsLock);
+		LWLockAcquire(StatsLock, LW_EXCLUSIVE);
+
+		/* When the table is full, the key just isn't counted */
+		entry = (SagaStatsEntry *) hash_search(StatsHash, &key, HASH_ENTER_NULL, &found);
+		if (entry != NULL && !found)
+		{
+			SpinLockInit(&entry->mutex);
+			entry->calls = 0;
+			entry->rows_checked = 0;
+			entry->rows_scanned = 0;
+			entry->violations = 0;
+			entry->total_time = 0;
+			entry->max_time = 0;
+		}
+	}
+
+	if (entry != NULL)
+	{
+		SpinLockAcquire(&entry->mutex);
+		entry->calls++;
+		entry->rows_checked += rows_checked;
+		entry->rows_scanned += rows_scanned;
+		entry->violations += violation ? 1 : 0;
+		entry->total_time += elapsed;
+		if (elapsed > entry->max_time)
+			entry->max_time = elapsed;
+		SpinLockRelease(&entry->mutex);
+	}
+
+	LWLockRelease(StatsLock);
+}
+
+/*
+ * Count one check of a key that started at `start`.  rows_checked is the
+ * number of rows the check had to look at the other table for, and
+ * rows_scanned the number of rows it read there, if known.
+ */
+void
+SagaStatsCount(char kind, const char *key_name, instr_time start,
+			   int64 rows_checked, int64 rows_scanned, bool violation)
+{
+	instr_time	now;
+
+	if (!sql_saga_track_checks)
+		return;
+
+	INSTR_TIME_SET_CURRENT(now);
+	INSTR_TIME_SUBTRACT(now, start);
+	StatsAdd(kind, key_name, INSTR_TIME_GET_MILLISEC(now),
+			 rows_checked, rows_scanned, violation);
+}
+
+/*
+ * count_batch_check -
+ * Counts one run of fk_batch_check() or uk_batch_check() for the given
+ * foreign key, which started at `started` and checked `rows_checked` rows.
+ * Checks of the referenced side are counted under the unique key, like
+ * those of uk_update_check() and uk_delete_check().
+ */
+Datum
+count_batch_check(PG_FUNCTION_ARGS)
+{
+	Name		foreign_key_name = PG_GETARG_NAME(0);
+	bool		referenced = PG_GETARG_BOOL(1);
+	TimestampTz	started = PG_GETARG_TIMESTAMPTZ(2);
+	int64		rows_checked = PG_GETARG_INT64(3);
+	bool		violation = PG_GETARG_BOOL(4);
+	const SagaForeignKey *fk;
+	long		secs;
+	int			usecs;
+
+	if (!sql_saga_track_checks)
+		PG_RETURN_VOID();
+
+	fk = SagaLookupForeignKey(NameStr(*foreign_key_name), false);
+	TimestampDifference(started, GetCurrentTimestamp(), &secs, &usecs);
+
+	StatsAdd(referenced ? SAGA_STATS_UNIQUE_KEY : SAGA_STATS_FOREIGN_KEY,
+			 referenced ? NameStr(fk->unique_key_name) : NameStr(fk->key_name),
+			 secs * 1000.0 + usecs / 1000.0,
+			 rows_checked, 0, violation);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * check_stats -
+ * Returns the counters of the keys of the current database.
+ */
+Datum
+check_stats(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	SagaStatsEntry *entries;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext	oldcontext;
+		TupleDesc		tupdesc;
+		HASH_SEQ_STATUS	status;
+		SagaStatsEntry *entry;
+		int				count = 0;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		/* Copy the entries, so we don't hold the lock between calls */
+		if (!stats_shared)
+			EnsureLocalStats();
+		else
+			LWLockAcquire(StatsLock, LW_SHARED);
+
+		entries = (SagaStatsEntry *) palloc(sizeof(SagaStatsEntry) *
+											Max(hash_get_num_entries(StatsHash), 1));
+
+		hash_seq_init(&status, StatsHash);
+		while ((entry = (SagaStatsEntry *) hash_seq_search(&status)) != NULL)
+		{
+			if (entry->key.dbid != MyDatabaseId)
+				continue;
+
+			if (stats_shared)
+				SpinLockAcquire(&entry->mutex);
+			memcpy(&entries[count], entry, sizeof(SagaStatsEntry));
+			if (stats_shared)
+				SpinLockRelease(&entry->mutex);
+			count++;
+		}
+
+		if (stats_shared)
+			LWLockRelease(StatsLock);
+
+		funcctx->user_fctx = entries;
+		funcctx->max_calls = count;
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	entries = (SagaStatsEntry *) funcctx->user_fctx;
+
+	if (funcctx->call_cntr < funcctx->max_calls)
+	{
+		SagaStatsEntry *entry = &entries[funcctx->call_cntr];
+		Datum		values[8];
+		bool		nulls[8];
+		HeapTuple	tuple;
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = CharGetDatum(entry->key.kind);
+		values[1] = NameGetDatum(&entry->key.key_name);
+		values[2] = Int64GetDatum(entry->calls);
+		values[3] = Int64GetDatum(entry->rows_checked);
+		values[4] = Int64GetDatum(entry->rows_scanned);
+		values[5] = Int64GetDatum(entry->violations);
+		values[6] = Float8GetDatum(entry->total_time);
+		values[7] = Float8GetDatum(entry->max_time);
+
+		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
+
+/*
+ * stat_reset -
+ * Throws away the counters of the keys of the current database.
+ */
+Datum
+stat_reset(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS status;
+	SagaStatsEntry *entry;
+
+	if (!stats_shared)
+		EnsureLocalStats();
+	else
+		LWLockAcquire(StatsLock, LW_EXCLUSIVE);
+
+	hash_seq_init(&status, StatsHash);
+	while ((entry = (SagaStatsEntry *) hash_seq_search(&status)) != NULL)
+	{
+		if (entry->key.dbid == MyDatabaseId)
+			hash_search(StatsHash, &entry->key, HASH_REMOVE, NULL);
+	}
+
+	if (stats_shared)
+		LWLockRelease(StatsLock);
+
+	PG_RETURN_VOID();
+}